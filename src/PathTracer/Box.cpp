@@ -53,58 +53,72 @@ bool Box::RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out)
     if (tHit < _tMin) tHit = tExit;              // start inside box -> exit is first valid
     if (tHit < _tMin || tHit > _tMax) return false;
 
-    // 5) Hit point in local and world space
-    glm::vec3 pLocal = roLocal + tHit * rdLocal;
-    glm::vec3 pWorld = _ray.origin + tHit * _ray.direction;
+    // Record which face was hit as the primitive id: axis * 2 + (1 if the face is on the negative side)
+    int axis;
+    float outwardSign;
+    if (tHit == tEntry)
+    {
+        // Entering: the slab that entered last, its face looks back against the ray
+        axis = (tMin3.x >= tMin3.y && tMin3.x >= tMin3.z) ? 0 : (tMin3.y >= tMin3.z ? 1 : 2);
+        outwardSign = rdLocal[axis] > 0.0f ? -1.0f : 1.0f;
+    }
+    else
+    {
+        // Exiting from inside: the slab that exited first, its face looks along the ray
+        axis = (tMax3.x <= tMax3.y && tMax3.x <= tMax3.z) ? 0 : (tMax3.y <= tMax3.z ? 1 : 2);
+        outwardSign = rdLocal[axis] > 0.0f ? 1.0f : -1.0f;
+    }
 
-    // 6) Compute geometric outward normal in local space
-    // Determine which face we hit by seeing which coordinate is on a face.
+    _out.t = tHit;
+    _out.primitive = uint32_t(axis * 2 + (outwardSign < 0.0f ? 1 : 0));
+    return true;
+}
+
+void Box::ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const
+{
+    // Same local frame as RayIntersect
+    glm::mat4 R = glm::mat4(1.0f);
+    R = glm::rotate(R, glm::radians(mRotation.x), glm::vec3(1, 0, 0));
+    R = glm::rotate(R, glm::radians(mRotation.y), glm::vec3(0, 1, 0));
+    R = glm::rotate(R, glm::radians(mRotation.z), glm::vec3(0, 0, 1));
+
+    glm::mat3 worldFromLocal = glm::mat3(R);
+
+    // 5) Hit point in world space
+    glm::vec3 pWorld = _ray.origin + _hit.t * _ray.direction;
+
+    // 6) Geometric outward normal in local space from the face recorded by RayIntersect
     glm::vec3 nLocal(0.0f);
-    const float eps = 1e-4f * glm::max(glm::max(halfExtents.x, halfExtents.y), halfExtents.z);
-
-    if (std::abs(pLocal.x - halfExtents.x) <= eps) nLocal = glm::vec3(1, 0, 0);
-    else if (std::abs(pLocal.x + halfExtents.x) <= eps) nLocal = glm::vec3(-1, 0, 0);
-    else if (std::abs(pLocal.y - halfExtents.y) <= eps) nLocal = glm::vec3(0, 1, 0);
-    else if (std::abs(pLocal.y + halfExtents.y) <= eps) nLocal = glm::vec3(0, -1, 0);
-    else if (std::abs(pLocal.z - halfExtents.z) <= eps) nLocal = glm::vec3(0, 0, 1);
-    else if (std::abs(pLocal.z + halfExtents.z) <= eps) nLocal = glm::vec3(0, 0, -1);
-    else {
-        // Fallback: pick the axis with largest t-entry to decide the face
-        // (Rarely needed, but robust if we're slightly inside due to FP)
-        float txEntry = tMin3.x, tyEntry = tMin3.y, tzEntry = tMin3.z;
-        if (tEntry == txEntry) nLocal = glm::vec3((roLocal.x + tEntry * rdLocal.x) > 0.0f ? 1 : -1, 0, 0);
-        else if (tEntry == tyEntry) nLocal = glm::vec3(0, (roLocal.y + tEntry * rdLocal.y) > 0.0f ? 1 : -1, 0);
-        else                        nLocal = glm::vec3(0, 0, (roLocal.z + tEntry * rdLocal.z) > 0.0f ? 1 : -1);
-    }
+    nLocal[_hit.primitive / 2] = (_hit.primitive & 1u) ? -1.0f : 1.0f;
 
     // 7) Transform normal back to world and face-forward
     glm::vec3 nWorld = glm::normalize(worldFromLocal * nLocal);
     bool frontFace = glm::dot(_ray.direction, nWorld) < 0.0f;
     glm::vec3 shadingNormal = frontFace ? nWorld : -nWorld;
 
-    // 8) Fill hit record
-    _out.t = tHit;
+    // 8) Fill surface record
     _out.p = pWorld;
     _out.n = shadingNormal;
-    _out.mat = &mMaterial;
-
-    return true;
+    _out.frontFace = frontFace;
+    _out.mat = mMaterial;
 }
 
-void Box::UpdateUI()
+bool Box::UpdateUI()
 {
+    bool changed = false;
     if (ImGui::TreeNode(mName.c_str()))
     {
-        ImGui::DragFloat3("Position ", &mPosition[0], 0.1);
-		ImGui::DragFloat3("Rotation ", &mRotation[0], 1.0f, 0, 360);
-        ImGui::DragFloat3("Size ", &mSize[0], 0.1f);
-        ImGui::ColorEdit3("Albedo", &mMaterial.albedo.r);
-        ImGui::SliderFloat("Roughness", &mMaterial.roughness, 0.0f, 1.0f);
-        ImGui::SliderFloat("Metallic", &mMaterial.metallic, 0.0f, 1.0f);
-        ImGui::ColorEdit3("Emission Colour", &mMaterial.emissionColour.r);
-        ImGui::SliderFloat("Emission Strength", &mMaterial.emissionStrength, 0.0f, 100.0f);
-        ImGui::SliderFloat("Index of Refraction", &mMaterial.IOR, 1.0f, 3.0f);
-        ImGui::SliderFloat("Transmission", &mMaterial.transmission, 0.0f, 1.0f);
+        changed |= ImGui::DragFloat3("Position ", &mPosition[0], 0.1);
+		changed |= ImGui::DragFloat3("Rotation ", &mRotation[0], 1.0f, 0, 360);
+        changed |= ImGui::DragFloat3("Size ", &mSize[0], 0.1f);
+        changed |= ImGui::ColorEdit3("Albedo", &mMaterial.albedo.r);
+        changed |= ImGui::SliderFloat("Roughness", &mMaterial.roughness, 0.0f, 1.0f);
+        changed |= ImGui::SliderFloat("Metallic", &mMaterial.metallic, 0.0f, 1.0f);
+        changed |= ImGui::ColorEdit3("Emission Colour", &mMaterial.emissionColour.r);
+        changed |= ImGui::SliderFloat("Emission Strength", &mMaterial.emissionStrength, 0.0f, 100.0f);
+        changed |= ImGui::SliderFloat("Index of Refraction", &mMaterial.IOR, 1.0f, 3.0f);
+        changed |= ImGui::SliderFloat("Transmission", &mMaterial.transmission, 0.0f, 1.0f);
         ImGui::TreePop();
     }
+    return changed;
 }
\ No newline at end of file
@@ -11,8 +11,9 @@ public:
 	~Box() {}
 
 	bool RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) override;
+	void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const override;
 
-	void UpdateUI() override;
+	bool UpdateUI() override;
 
 	void SetSize(const glm::vec3& _size) { mSize = _size; }
 	glm::vec3 GetSize() { return mSize; }
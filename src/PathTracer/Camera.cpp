@@ -2,6 +2,8 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <cmath>
+
 Camera::Camera(glm::ivec2 _winSize)
 {
     mLastWinSize = _winSize;
@@ -35,7 +37,7 @@ void Camera::CalculateMatrices(glm::ivec2 _winSize)
 }
 
 // This function generates a ray from the camera through a point on the screen
-Ray Camera::GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize)
+Ray Camera::GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize, glm::vec2 _offset)
 {
     if (mLastWinSize != _windowSize)
     {
@@ -44,8 +46,8 @@ Ray Camera::GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize)
 	}
 
     // 1) NDC
-    float nx = ((_windowPos.x + 0.5f) / float(_windowSize.x)) * 2.f - 1.f;
-    float ny = ((_windowPos.y + 0.5f) / float(_windowSize.y)) * 2.f - 1.f;
+    float nx = ((_windowPos.x + _offset.x) / float(_windowSize.x)) * 2.f - 1.f;
+    float ny = ((_windowPos.y + _offset.y) / float(_windowSize.y)) * 2.f - 1.f;
 
     // 2) Clip near/far
     glm::vec4 clipNear(nx, ny, -1.f, 1.f);
@@ -63,8 +65,39 @@ Ray Camera::GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize)
     return Ray{ originWorld, dirWorld };
 }
 
+bool Camera::Project(const glm::vec3& _point, glm::ivec2 _windowSize, glm::vec2& _raster) const
+{
+    const glm::vec4 clip = mProj * mView * glm::vec4(_point, 1.0f);
+    if (clip.w <= 0.0f)
+        return false;
+
+    // Inverse of GetRay's raster to NDC mapping
+    const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    _raster = (ndc * 0.5f + 0.5f) * glm::vec2(_windowSize);
+    return _raster.x >= 0.0f && _raster.y >= 0.0f && _raster.x < float(_windowSize.x) && _raster.y < float(_windowSize.y);
+}
+
+float Camera::Importance(const glm::vec3& _direction, glm::ivec2 _windowSize, float& _pdf) const
+{
+    _pdf = 0.0f;
+    const float cosTheta = glm::dot(GetForward(), _direction);
+    if (cosTheta <= 0.0f)
+        return 0.0f;
+
+    glm::vec2 raster;
+    if (!Project(mPosition + _direction, _windowSize, raster))
+        return 0.0f;
+
+    // Image plane at distance 1; points on it are uniform, so the solid-angle density falls off with cos^3
+    const float tanHalf = std::tan(glm::radians(mFov) * 0.5f);
+    const float area = 4.0f * tanHalf * tanHalf * float(_windowSize.x) / float(_windowSize.y);
+    const float cos2 = cosTheta * cosTheta;
+    _pdf = 1.0f / (area * cos2 * cosTheta);
+    return 1.0f / (area * cos2 * cos2);
+}
+
 // Helper functions to get the camera's forward, right, and up vectors
-glm::vec3 Camera::GetForward()
+glm::vec3 Camera::GetForward() const
 {
     return glm::normalize(glm::mat3(mInvView) * glm::vec3(0, 0, -1));
 }
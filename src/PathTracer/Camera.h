@@ -9,13 +9,22 @@ public:
 	Camera(glm::vec3 _position, glm::vec3 _rotation, glm::ivec2 _winSize);
 	~Camera() {}
 
-	Ray GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize);
+	// _offset is the position inside the pixel, in [0,1)^2
+	Ray GetRay(glm::ivec2 _windowPos, glm::ivec2 _windowSize, glm::vec2 _offset = glm::vec2(0.5f));
 
 	void CalculateMatrices(glm::ivec2 _winSize);
 
+	// Light tracing: the raster position (pixels, as passed to GetRay) that sees _point; false if it is behind the camera or off screen
+	bool Project(const glm::vec3& _point, glm::ivec2 _windowSize, glm::vec2& _raster) const;
+	// Pinhole importance We towards _direction, normalised to integrate to one over the image, and the solid-angle
+	// density of GetRay's directions when pixels and offsets are uniform. Both are 0 outside the view
+	float Importance(const glm::vec3& _direction, glm::ivec2 _windowSize, float& _pdf) const;
+	// World to clip space, as Project uses it
+	glm::mat4 GetViewProjection() const { return mProj * mView; }
+
 	// Only recalculate matricies if the cameras position has changed
 	void SetPosition(glm::vec3 _position) { mPosition = _position; CalculateMatrices(mLastWinSize); }
-	glm::vec3 GetPosition() { return mPosition; }
+	glm::vec3 GetPosition() const { return mPosition; }
 
 	void SetRotation(glm::vec3 _rotation) { mRotation = _rotation; CalculateMatrices(mLastWinSize); }
 	glm::vec3 GetRotation() { return mRotation; }
@@ -29,7 +38,7 @@ public:
 	void SetFarPlane(float _far) { mFarPlane = _far; CalculateMatrices(mLastWinSize); }
 	float GetFarPlane() { return mFarPlane; }
 
-	glm::vec3 GetForward();
+	glm::vec3 GetForward() const;
 	glm::vec3 GetRight();
 	glm::vec3 GetUp();
 
@@ -0,0 +1,513 @@
+#include "CompiledScene.h"
+
+#include "MathUtil.h"
+#include "Sphere.h"
+#include "Box.h"
+#include "Mesh.h"
+
+#include <algorithm>
+#include <limits>
+
+void CompiledScene::Compile(const std::vector<std::shared_ptr<RayObject>>& _objects, const EnvironmentMap* _environment)
+{
+    std::vector<std::unique_ptr<BakedMesh>> previous = std::move(mMeshes);
+    mMeshes.clear();
+    mFallback.clear();
+    mAnalytic.Clear();
+    mSphereObject.clear();
+    mBoxObject.clear();
+    mFallbackObject.clear();
+
+    for (uint32_t index = 0; index < uint32_t(_objects.size()); ++index)
+    {
+        const auto& object = _objects[index];
+        if (auto sphere = std::dynamic_pointer_cast<Sphere>(object))
+        {
+            mAnalytic.AddSphere(sphere->GetPosition(), sphere->GetRadius(), mAnalytic.AddMaterial(sphere->GetMaterial()));
+        }
+        else if (auto box = std::dynamic_pointer_cast<Box>(object))
+        {
+            mAnalytic.AddBox(box->GetPosition(), box->GetRotation(), box->GetSize(), mAnalytic.AddMaterial(box->GetMaterial()));
+        }
+        else if (auto batch = std::dynamic_pointer_cast<PrimitiveBatch>(object))
+        {
+            mAnalytic.Append(*batch);
+        }
+        else if (auto mesh = std::dynamic_pointer_cast<Mesh>(object))
+        {
+            glm::mat4 M, Minv;
+            mesh->BuildTransform(M, Minv);
+
+            // Rebaking is the expensive part of a compile, so keep any mesh that has not moved
+            std::unique_ptr<BakedMesh> baked;
+            for (auto& old : previous)
+            {
+                if (old && old->source == mesh.get() && old->transform == M)
+                {
+                    baked = std::move(old);
+                    break;
+                }
+            }
+            if (!baked)
+                baked = BakeMesh(object, *mesh, M);
+
+            baked->objectIndex = index;
+            mMeshes.push_back(std::move(baked));
+        }
+        else
+        {
+            mFallback.push_back(object);
+            mFallbackObject.push_back(index);
+        }
+
+        // Everything the analytic batch gained from this object belongs to it
+        mSphereObject.resize(mAnalytic.GetSphereCount(), index);
+        mBoxObject.resize(mAnalytic.GetBoxCount(), index);
+    }
+
+    // Material keys: the analytic table, then each mesh's groups (key 0 of a mesh is "no group"), then one per fallback object
+    mMaterialBase.clear();
+    mMaterialBase.push_back(0);
+    mMaterialBase.push_back(uint32_t(mAnalytic.GetMaterialCount()));
+    for (const auto& baked : mMeshes)
+        mMaterialBase.push_back(mMaterialBase.back() + 1 + uint32_t(baked->source->GetModel()->GetMaterialGroups().size()));
+    for (size_t i = 0; i < mFallback.size(); ++i)
+        mMaterialBase.push_back(mMaterialBase.back() + 1);
+
+    mAnalytic.Build();
+    BuildLights(_environment);
+    BuildBounds();
+}
+
+void CompiledScene::BuildBounds()
+{
+    struct Instance
+    {
+        uint32_t slot;
+        glm::vec3 bmin, bmax;
+    };
+    std::vector<Instance> instances;
+
+    if (mAnalytic.GetSphereCount() + mAnalytic.GetBoxCount() > 0)
+    {
+        Instance analytic{ uint32_t(kAnalyticSlot), glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+        for (size_t i = 0; i < mAnalytic.GetSphereCount(); ++i)
+        {
+            glm::vec3 centre;
+            float radius;
+            mAnalytic.GetSphere(i, centre, radius);
+            analytic.bmin = glm::min(analytic.bmin, centre - glm::vec3(radius));
+            analytic.bmax = glm::max(analytic.bmax, centre + glm::vec3(radius));
+        }
+
+        for (size_t i = 0; i < mAnalytic.GetBoxCount(); ++i)
+        {
+            glm::vec3 centre, halfAxes[3];
+            mAnalytic.GetBox(i, centre, halfAxes);
+            const glm::vec3 extent = glm::abs(halfAxes[0]) + glm::abs(halfAxes[1]) + glm::abs(halfAxes[2]);
+            analytic.bmin = glm::min(analytic.bmin, centre - extent);
+            analytic.bmax = glm::max(analytic.bmax, centre + extent);
+        }
+        instances.push_back(analytic);
+    }
+
+    for (size_t m = 0; m < mMeshes.size(); ++m)
+    {
+        if (!mMeshes[m]->faces.empty())
+            instances.push_back({ uint32_t(kAnalyticSlot + 1 + m), mMeshes[m]->bmin, mMeshes[m]->bmax });
+    }
+
+    mBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+    mBoundsMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (const Instance& instance : instances)
+    {
+        mBoundsMin = glm::min(mBoundsMin, instance.bmin);
+        mBoundsMax = glm::max(mBoundsMax, instance.bmax);
+    }
+
+    // Median splits on the centres, one slot per leaf
+    mTlas.clear();
+    if (instances.empty())
+        return;
+    mTlas.reserve(2 * instances.size());
+
+    auto buildNode = [&](auto& _self, uint32_t _start, uint32_t _count) -> uint32_t
+        {
+            const uint32_t nodeIndex = uint32_t(mTlas.size());
+            mTlas.push_back(TlasNode{});
+
+            glm::vec3 bmin = instances[_start].bmin, bmax = instances[_start].bmax;
+            for (uint32_t i = _start + 1; i < _start + _count; ++i)
+            {
+                bmin = glm::min(bmin, instances[i].bmin);
+                bmax = glm::max(bmax, instances[i].bmax);
+            }
+            mTlas[nodeIndex].bmin = bmin;
+            mTlas[nodeIndex].bmax = bmax;
+
+            if (_count == 1)
+            {
+                mTlas[nodeIndex].leftFirst = instances[_start].slot;
+                mTlas[nodeIndex].rightChild = 0;
+                mTlas[nodeIndex].count = 1; // LEAF
+                return nodeIndex;
+            }
+
+            const glm::vec3 extent = bmax - bmin;
+            const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+            const uint32_t leftCount = _count / 2;
+            std::nth_element(instances.begin() + _start, instances.begin() + _start + leftCount, instances.begin() + _start + _count,
+                [&](const Instance& _a, const Instance& _b) { return _a.bmin[axis] + _a.bmax[axis] < _b.bmin[axis] + _b.bmax[axis]; });
+
+            const uint32_t left = _self(_self, _start, leftCount);
+            const uint32_t right = _self(_self, _start + leftCount, _count - leftCount);
+            mTlas[nodeIndex].leftFirst = left;
+            mTlas[nodeIndex].rightChild = right;
+            mTlas[nodeIndex].count = 0; // INNER
+            return nodeIndex;
+        };
+    buildNode(buildNode, 0, uint32_t(instances.size()));
+}
+
+void CompiledScene::BuildLights(const EnvironmentMap* _environment)
+{
+    mLights.Clear();
+    mLights.SetEnvironment(_environment);
+    mSphereLight.assign(mAnalytic.GetSphereCount(), -1);
+    mBoxLight.assign(mAnalytic.GetBoxCount(), -1);
+
+    for (size_t i = 0; i < mAnalytic.GetSphereCount(); ++i)
+    {
+        const Material& mat = mAnalytic.GetPrimitiveMaterial(uint32_t(i));
+        const float lum = Luminance(mat.emissionColour * mat.emissionStrength);
+        if (lum <= 0.0f) continue;
+
+        Light light;
+        light.type = Light::Type::Sphere;
+        mAnalytic.GetSphere(i, light.v0, light.radius);
+        light.area = 4.0f * kPi * light.radius * light.radius;
+        light.power = lum * light.area;
+        light.object = kAnalyticSlot;
+        light.primitive = uint32_t(i);
+        if (light.area > 0.0f)
+            mSphereLight[i] = int32_t(mLights.Add(light));
+    }
+
+    for (size_t i = 0; i < mAnalytic.GetBoxCount(); ++i)
+    {
+        const uint32_t primitive = PrimitiveBatch::kBoxBit | uint32_t(i);
+        const Material& mat = mAnalytic.GetPrimitiveMaterial(primitive);
+        const float lum = Luminance(mat.emissionColour * mat.emissionStrength);
+        if (lum <= 0.0f) continue;
+
+        Light light;
+        light.type = Light::Type::Box;
+        glm::vec3 axes[3];
+        mAnalytic.GetBox(i, light.v0, axes);
+        light.v1 = axes[0]; light.v2 = axes[1]; light.v3 = axes[2];
+        const float lx = glm::length(axes[0]), ly = glm::length(axes[1]), lz = glm::length(axes[2]);
+        light.area = 8.0f * (lx * ly + ly * lz + lz * lx);
+        light.power = lum * light.area;
+        light.object = kAnalyticSlot;
+        light.primitive = primitive;
+        if (light.area > 0.0f)
+            mBoxLight[i] = int32_t(mLights.Add(light));
+    }
+
+    for (size_t m = 0; m < mMeshes.size(); ++m)
+    {
+        BakedMesh& baked = *mMeshes[m];
+        baked.faceLight.clear();
+
+        const auto& groups = baked.source->GetModel()->GetMaterialGroups();
+        for (size_t f = 0; f < baked.faces.size(); ++f)
+        {
+            const auto& face = baked.faces[f];
+            if (face.materialGroup < 0) continue;
+            if (groups[size_t(face.materialGroup)].pbr.emissiveFactor == glm::vec3(0.0f)) continue;
+
+            // Faces the alpha mask removes entirely can never be hit, so they are not lights either
+            const float coverage = baked.bvh.OpaqueFraction(uint32_t(f));
+            if (coverage <= 0.0f) continue;
+
+            Light light;
+            light.type = Light::Type::Triangle;
+            light.v0 = face.a.position; light.v1 = face.b.position; light.v2 = face.c.position;
+            light.area = 0.5f * glm::length(glm::cross(light.v1 - light.v0, light.v2 - light.v0));
+            if (light.area <= 0.0f) continue;
+
+            // Emission can be textured, so estimate power from the value at the centroid, scaled by alpha coverage
+            SurfaceInteraction si;
+            const Ray probe(light.v0 + glm::vec3(1.0f), glm::vec3(-1.0f));
+            baked.source->ComputeFaceInteraction(face, glm::vec2(1.0f / 3.0f), glm::mat4(1.0f), glm::mat3(1.0f), probe, si);
+            light.power = Luminance(si.mat.emissionColour * si.mat.emissionStrength) * 2.0f * light.area * coverage; // Both sides emit
+            light.object = kAnalyticSlot + 1 + int(m);
+            light.primitive = uint32_t(f);
+
+            if (baked.faceLight.empty())
+                baked.faceLight.assign(baked.faces.size(), -1);
+            baked.faceLight[f] = int32_t(mLights.Add(light));
+        }
+    }
+
+    mLights.Build();
+}
+
+bool CompiledScene::IsOpaque(const Hit& _hit) const
+{
+    const size_t slot = size_t(_hit.object - kAnalyticSlot - 1);
+    if (_hit.object != kAnalyticSlot && slot < mMeshes.size())
+        return mMeshes[slot]->bvh.IsOpaque(_hit.primitive, _hit.uv.x, _hit.uv.y);
+    return true;
+}
+
+int CompiledScene::GetLightIndex(const Hit& _hit) const
+{
+    if (_hit.object == kAnalyticSlot)
+    {
+        if (_hit.primitive & PrimitiveBatch::kBoxBit)
+            return mBoxLight[_hit.primitive & ~PrimitiveBatch::kBoxBit];
+        return mSphereLight[_hit.primitive];
+    }
+
+    const size_t slot = size_t(_hit.object - kAnalyticSlot - 1);
+    if (slot < mMeshes.size())
+    {
+        const auto& faceLight = mMeshes[slot]->faceLight;
+        return faceLight.empty() ? -1 : faceLight[_hit.primitive];
+    }
+    return -1;
+}
+
+uint32_t CompiledScene::GetObjectIndex(const Hit& _hit) const
+{
+    if (_hit.object == kAnalyticSlot)
+    {
+        if (_hit.primitive & PrimitiveBatch::kBoxBit)
+            return mBoxObject[_hit.primitive & ~PrimitiveBatch::kBoxBit];
+        return mSphereObject[_hit.primitive];
+    }
+
+    const size_t slot = size_t(_hit.object - kAnalyticSlot - 1);
+    if (slot < mMeshes.size())
+        return mMeshes[slot]->objectIndex;
+    return mFallbackObject[slot - mMeshes.size()];
+}
+
+uint32_t CompiledScene::GetMaterialKey(const Hit& _hit) const
+{
+    if (_hit.object == kAnalyticSlot)
+        return mAnalytic.GetPrimitiveMaterialIndex(_hit.primitive);
+
+    const size_t slot = size_t(_hit.object - kAnalyticSlot - 1);
+    if (slot < mMeshes.size())
+        return mMaterialBase[size_t(_hit.object)] + uint32_t(mMeshes[slot]->faces[_hit.primitive].materialGroup + 1);
+    return mMaterialBase[size_t(_hit.object)];
+}
+
+std::unique_ptr<CompiledScene::BakedMesh> CompiledScene::BakeMesh(const std::shared_ptr<RayObject>& _owner, const Mesh& _mesh, const glm::mat4& _M)
+{
+    auto baked = std::make_unique<BakedMesh>();
+    baked->owner = _owner;
+    baked->source = &_mesh;
+    baked->transform = _M;
+
+    const glm::mat3 M3 = glm::mat3(_M);
+    const glm::mat3 MinvT = glm::transpose(glm::inverse(M3));
+
+    // A mirroring transform flips winding and tangent handedness; swap b/c and negate w so
+    // geometric normals and normal-map bitangents come out the same as instanced shading
+    const bool mirrored = glm::determinant(M3) < 0.0f;
+
+    auto bakeVertex = [&](const ModelLoader::Vertex& _v)
+        {
+            ModelLoader::Vertex out = _v;
+            out.position = glm::vec3(_M * glm::vec4(_v.position, 1.0f));
+
+            const glm::vec3 n = MinvT * _v.normal;
+            const float nLen = glm::length(n);
+            out.normal = (nLen > 0.0f) ? n / nLen : n;
+
+            const glm::vec3 t = M3 * glm::vec3(_v.tangent);
+            const float tLen = glm::length(t);
+            out.tangent = glm::vec4((tLen > 0.0f) ? t / tLen : t, mirrored ? -_v.tangent.w : _v.tangent.w);
+            return out;
+        };
+
+    const auto& faces = _mesh.GetModel()->GetFaces();
+    baked->faces.reserve(faces.size());
+    for (const auto& f : faces)
+    {
+        ModelLoader::Face out = f;
+        out.a = bakeVertex(f.a);
+        out.b = bakeVertex(mirrored ? f.c : f.b);
+        out.c = bakeVertex(mirrored ? f.b : f.c);
+        baked->faces.push_back(out);
+    }
+
+    baked->bmin = glm::vec3(std::numeric_limits<float>::max());
+    baked->bmax = glm::vec3(-std::numeric_limits<float>::max());
+    for (const ModelLoader::Face& face : baked->faces)
+    {
+        baked->bmin = glm::min(baked->bmin, glm::min(face.a.position, glm::min(face.b.position, face.c.position)));
+        baked->bmax = glm::max(baked->bmax, glm::max(face.a.position, glm::max(face.b.position, face.c.position)));
+    }
+
+    baked->bvh.Build(baked->faces, *_mesh.GetModel());
+    return baked;
+}
+
+bool CompiledScene::RayAabb(const glm::vec3& _origin, const glm::vec3& _invD, const glm::vec3& _bmin, const glm::vec3& _bmax, float _tMin, float _tMax, float& _tEntry)
+{
+    const glm::vec3 t1 = (_bmin - _origin) * _invD;
+    const glm::vec3 t2 = (_bmax - _origin) * _invD;
+    const glm::vec3 tNear = glm::min(t1, t2);
+    const glm::vec3 tFar = glm::max(t1, t2);
+    _tEntry = std::max(tNear.x, std::max(tNear.y, tNear.z));
+    const float tExit = std::min(tFar.x, std::min(tFar.y, tFar.z));
+    return tExit >= std::max(_tEntry, _tMin) && _tEntry <= _tMax;
+}
+
+template <typename TestSlot>
+bool CompiledScene::TraverseTlas(const Ray& _ray, float _tMin, const float& _closest, bool _anyHit, TestSlot&& _testSlot) const
+{
+    if (mTlas.empty()) return false;
+
+    const glm::vec3 invD(
+        _ray.direction.x != 0.0f ? 1.0f / _ray.direction.x : 1e30f,
+        _ray.direction.y != 0.0f ? 1.0f / _ray.direction.y : 1e30f,
+        _ray.direction.z != 0.0f ? 1.0f / _ray.direction.z : 1e30f);
+
+    bool hit = false;
+    uint32_t stack[64];
+    int sp = 0;
+    stack[sp++] = 0u; // root
+
+    while (sp)
+    {
+        const TlasNode& node = mTlas[stack[--sp]];
+        float tEntry;
+        if (!RayAabb(_ray.origin, invD, node.bmin, node.bmax, _tMin, _closest, tEntry)) continue;
+
+        if (node.count > 0) // leaf
+        {
+            if (!_testSlot(int(node.leftFirst))) continue;
+            hit = true;
+            if (_anyHit) return true;
+            continue;
+        }
+
+        // Inner: nearer child first, so its hits can cull the other
+        const TlasNode& left = mTlas[node.leftFirst];
+        const TlasNode& right = mTlas[node.rightChild];
+        float lt, rt;
+        const bool hitL = RayAabb(_ray.origin, invD, left.bmin, left.bmax, _tMin, _closest, lt);
+        const bool hitR = RayAabb(_ray.origin, invD, right.bmin, right.bmax, _tMin, _closest, rt);
+
+        if (hitL && hitR)
+        {
+            if (lt < rt) { stack[sp++] = node.rightChild; stack[sp++] = node.leftFirst; }
+            else { stack[sp++] = node.leftFirst; stack[sp++] = node.rightChild; }
+        }
+        else if (hitL) { stack[sp++] = node.leftFirst; }
+        else if (hitR) { stack[sp++] = node.rightChild; }
+    }
+    return hit;
+}
+
+bool CompiledScene::Intersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) const
+{
+    float closestT = _tMax;
+
+    // Mesh BVHs expect a unit direction; t is rescaled back to units of _ray.direction
+    const float dirLen = glm::length(_ray.direction);
+    Ray unit;
+    unit.origin = _ray.origin;
+    unit.direction = dirLen > 0.0f ? _ray.direction / dirLen : _ray.direction;
+
+    bool hitSomething = TraverseTlas(_ray, _tMin, closestT, false, [&](int _slot)
+        {
+            if (_slot == kAnalyticSlot)
+            {
+                Hit h{};
+                if (!mAnalytic.Intersect(_ray, _tMin, closestT, h)) return false;
+
+                closestT = h.t;
+                _out = h;
+                _out.object = kAnalyticSlot;
+                return true;
+            }
+
+            if (dirLen <= 0.0f) return false;
+
+            float t;
+            uint32_t face;
+            glm::vec2 uv;
+            if (!mMeshes[size_t(_slot - kAnalyticSlot - 1)]->bvh.Intersect(unit, _tMin * dirLen, closestT * dirLen, t, face, uv)) return false;
+
+            closestT = t / dirLen;
+            _out.t = closestT;
+            _out.object = _slot;
+            _out.primitive = face;
+            _out.uv = uv;
+            return true;
+        });
+
+    Hit h{};
+    for (size_t i = 0; i < mFallback.size(); ++i)
+    {
+        if (!mFallback[i]->RayIntersect(_ray, _tMin, closestT, h) || h.t >= closestT) continue;
+
+        hitSomething = true;
+        closestT = h.t;
+        _out = h;
+        _out.object = kAnalyticSlot + 1 + int(mMeshes.size() + i);
+    }
+
+    return hitSomething;
+}
+
+bool CompiledScene::Occluded(const Ray& _ray, float _tMin, float _tMax) const
+{
+    const float dirLen = glm::length(_ray.direction);
+    Ray unit;
+    unit.origin = _ray.origin;
+    unit.direction = dirLen > 0.0f ? _ray.direction / dirLen : _ray.direction;
+
+    const bool occluded = TraverseTlas(_ray, _tMin, _tMax, true, [&](int _slot)
+        {
+            if (_slot == kAnalyticSlot)
+                return mAnalytic.Occluded(_ray, _tMin, _tMax);
+            return dirLen > 0.0f && mMeshes[size_t(_slot - kAnalyticSlot - 1)]->bvh.Occluded(unit, _tMin * dirLen, _tMax * dirLen);
+        });
+    if (occluded)
+        return true;
+
+    Hit h{};
+    for (const auto& object : mFallback)
+    {
+        if (object->RayIntersect(_ray, _tMin, _tMax, h) && h.t < _tMax)
+            return true;
+    }
+    return false;
+}
+
+void CompiledScene::ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const
+{
+    if (_hit.object == kAnalyticSlot)
+    {
+        mAnalytic.ComputeSurfaceInteraction(_ray, _hit, _out);
+        return;
+    }
+
+    const size_t slot = size_t(_hit.object - kAnalyticSlot - 1);
+    if (slot < mMeshes.size())
+    {
+        // Faces are already in world space
+        const BakedMesh& baked = *mMeshes[slot];
+        baked.source->ComputeFaceInteraction(baked.faces[_hit.primitive], _hit.uv, glm::mat4(1.0f), glm::mat3(1.0f), _ray, _out);
+        return;
+    }
+
+    mFallback[slot - mMeshes.size()]->ComputeSurfaceInteraction(_ray, _hit, _out);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "RayObject.h"
+#include "PrimitiveBatch.h"
+#include "TriangleBvh.h"
+#include "LightSampler.h"
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+#include <memory>
+
+class Mesh;
+
+// Flattened, render-ready copy of the PathTracer's RayObject list.
+// Spheres, boxes and primitive batches are merged into one SoA batch with a single material table,
+// meshes are baked into world space with their own BVH, so the hot loop makes no per-object virtual calls.
+// A top-level BVH over the batch's and each mesh's world bounds picks which of them a ray has to visit.
+// Objects of any other type are kept and intersected through the RayObject interface.
+class CompiledScene
+{
+public:
+	// Rebuilds from _objects; meshes whose transform has not changed since the last compile are reused.
+	// _environment (may be null) is sampled as a light alongside the emissive objects
+	void Compile(const std::vector<std::shared_ptr<RayObject>>& _objects, const EnvironmentMap* _environment = nullptr);
+
+	// Closest hit in (_tMin, _tMax); Hit.object is a slot in this scene, not an index into the RayObject list
+	bool Intersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) const;
+	void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const;
+
+	// True if anything lies in (_tMin, _tMax) along the ray
+	bool Occluded(const Ray& _ray, float _tMin, float _tMax) const;
+
+	// Emissive spheres, boxes and mesh triangles plus the environment (fallback objects are not sampled as lights)
+	const LightSampler& GetLights() const { return mLights; }
+	// False if _hit lies on a part of a mesh cut out by its alpha mask (e.g. a sampled light point)
+	bool IsOpaque(const Hit& _hit) const;
+
+	// Index into GetLights() of the emitter at _hit, or -1
+	int GetLightIndex(const Hit& _hit) const;
+
+	size_t GetMeshCount() const { return mMeshes.size(); }
+	size_t GetFallbackCount() const { return mFallback.size(); }
+	// Scene-wide id of the material at _hit (analytic material, mesh material group or fallback object),
+	// in [0, GetMaterialKeyCount()); hits sharing a key shade with the same textures and parameters
+	uint32_t GetMaterialKey(const Hit& _hit) const;
+	size_t GetMaterialKeyCount() const { return mMaterialBase.empty() ? 0 : mMaterialBase.back(); }
+	// Index in the list passed to Compile of the RayObject that produced _hit
+	uint32_t GetObjectIndex(const Hit& _hit) const;
+
+	// World bounds of the spheres, boxes and meshes (fallback objects are not included); min > max if there are none
+	const glm::vec3& GetBoundsMin() const { return mBoundsMin; }
+	const glm::vec3& GetBoundsMax() const { return mBoundsMax; }
+
+private:
+	// A mesh with its faces transformed to world space
+	struct BakedMesh
+	{
+		std::shared_ptr<RayObject> owner; // Keeps the source Mesh (and its ModelLoader) alive
+		const Mesh* source = nullptr;
+		glm::mat4 transform{ 1.0f }; // Object-to-world used for the bake
+		std::vector<ModelLoader::Face> faces;
+		TriangleBvh bvh; // References faces, so BakedMesh is heap allocated and never moved
+		std::vector<int32_t> faceLight; // Light index per face, empty if the mesh has no emissive faces
+		uint32_t objectIndex = 0; // Source position in the compiled list, refreshed on every compile
+		glm::vec3 bmin{ 0.0f }; // World bounds of the faces
+		glm::vec3 bmax{ 0.0f };
+	};
+
+	// Top-level BVH (flattened, index-based) over the analytic batch and the baked meshes
+	struct TlasNode
+	{
+		glm::vec3 bmin; // Node AABB
+		glm::vec3 bmax;
+		uint32_t leftFirst; // Inner: index of left child; leaf: slot
+		uint32_t rightChild;
+		uint32_t count; // Inner: 0; leaf: 1
+	};
+
+	void BuildLights(const EnvironmentMap* _environment);
+	// Scene bounds and the top-level BVH
+	void BuildBounds();
+
+	// Calls _testSlot(slot) on the slots whose bounds the ray enters before _closest (which the test may shorten);
+	// returns whether any test hit, stopping at the first if _anyHit
+	template <typename TestSlot>
+	bool TraverseTlas(const Ray& _ray, float _tMin, const float& _closest, bool _anyHit, TestSlot&& _testSlot) const;
+
+	static inline bool RayAabb(const glm::vec3& _origin, const glm::vec3& _invD, const glm::vec3& _bmin, const glm::vec3& _bmax, float _tMin, float _tMax, float& _tEntry);
+
+	static std::unique_ptr<BakedMesh> BakeMesh(const std::shared_ptr<RayObject>& _owner, const Mesh& _mesh, const glm::mat4& _M);
+
+	// Slot 0 is the analytic batch, then one slot per baked mesh, then the fallback objects
+	static constexpr int kAnalyticSlot = 0;
+
+	PrimitiveBatch mAnalytic{ "Compiled primitives" };
+	std::vector<std::unique_ptr<BakedMesh>> mMeshes;
+	std::vector<std::shared_ptr<RayObject>> mFallback;
+
+	LightSampler mLights;
+	std::vector<int32_t> mSphereLight; // Light index per analytic sphere / box, -1 if not emissive
+	std::vector<int32_t> mBoxLight;
+
+	// Source object index per analytic sphere / box, and per fallback object
+	std::vector<uint32_t> mSphereObject;
+	std::vector<uint32_t> mBoxObject;
+	std::vector<uint32_t> mFallbackObject;
+
+	std::vector<uint32_t> mMaterialBase; // First material key of each slot, plus the total at the end
+
+	std::vector<TlasNode> mTlas; // Empty if there is neither a primitive nor a mesh
+
+	glm::vec3 mBoundsMin{ 0.0f };
+	glm::vec3 mBoundsMax{ 0.0f };
+};
\ No newline at end of file
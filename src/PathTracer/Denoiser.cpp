@@ -0,0 +1,197 @@
+#include "Denoiser.h"
+#include "MathUtil.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <cmath>
+
+// B3 spline weights of the 5x5 a-trous kernel, per axis
+static constexpr float kKernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+template <typename Task>
+void Denoiser::ForEachTile(ThreadPool& _threadPool, int _width, int _height, const Task& _task)
+{
+    for (int y0 = 0; y0 < _height; y0 += kTileSize)
+    {
+        for (int x0 = 0; x0 < _width; x0 += kTileSize)
+        {
+            const int x1 = std::min(x0 + kTileSize, _width);
+            const int y1 = std::min(y0 + kTileSize, _height);
+            _threadPool.EnqueueTask([=, &_task] { _task(x0, y0, x1, y1); });
+        }
+    }
+    _threadPool.WaitForCompletion();
+}
+
+void Denoiser::Denoise(const Film& _film, ThreadPool& _threadPool, std::vector<glm::vec3>& _out)
+{
+    mWidth = _film.Width();
+    mHeight = _film.Height();
+    const int n = _film.PixelCount();
+    for (int i = 0; i < 2; ++i)
+    {
+        mIrradiance[i].resize(n);
+        mVariance[i].resize(n);
+    }
+    mAlbedo.resize(n);
+    mNormal.resize(n);
+    mDepth.resize(n);
+    mCurrent = 0;
+
+    ForEachTile(_threadPool, mWidth, mHeight, [&](int _x0, int _y0, int _x1, int _y1) { Prepare(_film, _x0, _y0, _x1, _y1); });
+
+    for (int i = 0; i < mIterations; ++i)
+    {
+        const int step = 1 << i;
+        ForEachTile(_threadPool, mWidth, mHeight, [&](int _x0, int _y0, int _x1, int _y1) { FilterPass(step, _x0, _y0, _x1, _y1); });
+        mCurrent ^= 1;
+    }
+
+    // Put the texture back
+    _out.resize(n);
+    const std::vector<glm::vec3>& irradiance = mIrradiance[mCurrent];
+    for (int p = 0; p < n; ++p)
+        _out[p] = irradiance[p] * SafeAlbedo(mAlbedo[p]);
+}
+
+void Denoiser::Prepare(const Film& _film, int _x0, int _y0, int _x1, int _y1)
+{
+    std::vector<glm::vec3>& irradiance = mIrradiance[0];
+    std::vector<float>& variance = mVariance[0];
+
+    for (int y = _y0; y < _y1; ++y)
+    {
+        for (int x = _x0; x < _x1; ++x)
+        {
+            const int p = y * mWidth + x;
+            const SampleFeatures f = _film.FeaturesAt(x, y);
+            const glm::vec3 albedo = SafeAlbedo(f.albedo);
+
+            mAlbedo[p] = f.albedo;
+            // Averaged normals shorten at silhouettes; unit length keeps the normal weight about direction only
+            mNormal[p] = (f.normal != glm::vec3(0.0f)) ? glm::normalize(f.normal) : f.normal;
+            mDepth[p] = f.depth;
+            irradiance[p] = _film.AverageAt(x, y) / albedo;
+
+            const float albedoLum = Luminance(albedo);
+            if (_film.SampleCountAt(x, y) >= 4)
+            {
+                variance[p] = _film.VarianceAt(x, y) / (albedoLum * albedoLum);
+                continue;
+            }
+
+            // Too few samples for the pixel's own second moment: use the spread of its 3x3 neighbourhood
+            float sum = 0.0f, sumSq = 0.0f;
+            int count = 0;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    const int qx = x + dx, qy = y + dy;
+                    if (qx < 0 || qy < 0 || qx >= mWidth || qy >= mHeight)
+                        continue;
+                    const float l = Luminance(_film.AverageAt(qx, qy) / SafeAlbedo(_film.FeaturesAt(qx, qy).albedo));
+                    sum += l;
+                    sumSq += l * l;
+                    ++count;
+                }
+            }
+            const float mean = sum / float(count);
+            variance[p] = std::max(0.0f, sumSq / float(count) - mean * mean);
+        }
+    }
+}
+
+void Denoiser::FilterPass(int _step, int _x0, int _y0, int _x1, int _y1)
+{
+    const std::vector<glm::vec3>& irradianceIn = mIrradiance[mCurrent];
+    const std::vector<float>& varianceIn = mVariance[mCurrent];
+    std::vector<glm::vec3>& irradianceOut = mIrradiance[mCurrent ^ 1];
+    std::vector<float>& varianceOut = mVariance[mCurrent ^ 1];
+
+    for (int y = _y0; y < _y1; ++y)
+    {
+        for (int x = _x0; x < _x1; ++x)
+        {
+            const int p = y * mWidth + x;
+
+            // Luminance weights scale with the local noise, prefiltered by a 3x3 Gaussian to steady the estimate
+            float localVariance = 0.0f, localWeight = 0.0f;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    const int qx = x + dx, qy = y + dy;
+                    if (qx < 0 || qy < 0 || qx >= mWidth || qy >= mHeight)
+                        continue;
+                    const float w = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+                    localVariance += w * varianceIn[qy * mWidth + qx];
+                    localWeight += w;
+                }
+            }
+            const float lumScale = 1.0f / (mColourSigma * std::sqrt(localVariance / localWeight) + 1e-6f);
+
+            const glm::vec3 irradianceP = irradianceIn[p];
+            const float lumP = Luminance(irradianceP);
+            const glm::vec3 normalP = mNormal[p];
+            const float depthP = mDepth[p];
+
+            glm::vec3 sum(0.0f);
+            float sumVariance = 0.0f;
+            float sumWeight = 0.0f;
+            for (int ky = 0; ky < 5; ++ky)
+            {
+                const int qy = y + (ky - 2) * _step;
+                if (qy < 0 || qy >= mHeight)
+                    continue;
+
+                for (int kx = 0; kx < 5; ++kx)
+                {
+                    const int qx = x + (kx - 2) * _step;
+                    if (qx < 0 || qx >= mWidth)
+                        continue;
+
+                    const int q = qy * mWidth + qx;
+                    const float pixelDistance = float(_step) * std::sqrt(float((kx - 2) * (kx - 2) + (ky - 2) * (ky - 2)));
+
+                    const float wNormal = std::pow(std::max(0.0f, glm::dot(normalP, mNormal[q])), mNormalPower);
+                    const float wDepth = std::abs(depthP - mDepth[q]) / (mDepthSigma * depthP * pixelDistance + 1e-4f);
+                    const float wLum = std::abs(lumP - Luminance(irradianceIn[q])) * lumScale;
+                    const float w = kKernel[kx] * kKernel[ky] * wNormal * std::exp(-wDepth - wLum);
+
+                    sum += w * irradianceIn[q];
+                    sumVariance += w * w * varianceIn[q];
+                    sumWeight += w;
+                }
+            }
+
+            // The centre tap always has full normal, depth and luminance weight, so sumWeight > 0
+            // unless the pixel has no features yet (zero normal); then it passes through unfiltered
+            if (sumWeight > 0.0f)
+            {
+                irradianceOut[p] = sum / sumWeight;
+                varianceOut[p] = sumVariance / (sumWeight * sumWeight);
+            }
+            else
+            {
+                irradianceOut[p] = irradianceP;
+                varianceOut[p] = varianceIn[p];
+            }
+        }
+    }
+}
+
+bool Denoiser::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Denoiser"))
+    {
+        changed |= ImGui::SliderInt("Iterations", &mIterations, 1, 8);
+        changed |= ImGui::SliderFloat("Colour sigma", &mColourSigma, 0.5f, 32.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Normal power", &mNormalPower, 1.0f, 256.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Depth sigma", &mDepthSigma, 0.001f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        ImGui::TreePop();
+    }
+    return changed;
+}
\ No newline at end of file
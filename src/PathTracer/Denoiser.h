@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Film.h"
+#include "ThreadPool.h"
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with variance-guided luminance weights (SVGF, Schied et al. 2017).
+// Works on the film's irradiance (colour over albedo) so texture detail is not blurred, and stops at changes in
+// normal, depth and, relative to the estimated noise, luminance. Reads the film only; the accumulation is untouched.
+class Denoiser
+{
+public:
+	// Filters the film's current average into _out (linear RGB, W*H), one task per tile on _threadPool
+	void Denoise(const Film& _film, ThreadPool& _threadPool, std::vector<glm::vec3>& _out);
+
+	// Passes of the 5x5 kernel, the n'th spaced 2^n pixels apart, so the footprint doubles each pass
+	void SetIterations(int _iterations) { mIterations = _iterations; }
+	int GetIterations() const { return mIterations; }
+
+	bool UpdateUI();
+
+	static constexpr int kTileSize = 64;
+
+private:
+	// Runs _task(x0, y0, x1, y1) over every tile of the image and waits for them all
+	template <typename Task>
+	void ForEachTile(ThreadPool& _threadPool, int _width, int _height, const Task& _task);
+
+	void Prepare(const Film& _film, int _x0, int _y0, int _x1, int _y1);
+	void FilterPass(int _step, int _x0, int _y0, int _x1, int _y1);
+
+	int mIterations = 5;
+	float mColourSigma = 4.0f; // Luminance difference, in standard deviations of the noise, that stops the filter
+	float mNormalPower = 128.0f;
+	float mDepthSigma = 0.05f; // Relative depth change per pixel of distance
+
+	int mWidth = 0;
+	int mHeight = 0;
+
+	// Ping-ponged irradiance and its variance (luminance, of the pixel mean)
+	std::vector<glm::vec3> mIrradiance[2];
+	std::vector<float> mVariance[2];
+	int mCurrent = 0;
+
+	// Guides, fixed for the whole filter
+	std::vector<glm::vec3> mAlbedo;
+	std::vector<glm::vec3> mNormal;
+	std::vector<float> mDepth;
+};
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include "EnvironmentMap.h"
+#include "MathUtil.h"
+
+#include "stb_image.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <stdexcept>
+
+EnvironmentMap::EnvironmentMap(const std::string& _path)
+{
+    mPath = _path;
+
+    if (std::filesystem::is_directory(_path))
+        LoadCubeMap(_path);
+    else
+        LoadEquirect(_path);
+
+    BuildDistribution();
+}
+
+void EnvironmentMap::LoadEquirect(const std::string& _path)
+{
+    // stbi_loadf reads .hdr as is and linearises LDR formats with gamma 2.2
+    int w = 0, h = 0, channels = 0;
+    float* data = stbi_loadf(_path.c_str(), &w, &h, &channels, 3);
+    if (!data)
+        throw std::runtime_error("Failed to load environment map: " + _path);
+
+    mWidth = w;
+    mHeight = h;
+    mPixels.resize(size_t(w) * h);
+    for (size_t i = 0; i < mPixels.size(); ++i)
+        mPixels[i] = glm::vec3(data[i * 3 + 0], data[i * 3 + 1], data[i * 3 + 2]);
+
+    stbi_image_free(data);
+}
+
+void EnvironmentMap::LoadCubeMap(const std::string& _folder)
+{
+    struct Face
+    {
+        int w = 0, h = 0;
+        std::vector<glm::vec3> pixels;
+    };
+
+    // Same face order as the major axis index below: +X, -X, +Y, -Y, +Z, -Z
+    const char* names[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+    Face faces[6];
+    for (int f = 0; f < 6; ++f)
+    {
+        const std::string file = (std::filesystem::path(_folder) / (std::string(names[f]) + ".png")).string();
+        int channels = 0;
+        float* data = stbi_loadf(file.c_str(), &faces[f].w, &faces[f].h, &channels, 3);
+        if (!data)
+            throw std::runtime_error("Failed to load cube map face: " + file);
+
+        faces[f].pixels.resize(size_t(faces[f].w) * faces[f].h);
+        for (size_t i = 0; i < faces[f].pixels.size(); ++i)
+            faces[f].pixels[i] = glm::vec3(data[i * 3 + 0], data[i * 3 + 1], data[i * 3 + 2]);
+        stbi_image_free(data);
+    }
+
+    auto sampleFace = [&](int _f, float _s, float _t)
+        {
+            // Bilinear, clamped at the face edges
+            const Face& face = faces[_f];
+            const float x = glm::clamp(_s * face.w - 0.5f, 0.0f, float(face.w - 1));
+            const float y = glm::clamp(_t * face.h - 0.5f, 0.0f, float(face.h - 1));
+            const int x0 = int(x), y0 = int(y);
+            const int x1 = std::min(x0 + 1, face.w - 1), y1 = std::min(y0 + 1, face.h - 1);
+            const float fx = x - x0, fy = y - y0;
+            const glm::vec3 top = glm::mix(face.pixels[size_t(y0) * face.w + x0], face.pixels[size_t(y0) * face.w + x1], fx);
+            const glm::vec3 bottom = glm::mix(face.pixels[size_t(y1) * face.w + x0], face.pixels[size_t(y1) * face.w + x1], fx);
+            return glm::mix(top, bottom, fy);
+        };
+
+    // Four texels around the equator per face texel keeps the detail without growing without bound
+    mWidth = std::min(4 * faces[0].w, 2048);
+    mHeight = mWidth / 2;
+    mPixels.resize(size_t(mWidth) * mHeight);
+
+    const float rotation = mRotation;
+    mRotation = 0.0f; // Resample in the map's own frame
+    for (int y = 0; y < mHeight; ++y)
+    {
+        for (int x = 0; x < mWidth; ++x)
+        {
+            const glm::vec3 d = UVToDirection(glm::vec2((x + 0.5f) / mWidth, (y + 0.5f) / mHeight));
+            const glm::vec3 a = glm::abs(d);
+
+            // OpenGL cube map face selection and (s, t) with t running down the image
+            int f;
+            float sc, tc, ma;
+            if (a.x >= a.y && a.x >= a.z) { f = d.x > 0.0f ? 0 : 1; ma = a.x; sc = d.x > 0.0f ? -d.z : d.z; tc = -d.y; }
+            else if (a.y >= a.z) { f = d.y > 0.0f ? 2 : 3; ma = a.y; sc = d.x; tc = d.y > 0.0f ? d.z : -d.z; }
+            else { f = d.z > 0.0f ? 4 : 5; ma = a.z; sc = d.z > 0.0f ? d.x : -d.x; tc = -d.y; }
+
+            mPixels[size_t(y) * mWidth + x] = sampleFace(f, 0.5f * (sc / ma + 1.0f), 0.5f * (tc / ma + 1.0f));
+        }
+    }
+    mRotation = rotation;
+}
+
+void EnvironmentMap::BuildDistribution()
+{
+    mRowWeight.assign(mHeight, 0.0f);
+    mRowCdf.assign(size_t(mHeight) + 1, 0.0f);
+    mColumnCdf.assign(size_t(mHeight) * (mWidth + 1), 0.0f);
+
+    for (int y = 0; y < mHeight; ++y)
+    {
+        // Rows shrink towards the poles, so weight texels by the solid angle they cover
+        const float sinTheta = std::sin(kPi * (y + 0.5f) / mHeight);
+        float* cdf = &mColumnCdf[size_t(y) * (mWidth + 1)];
+
+        for (int x = 0; x < mWidth; ++x)
+            cdf[x + 1] = cdf[x] + std::max(0.0f, Luminance(Texel(x, y))) * sinTheta;
+
+        mRowWeight[y] = cdf[mWidth];
+        if (cdf[mWidth] > 0.0f)
+        {
+            for (int x = 1; x <= mWidth; ++x)
+                cdf[x] /= cdf[mWidth];
+        }
+        mRowCdf[y + 1] = mRowCdf[y] + mRowWeight[y];
+    }
+
+    mTotalWeight = mRowCdf[mHeight];
+    if (mTotalWeight > 0.0f)
+    {
+        for (int y = 1; y <= mHeight; ++y)
+            mRowCdf[y] /= mTotalWeight;
+    }
+}
+
+glm::vec2 EnvironmentMap::DirectionToUV(const glm::vec3& _dir) const
+{
+    const glm::vec3 d = glm::normalize(_dir);
+
+    // Undo the rotation about +Y
+    const float r = glm::radians(mRotation);
+    const float c = std::cos(r), s = std::sin(r);
+    const glm::vec3 local(c * d.x - s * d.z, d.y, s * d.x + c * d.z);
+
+    float phi = std::atan2(local.z, local.x);
+    if (phi < 0.0f) phi += 2.0f * kPi;
+    const float theta = std::acos(glm::clamp(local.y, -1.0f, 1.0f));
+    return glm::vec2(phi / (2.0f * kPi), theta / kPi);
+}
+
+glm::vec3 EnvironmentMap::UVToDirection(const glm::vec2& _uv) const
+{
+    const float phi = 2.0f * kPi * _uv.x;
+    const float theta = kPi * _uv.y;
+    const float sinTheta = std::sin(theta);
+    const glm::vec3 local(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+
+    const float r = glm::radians(mRotation);
+    const float c = std::cos(r), s = std::sin(r);
+    return glm::vec3(c * local.x + s * local.z, local.y, -s * local.x + c * local.z);
+}
+
+glm::vec3 EnvironmentMap::Evaluate(const glm::vec3& _dir) const
+{
+    const glm::vec2 uv = DirectionToUV(_dir);
+
+    // Bilinear, wrapping around in longitude
+    const float x = uv.x * mWidth - 0.5f;
+    const float y = glm::clamp(uv.y * mHeight - 0.5f, 0.0f, float(mHeight - 1));
+    const int x0 = int(std::floor(x));
+    const int y0 = int(y);
+    const float fx = x - x0, fy = y - y0;
+    const int xa = (x0 % mWidth + mWidth) % mWidth;
+    const int xb = (xa + 1) % mWidth;
+    const int y1 = std::min(y0 + 1, mHeight - 1);
+
+    const glm::vec3 top = glm::mix(Texel(xa, y0), Texel(xb, y0), fx);
+    const glm::vec3 bottom = glm::mix(Texel(xa, y1), Texel(xb, y1), fx);
+    return glm::mix(top, bottom, fy) * mIntensity;
+}
+
+bool EnvironmentMap::Sample(const glm::vec2& _u, glm::vec3& _wi, float& _pdf) const
+{
+    if (mTotalWeight <= 0.0f)
+        return false;
+
+    // Row, then column within it; the remainder of each number places the point inside the texel
+    const int y = glm::clamp(int(std::upper_bound(mRowCdf.begin(), mRowCdf.end(), _u.y) - mRowCdf.begin()) - 1, 0, mHeight - 1);
+    const float rowSpan = mRowCdf[y + 1] - mRowCdf[y];
+    const float dy = (rowSpan > 0.0f) ? (_u.y - mRowCdf[y]) / rowSpan : 0.5f;
+
+    const float* cdf = &mColumnCdf[size_t(y) * (mWidth + 1)];
+    const int x = glm::clamp(int(std::upper_bound(cdf, cdf + mWidth + 1, _u.x) - cdf) - 1, 0, mWidth - 1);
+    const float colSpan = cdf[x + 1] - cdf[x];
+    const float dx = (colSpan > 0.0f) ? (_u.x - cdf[x]) / colSpan : 0.5f;
+
+    const glm::vec2 uv((x + glm::clamp(dx, 0.0f, 1.0f)) / mWidth, (y + glm::clamp(dy, 0.0f, 1.0f)) / mHeight);
+    const float sinTheta = std::sin(kPi * uv.y);
+    if (sinTheta <= 0.0f)
+        return false;
+
+    // Density over the unit square, then over solid angle (d omega = 2 pi^2 sin(theta) du dv)
+    const float pdfUV = rowSpan * colSpan * float(mWidth) * float(mHeight);
+    _pdf = pdfUV / (2.0f * kPi * kPi * sinTheta);
+    _wi = UVToDirection(uv);
+    return _pdf > 0.0f;
+}
+
+float EnvironmentMap::Pdf(const glm::vec3& _dir) const
+{
+    if (mTotalWeight <= 0.0f)
+        return 0.0f;
+
+    const glm::vec2 uv = DirectionToUV(_dir);
+    const float sinTheta = std::sin(kPi * uv.y);
+    if (sinTheta <= 0.0f)
+        return 0.0f;
+
+    const int x = glm::clamp(int(uv.x * mWidth), 0, mWidth - 1);
+    const int y = glm::clamp(int(uv.y * mHeight), 0, mHeight - 1);
+    const float* cdf = &mColumnCdf[size_t(y) * (mWidth + 1)];
+    const float pdfUV = (mRowCdf[y + 1] - mRowCdf[y]) * (cdf[x + 1] - cdf[x]) * float(mWidth) * float(mHeight);
+    return pdfUV / (2.0f * kPi * kPi * sinTheta);
+}
+
+bool EnvironmentMap::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Environment"))
+    {
+        ImGui::Text("%s (%dx%d)", mPath.c_str(), mWidth, mHeight);
+        changed |= ImGui::SliderFloat("Intensity", &mIntensity, 0.0f, 10.0f);
+        changed |= ImGui::SliderFloat("Rotation", &mRotation, -180.0f, 180.0f);
+        ImGui::TreePop();
+    }
+    return changed;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Distant lighting from an image around the scene, stored as an equirectangular (lat-long) map.
+// Cube maps are resampled into the same layout so lookups and importance sampling share one path.
+class EnvironmentMap
+{
+public:
+	// _path is either an equirectangular image (.hdr or LDR) or a folder holding a cube map
+	// as px/nx/py/ny/pz/nz .png. Throws std::runtime_error if nothing can be loaded.
+	EnvironmentMap(const std::string& _path);
+
+	// Radiance arriving from direction _dir (towards the environment, need not be normalised)
+	glm::vec3 Evaluate(const glm::vec3& _dir) const;
+
+	// Direction chosen in proportion to luminance; _pdf is per unit solid angle. False if the map is black
+	bool Sample(const glm::vec2& _u, glm::vec3& _wi, float& _pdf) const;
+	float Pdf(const glm::vec3& _dir) const;
+
+	// Intensity and rotation only rescale / turn the map, so changing them needs no rebuild
+	void SetIntensity(float _intensity) { mIntensity = _intensity; }
+	float GetIntensity() const { return mIntensity; }
+	void SetRotation(float _degrees) { mRotation = _degrees; }
+	float GetRotation() const { return mRotation; }
+
+	const std::string& GetPath() const { return mPath; }
+
+	bool UpdateUI();
+
+private:
+	void LoadEquirect(const std::string& _path);
+	void LoadCubeMap(const std::string& _folder);
+	void BuildDistribution();
+
+	// Between world directions and map coordinates in [0,1)^2, applying mRotation
+	glm::vec2 DirectionToUV(const glm::vec3& _dir) const;
+	glm::vec3 UVToDirection(const glm::vec2& _uv) const;
+
+	glm::vec3 Texel(int _x, int _y) const { return mPixels[size_t(_y) * mWidth + _x]; }
+
+	std::string mPath;
+	int mWidth = 0;
+	int mHeight = 0;
+	std::vector<glm::vec3> mPixels; // Linear RGB, row 0 is straight up
+
+	float mIntensity = 1.0f;
+	float mRotation = 0.0f; // Degrees about +Y
+
+	// Piecewise-constant 2D distribution over texels: pick a row, then a column within it
+	std::vector<float> mRowCdf; // mHeight + 1 entries
+	std::vector<float> mColumnCdf; // mHeight rows of mWidth + 1 entries
+	std::vector<float> mRowWeight; // Unnormalised weight of each row
+	float mTotalWeight = 0.0f;
+};
\ No newline at end of file
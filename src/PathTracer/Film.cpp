@@ -1,4 +1,9 @@
 #include "Film.h"
+#include "MathUtil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
 
 Film::Film()
 	: mWidth(0)
@@ -20,85 +25,479 @@ void Film::Resize(int _width, int _height)
     const int n = PixelCount();
     mAccum.assign(n, glm::vec3(0.0f));
     mSamples.assign(n, 0u);
+    mLumSqAccum.assign(n, 0.0f);
+    mSplatAccum = std::vector<std::atomic<float>>(size_t(n) * 3);
+    mLightPaths = 0;
+    mAlbedoAccum.assign(n, glm::vec3(0.0f));
+    mNormalAccum.assign(n, glm::vec3(0.0f));
+    mDepthAccum.assign(n, 0.0f);
+    mFeatureSamples.assign(n, 0u);
+    mObjectId.assign(n, 0u);
     mDisplay8.assign(std::max(1, n) * 4, 0u);
-    mDirty = true;
+
+    mTilesX = (mWidth + kTileSize - 1) / kTileSize;
+    mTilesY = (mHeight + kTileSize - 1) / kTileSize;
+    mTileConverged.assign(size_t(mTilesX) * mTilesY, 0u);
+    mConvergedFraction = 0.0f;
+    mTileDirty = std::vector<std::atomic<std::uint8_t>>(size_t(mTilesX) * mTilesY);
+    mAllDirty = true;
 }
 
 void Film::Reset()
 {
     std::fill(mAccum.begin(), mAccum.end(), glm::vec3(0.0f));
     std::fill(mSamples.begin(), mSamples.end(), 0u);
-    mDirty = true;
+    std::fill(mLumSqAccum.begin(), mLumSqAccum.end(), 0.0f);
+    for (std::atomic<float>& s : mSplatAccum)
+        s.store(0.0f, std::memory_order_relaxed);
+    mLightPaths = 0;
+    std::fill(mAlbedoAccum.begin(), mAlbedoAccum.end(), glm::vec3(0.0f));
+    std::fill(mNormalAccum.begin(), mNormalAccum.end(), glm::vec3(0.0f));
+    std::fill(mDepthAccum.begin(), mDepthAccum.end(), 0.0f);
+    std::fill(mFeatureSamples.begin(), mFeatureSamples.end(), 0u);
+    std::fill(mObjectId.begin(), mObjectId.end(), 0u);
+    std::fill(mTileConverged.begin(), mTileConverged.end(), 0u);
+    mConvergedFraction = 0.0f;
+    mAllDirty = true;
+}
+
+// Firefly clamp on a sample's luminance, shared by the tiles and the splats
+static inline glm::vec3 ClampSample(const glm::vec3& _linearRGB, float& _lum)
+{
+    glm::vec3 contrib = _linearRGB;
+    _lum = Luminance(contrib);
+    if (_lum > Film::kMaxSampleLuminance) { contrib *= (Film::kMaxSampleLuminance / _lum); _lum = Film::kMaxSampleLuminance; }
+    return contrib;
+}
+
+void Film::MergeTile(const FilmTile& _tile)
+{
+    for (int y = _tile.mY0; y < _tile.mY1; ++y)
+    {
+        for (int x = _tile.mX0; x < _tile.mX1; ++x)
+        {
+            const int t = _tile.Index(x, y);
+            if (_tile.mSamples[t] == 0u)
+                continue;
+
+            const int p = y * mWidth + x;
+            mAccum[p] += _tile.mAccum[t];
+            mLumSqAccum[p] += _tile.mLumSqAccum[t];
+            mSamples[p] += _tile.mSamples[t];
+            mAlbedoAccum[p] += _tile.mAlbedoAccum[t];
+            mNormalAccum[p] += _tile.mNormalAccum[t];
+            mDepthAccum[p] += _tile.mDepthAccum[t];
+            if (mFeatureSamples[p] == 0u)
+                mObjectId[p] = _tile.mObjectId[t];
+            mFeatureSamples[p] += _tile.mFeatureSamples[t];
+        }
+    }
+
+    // Every film tile the rectangle touches
+    if (_tile.mX1 > _tile.mX0 && _tile.mY1 > _tile.mY0)
+    {
+        for (int ty = _tile.mY0 / kTileSize; ty <= (_tile.mY1 - 1) / kTileSize; ++ty)
+            for (int tx = _tile.mX0 / kTileSize; tx <= (_tile.mX1 - 1) / kTileSize; ++tx)
+                mTileDirty[size_t(ty) * mTilesX + tx].store(1u, std::memory_order_relaxed);
+    }
 }
 
-void Film::AddSample(int _x, int _y, const glm::vec3& _linearRGB)
+void Film::AddSplat(int _x, int _y, const glm::vec3& _linearRGB)
+{
+    const size_t p = size_t(_y * mWidth + _x) * 3;
+
+    // Same firefly clamp as camera samples: a splat is worth about one camera sample once averaged
+    float lum;
+    const glm::vec3 contrib = ClampSample(_linearRGB, lum);
+
+    for (int c = 0; c < 3; ++c)
+        mSplatAccum[p + c].fetch_add(contrib[c], std::memory_order_relaxed);
+}
+
+void Film::AddLightPaths(uint64_t _count)
+{
+    mLightPaths.fetch_add(_count, std::memory_order_relaxed);
+    mAllDirty = true; // Every pixel's share of the splats changes
+}
+
+SampleFeatures Film::FeaturesAt(int _x, int _y) const
 {
     const int p = _y * mWidth + _x;
+    const uint32_t s = mFeatureSamples[p];
+    SampleFeatures f;
+    if (s)
+    {
+        f.albedo = mAlbedoAccum[p] / float(s);
+        f.normal = mNormalAccum[p] / float(s);
+        f.depth = mDepthAccum[p] / float(s);
+        f.objectId = mObjectId[p];
+    }
+    return f;
+}
 
-	glm::vec3 contrib = _linearRGB;
-    const float maxLum = 12.0f; // start 8-20; tune per scene
-    float lum = glm::dot(contrib, glm::vec3(0.2126f, 0.7152f, 0.0722f));
-    if (lum > maxLum) contrib *= (maxLum / lum);
+float Film::VarianceAt(int _x, int _y) const
+{
+    const int p = _y * mWidth + _x;
+    const uint32_t s = mSamples[p];
+    if (s < 2)
+        return 0.0f;
+
+    const float mean = Luminance(mAccum[p]) / float(s);
+    const float sampleVariance = std::max(0.0f, (mLumSqAccum[p] / float(s) - mean * mean) * float(s) / float(s - 1));
+    return sampleVariance / float(s);
+}
 
-    mAccum[p] += contrib;
-    mSamples[p] += 1u;
-    mDirty = true;
+float Film::MeanLumSqAt(int _x, int _y) const
+{
+    const int p = _y * mWidth + _x;
+    return mSamples[p] ? mLumSqAccum[p] / float(mSamples[p]) : 0.0f;
+}
+
+void Film::AddHistory(int _x, int _y, const glm::vec3& _linearRGB, float _meanLumSq, uint32_t _count)
+{
+    const int p = _y * mWidth + _x;
+    mAccum[p] += _linearRGB * float(_count);
+    mLumSqAccum[p] += _meanLumSq * float(_count);
+    mSamples[p] += _count;
+    MarkTileDirty(_x, _y);
 }
 
 glm::vec3 Film::AverageAt(int _x, int _y) const
 {
     const int p = _y * mWidth + _x;
     const uint32_t s = mSamples[p];
-    return s ? (mAccum[p] / float(s)) : glm::vec3(0.0f);
+    glm::vec3 average = s ? (mAccum[p] / float(s)) : glm::vec3(0.0f);
+
+    // Splats estimate the pixel's share of the whole image, so scale by the pixel count over the light paths
+    const uint64_t lightPaths = mLightPaths.load(std::memory_order_relaxed);
+    if (lightPaths)
+    {
+        const float scale = float(PixelCount()) / float(lightPaths);
+        average += glm::vec3(mSplatAccum[3 * size_t(p)].load(std::memory_order_relaxed),
+                             mSplatAccum[3 * size_t(p) + 1].load(std::memory_order_relaxed),
+                             mSplatAccum[3 * size_t(p) + 2].load(std::memory_order_relaxed)) * scale;
+    }
+    return average;
+}
+
+void Film::UpdateConvergence(float _threshold, uint32_t _minSamples)
+{
+    int convergedPixels = 0;
+
+    for (int ty = 0; ty < mTilesY; ++ty)
+    {
+        for (int tx = 0; tx < mTilesX; ++tx)
+        {
+            const int x0 = tx * kTileSize, x1 = std::min(x0 + kTileSize, mWidth);
+            const int y0 = ty * kTileSize, y1 = std::min(y0 + kTileSize, mHeight);
+            const int tilePixels = (x1 - x0) * (y1 - y0);
+
+            float errorSum = 0.0f;
+            bool enoughSamples = true;
+            for (int y = y0; y < y1 && enoughSamples; ++y)
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    const int p = y * mWidth + x;
+                    const uint32_t s = mSamples[p];
+                    if (s < std::max(_minSamples, 2u))
+                    {
+                        enoughSamples = false;
+                        break;
+                    }
+
+                    // Standard error of the mean, relative to the pixel's brightness; the offset keeps
+                    // near-black pixels from needing an exact zero to converge
+                    const float mean = Luminance(mAccum[p]) / float(s);
+                    errorSum += std::sqrt(VarianceAt(x, y)) / (mean + 0.1f);
+                }
+            }
+
+            // Recomputed every time, so raising the threshold brings tiles back
+            const bool converged = enoughSamples && errorSum / float(tilePixels) < _threshold;
+            const size_t tile = size_t(ty) * mTilesX + tx;
+            if (mTileConverged[tile] != (converged ? 1u : 0u))
+            {
+                // The heat map changes only where a tile flipped
+                mTileConverged[tile] = converged ? 1u : 0u;
+                mTileDirty[tile].store(1u, std::memory_order_relaxed);
+            }
+            if (converged)
+                convergedPixels += tilePixels;
+        }
+    }
+
+    mConvergedFraction = PixelCount() ? float(convergedPixels) / float(PixelCount()) : 0.0f;
+}
+
+// Tiles handed to each resolve task
+static constexpr size_t kResolveTilesPerTask = 16;
+
+const std::vector<std::uint8_t>& Film::ResolveToRGBA8(ThreadPool& _threadPool)
+{
+    // Only tiles that took samples since the last resolve, unless something changed for every pixel. Layers shown
+    // relative to the whole image's range are redone in full whenever anything changed
+    const bool all = mAllDirty.exchange(false);
+    mResolveTiles.clear();
+    for (int t = 0; t < int(mTileDirty.size()); ++t)
+    {
+        if (mTileDirty[t].exchange(0u, std::memory_order_relaxed) != 0u || all)
+            mResolveTiles.push_back(t);
+    }
+    if (mResolveTiles.empty())
+        return mDisplay8;
+
+    const bool wholeImageRange = mDisplayLayer == AovLayer::Depth || mDisplayLayer == AovLayer::SampleCount;
+    if (wholeImageRange && mResolveTiles.size() != mTileDirty.size())
+    {
+        mResolveTiles.resize(mTileDirty.size());
+        std::iota(mResolveTiles.begin(), mResolveTiles.end(), 0);
+    }
+
+    const DisplayRange range = GetDisplayRange(mDisplayLayer);
+    for (size_t first = 0; first < mResolveTiles.size(); first += kResolveTilesPerTask)
+    {
+        const size_t last = std::min(first + kResolveTilesPerTask, mResolveTiles.size());
+        _threadPool.EnqueueTask([=, this] {
+            for (size_t i = first; i < last; ++i)
+            {
+                const int x0 = (mResolveTiles[i] % mTilesX) * kTileSize;
+                const int y0 = (mResolveTiles[i] / mTilesX) * kTileSize;
+                ResolveRect(mDisplayLayer, range, x0, y0, std::min(x0 + kTileSize, mWidth), std::min(y0 + kTileSize, mHeight), mDisplay8);
+            }
+        });
+    }
+    _threadPool.WaitForCompletion();
+    return mDisplay8;
 }
 
-const std::vector<std::uint8_t>& Film::ResolveToRGBA8()
+const char* Film::GetLayerName(AovLayer _layer)
 {
-    if (!mDirty) return mDisplay8;
+    static const char* names[] = { "colour", "albedo", "normal", "depth", "objectid", "samplecount" };
+    return names[static_cast<int>(_layer)];
+}
 
+void Film::GetLayer(AovLayer _layer, std::vector<glm::vec3>& _out) const
+{
     const int n = PixelCount();
-    if ((int)mDisplay8.size() != n * 4) mDisplay8.resize(n * 4);
+    _out.resize(n);
 
     for (int p = 0; p < n; ++p)
     {
-        const uint32_t s = mSamples[p];
-        glm::vec3 c = s ? (mAccum[p] / float(s)) : glm::vec3(0.0f);
+        const int x = p % mWidth, y = p / mWidth;
+        switch (_layer)
+        {
+        case AovLayer::Colour: _out[p] = AverageAt(x, y); break;
+        case AovLayer::Albedo: _out[p] = FeaturesAt(x, y).albedo; break;
+        case AovLayer::Normal: _out[p] = FeaturesAt(x, y).normal; break;
+        case AovLayer::Depth: _out[p] = glm::vec3(FeaturesAt(x, y).depth); break;
+        case AovLayer::ObjectId: _out[p] = glm::vec3(float(mObjectId[p])); break;
+        default: _out[p] = glm::vec3(float(mSamples[p])); break;
+        }
+    }
+}
 
-        if (mToneMap == ToneMap::Reinhard)
-            // Simple Reinhard tone mapping
-            c = c / (glm::vec3(1.0f) + c);
+void Film::ResolveLayerToRGBA8(AovLayer _layer, std::vector<std::uint8_t>& _out) const
+{
+    const int n = PixelCount();
+    if ((int)_out.size() != n * 4) _out.resize(n * 4);
 
-        glm::vec3 e = c;
+    ResolveRect(_layer, GetDisplayRange(_layer), 0, 0, mWidth, mHeight, _out);
+}
 
-        if (mColourSpace == ColourSpace::sRGB)
+Film::DisplayRange Film::GetDisplayRange(AovLayer _layer) const
+{
+    const int n = PixelCount();
+    DisplayRange range;
+
+    // Depth is shown near = white, scaled to the farthest surface; the sky stays black
+    if (_layer == AovLayer::Depth)
+    {
+        for (int p = 0; p < n; ++p)
         {
-            // sRGB encoding
-            // R
+            const float d = FeaturesAt(p % mWidth, p / mWidth).depth;
+            if (d < SampleFeatures::kMissDepth * 0.5f)
+                range.maxDepth = std::max(range.maxDepth, d);
+        }
+    }
+
+    if (_layer == AovLayer::SampleCount)
+    {
+        for (int p = 0; p < n; ++p)
+            range.maxSamples = std::max(range.maxSamples, mSamples[p]);
+    }
+    return range;
+}
+
+void Film::ResolveRect(AovLayer _layer, const DisplayRange& _range, int _x0, int _y0, int _x1, int _y1, std::vector<std::uint8_t>& _out) const
+{
+    const std::uint8_t* lut = EncodeLut(mColourSpace);
+
+    for (int y = _y0; y < _y1; ++y)
+    {
+        for (int x = _x0; x < _x1; ++x)
+        {
+            const int p = y * mWidth + x;
+            std::uint8_t* out = &_out[4 * size_t(p)];
+            glm::vec3 e(0.0f);
+            switch (_layer)
             {
-                float u = std::max(0.0f, c.r);
-                e.r = (u <= 0.0031308f) ? (12.92f * u) : (1.055f * std::pow(u, 1.0f / 2.4f) - 0.055f);
+            case AovLayer::Colour:
+                EncodeRGBA8(AverageAt(x, y), true, lut, out);
+                continue;
+            case AovLayer::Albedo:
+                EncodeRGBA8(FeaturesAt(x, y).albedo, false, lut, out);
+                continue;
+            case AovLayer::Normal:
+                e = glm::clamp(FeaturesAt(x, y).normal * 0.5f + 0.5f, glm::vec3(0.0f), glm::vec3(1.0f));
+                break;
+            case AovLayer::Depth:
+            {
+                const float d = FeaturesAt(x, y).depth;
+                e = glm::vec3(_range.maxDepth > 0.0f ? glm::clamp(1.0f - d / _range.maxDepth, 0.0f, 1.0f) : 0.0f);
+                break;
             }
-            // G
+            case AovLayer::ObjectId:
             {
-                float u = std::max(0.0f, c.g);
-                e.g = (u <= 0.0031308f) ? (12.92f * u) : (1.055f * std::pow(u, 1.0f / 2.4f) - 0.055f);
+                // A distinct colour per id from the bits of a multiplicative hash
+                const uint32_t id = mObjectId[p];
+                const uint32_t h = id * 2654435761u;
+                e = id ? glm::vec3(float((h >> 24) & 0xffu), float((h >> 16) & 0xffu), float((h >> 8) & 0xffu)) / 255.0f : glm::vec3(0.0f);
+                break;
             }
-            // B
+            default:
             {
-                float u = std::max(0.0f, c.b);
-                e.b = (u <= 0.0031308f) ? (12.92f * u) : (1.055f * std::pow(u, 1.0f / 2.4f) - 0.055f);
+                // Blue -> green -> red with the count; converged tiles are drawn darker
+                const float t = float(mSamples[p]) / float(_range.maxSamples);
+                e = (t < 0.5f) ? glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f), t * 2.0f)
+                               : glm::mix(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), t * 2.0f - 1.0f);
+                if (IsConverged(x, y))
+                    e *= 0.5f;
+                break;
+            }
             }
+
+            out[0] = static_cast<std::uint8_t>(std::lround(e.r * 255.0f));
+            out[1] = static_cast<std::uint8_t>(std::lround(e.g * 255.0f));
+            out[2] = static_cast<std::uint8_t>(std::lround(e.b * 255.0f));
+            out[3] = 255u;
         }
+    }
+}
 
-        // Clamp to displayable range after encoding
-        e = glm::clamp(e, glm::vec3(0.0f), glm::vec3(1.0f));
+// Display encodings of [0,1] to 8 bits, one table per colour space in the order of the enum. Samples are close
+// enough that snapping to the nearest moves the output by well under a step, so results stay within one step of
+// the exact curve
+static constexpr int kEncodeLutSize = 1 << 14;
+static constexpr float kEncodeLutScale = float(kEncodeLutSize - 1);
 
-        mDisplay8[4 * p + 0] = static_cast<std::uint8_t>(std::lround(e.r * 255.0f));
-        mDisplay8[4 * p + 1] = static_cast<std::uint8_t>(std::lround(e.g * 255.0f));
-        mDisplay8[4 * p + 2] = static_cast<std::uint8_t>(std::lround(e.b * 255.0f));
-        mDisplay8[4 * p + 3] = 255u;
+const std::uint8_t* Film::EncodeLut(ColourSpace _colourSpace)
+{
+    static const std::vector<std::uint8_t> luts = [] {
+        std::vector<std::uint8_t> lut(2 * size_t(kEncodeLutSize));
+        for (int i = 0; i < kEncodeLutSize; ++i)
+        {
+            const float u = float(i) / kEncodeLutScale;
+            // sRGB encoding
+            const float s = (u <= 0.0031308f) ? (12.92f * u) : (1.055f * std::pow(u, 1.0f / 2.4f) - 0.055f);
+            lut[i] = static_cast<std::uint8_t>(std::lround(u * 255.0f));
+            lut[kEncodeLutSize + i] = static_cast<std::uint8_t>(std::lround(std::clamp(s, 0.0f, 1.0f) * 255.0f));
+        }
+        return lut;
+    }();
+    return luts.data() + static_cast<int>(_colourSpace) * kEncodeLutSize;
+}
+
+void Film::EncodeRGBA8(glm::vec3 _c, bool _toneMap, const std::uint8_t* _lut, std::uint8_t* _out) const
+{
+    if (_toneMap && mToneMap == ToneMap::Reinhard)
+        // Simple Reinhard tone mapping
+        _c = _c / (glm::vec3(1.0f) + _c);
+
+    // Clamp to the displayable range (NaN to 0), then encode by table
+    for (int i = 0; i < 3; ++i)
+        _out[i] = _lut[int(std::min(std::max(0.0f, _c[i]), 1.0f) * kEncodeLutScale + 0.5f)];
+    _out[3] = 255u;
+}
+
+const std::vector<std::uint8_t>& Film::ResolveToRGBA8(const std::vector<glm::vec3>& _image, ThreadPool& _threadPool)
+{
+    const int n = PixelCount();
+    if ((int)mDisplay8.size() != n * 4) mDisplay8.resize(n * 4);
+
+    const std::uint8_t* lut = EncodeLut(mColourSpace);
+    for (int y0 = 0; y0 < mHeight; y0 += kTileSize)
+    {
+        const int y1 = std::min(y0 + kTileSize, mHeight);
+        _threadPool.EnqueueTask([=, this, &_image] {
+            for (int p = y0 * mWidth; p < y1 * mWidth; ++p)
+                EncodeRGBA8(_image[p], true, lut, &mDisplay8[4 * size_t(p)]);
+        });
     }
+    _threadPool.WaitForCompletion();
 
-    mDirty = false;
+    mAllDirty = true; // The cached buffer no longer holds the accumulated image
     return mDisplay8;
-}
\ No newline at end of file
+}
+
+void Film::Upsample(int _scale, int _width, int _height, std::vector<glm::vec3>& _out) const
+{
+    _out.assign(size_t(_width) * _height, glm::vec3(0.0f));
+    if (mWidth == 0 || mHeight == 0)
+        return;
+
+    // Film pixel values sit at their blocks' centres; output pixels blend the four nearest
+    const float invScale = 1.0f / float(_scale);
+    for (int y = 0; y < _height; ++y)
+    {
+        const float fy = glm::clamp((float(y) + 0.5f) * invScale - 0.5f, 0.0f, float(mHeight - 1));
+        const int y0 = int(fy);
+        const int y1 = std::min(y0 + 1, mHeight - 1);
+        const float ty = fy - float(y0);
+
+        for (int x = 0; x < _width; ++x)
+        {
+            const float fx = glm::clamp((float(x) + 0.5f) * invScale - 0.5f, 0.0f, float(mWidth - 1));
+            const int x0 = int(fx);
+            const int x1 = std::min(x0 + 1, mWidth - 1);
+            const float tx = fx - float(x0);
+
+            const glm::vec3 top = glm::mix(AverageAt(x0, y0), AverageAt(x1, y0), tx);
+            const glm::vec3 bottom = glm::mix(AverageAt(x0, y1), AverageAt(x1, y1), tx);
+            _out[size_t(y) * _width + x] = glm::mix(top, bottom, ty);
+        }
+    }
+}
+
+void FilmTile::Reset(int _x0, int _y0, int _x1, int _y1)
+{
+    mX0 = _x0;
+    mY0 = _y0;
+    mX1 = std::max(_x0, _x1);
+    mY1 = std::max(_y0, _y1);
+    const size_t n = size_t(mX1 - mX0) * (mY1 - mY0);
+    mAccum.assign(n, glm::vec3(0.0f));
+    mSamples.assign(n, 0u);
+    mLumSqAccum.assign(n, 0.0f);
+    mAlbedoAccum.assign(n, glm::vec3(0.0f));
+    mNormalAccum.assign(n, glm::vec3(0.0f));
+    mDepthAccum.assign(n, 0.0f);
+    mFeatureSamples.assign(n, 0u);
+    mObjectId.assign(n, 0u);
+}
+
+void FilmTile::AddSample(int _x, int _y, const glm::vec3& _linearRGB, const SampleFeatures& _features)
+{
+    const int t = Index(_x, _y);
+    mAlbedoAccum[t] += _features.albedo;
+    mNormalAccum[t] += _features.normal;
+    mDepthAccum[t] += _features.depth;
+    if (mFeatureSamples[t] == 0u)
+        mObjectId[t] = _features.objectId;
+    mFeatureSamples[t] += 1u;
+
+    float lum;
+    mAccum[t] += ClampSample(_linearRGB, lum);
+    mLumSqAccum[t] += lum * lum;
+    mSamples[t] += 1u;
+}
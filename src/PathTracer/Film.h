@@ -1,8 +1,12 @@
 #pragma once
 
+#include "ThreadPool.h"
+
 #include <glm/glm.hpp>
 
 #include <vector>
+#include <atomic>
+#include <cstdint>
 
 enum class ColourSpace
 {
@@ -16,6 +20,64 @@ enum class ToneMap
     Reinhard
 };
 
+// Data about where a camera path first lands on a non-mirror surface, kept per pixel as AOV layers
+struct SampleFeatures
+{
+    glm::vec3 albedo{ 1.0f }; // 1 for paths that leave the scene, so the sky passes through unchanged
+    glm::vec3 normal{ 0.0f };
+    float depth = 0.0f; // Distance along the path from the camera
+    uint32_t objectId = 0; // 1 + index of the hit object in the PathTracer's list, 0 for paths that leave the scene
+
+    // Depth recorded for paths that leave the scene, far beyond any geometry
+    static constexpr float kMissDepth = 1e4f;
+};
+
+// Arbitrary output variables: per-pixel layers written during the normal trace alongside the colour
+enum class AovLayer
+{
+    Colour,
+    Albedo,
+    Normal,
+    Depth,
+    ObjectId, // The first sample's object; ids are not averaged
+    SampleCount,
+    Count
+};
+
+// Samples for one rectangle of a film, accumulated by a single task and merged into the film in one go
+// (Film::MergeTile), so tasks never write the film's shared arrays pixel by pixel
+class FilmTile
+{
+public:
+    // Empties the tile and places it over the film pixels [_x0, _x1) x [_y0, _y1); buffers are kept for reuse
+    void Reset(int _x0, int _y0, int _x1, int _y1);
+
+    // Adds one sample in linear RGB (firefly clamped to Film::kMaxSampleLuminance) with the path's first-hit
+    // features, in film coordinates inside the tile
+    void AddSample(int _x, int _y, const glm::vec3& _linearRGB, const SampleFeatures& _features);
+
+    uint32_t SampleCountAt(int _x, int _y) const { return mSamples[Index(_x, _y)]; }
+
+private:
+    friend class Film;
+
+    int Index(int _x, int _y) const { return (_y - mY0) * (mX1 - mX0) + (_x - mX0); }
+
+    int mX0 = 0;
+    int mY0 = 0;
+    int mX1 = 0;
+    int mY1 = 0;
+
+    std::vector<glm::vec3> mAccum;
+    std::vector<std::uint32_t> mSamples;
+    std::vector<float> mLumSqAccum;
+    std::vector<glm::vec3> mAlbedoAccum;
+    std::vector<glm::vec3> mNormalAccum;
+    std::vector<float> mDepthAccum;
+    std::vector<std::uint32_t> mFeatureSamples;
+    std::vector<std::uint32_t> mObjectId;
+};
+
 class Film
 {
 public:
@@ -25,19 +87,68 @@ public:
     void Resize(int _width, int _height);
     void Reset();
 
-    // Add one sample in linear RGB
-	void AddSample(int _x, int _y, const glm::vec3& _linearRGB);
+    // Camera samples are accumulated in a FilmTile by the task that traces them, then added here.
+    // Tiles over different pixels can be merged from different threads at once
+    void MergeTile(const FilmTile& _tile);
+
+    // Luminance a single sample or splat is clamped to, so rare very bright paths do not show as fireflies
+    static constexpr float kMaxSampleLuminance = 12.0f;
 
-    // Read the current average (linear space). Returns {0,0,0} if no samples yet.
+    // Light tracing: adds to any pixel's splat sum. Thread safe, unlike MergeTile, since light paths land anywhere
+    void AddSplat(int _x, int _y, const glm::vec3& _linearRGB);
+    // Splat sums are averaged over the light paths traced for the whole image, at one per camera sample;
+    // call with how many were traced (whether or not they splatted)
+    void AddLightPaths(uint64_t _count);
+
+    // Read the current average (linear space), camera samples plus splats. Returns {0,0,0} if no samples yet.
     glm::vec3 AverageAt(int _x, int _y) const;
 
+    uint32_t SampleCountAt(int _x, int _y) const { return mSamples[_y * mWidth + _x]; }
+
+    // Per-pixel averages of the features passed to FilmTile::AddSample; a pixel with no feature samples reads as a miss
+    SampleFeatures FeaturesAt(int _x, int _y) const;
+    uint32_t ObjectIdAt(int _x, int _y) const { return mObjectId[_y * mWidth + _x]; }
+    // Variance of AverageAt's luminance (the sample variance over the count), 0 below two samples
+    float VarianceAt(int _x, int _y) const;
+    // Mean of the squared sample luminances, 0 with no samples
+    float MeanLumSqAt(int _x, int _y) const;
+
+    // Temporal reprojection: counts _count samples with average _linearRGB and mean squared luminance _meanLumSq
+    // into the pixel, as if they had been traced there
+    void AddHistory(int _x, int _y, const glm::vec3& _linearRGB, float _meanLumSq, uint32_t _count);
+
+    // Adaptive sampling. Per tile, the mean relative standard error of pixel luminance (from the second moment
+    // buffer) is compared against _threshold once every pixel has _minSamples; tiles below it stop being sampled.
+    // Call between frames, not while samples are being added
+    void UpdateConvergence(float _threshold, uint32_t _minSamples);
+    bool IsConverged(int _x, int _y) const { return mTileConverged[(_y / kTileSize) * mTilesX + (_x / kTileSize)] != 0; }
+    // Share of pixels in converged tiles, as of the last UpdateConvergence
+    float GetConvergedFraction() const { return mConvergedFraction; }
+
+    // Layer shown by ResolveToRGBA8. Sample counts are a heat map (blue = fewest, red = most)
+    void SetDisplayLayer(AovLayer _layer) { mDisplayLayer = _layer; mAllDirty = true; }
+    AovLayer GetDisplayLayer() const { return mDisplayLayer; }
+    static const char* GetLayerName(AovLayer _layer);
+
+    // One layer as linear values, W*H: depth, id and count are repeated in all three channels
+    void GetLayer(AovLayer _layer, std::vector<glm::vec3>& _out) const;
+    // One layer as a viewable image sized W*H*4, as ResolveToRGBA8 would show it
+    void ResolveLayerToRGBA8(AovLayer _layer, std::vector<std::uint8_t>& _out) const;
+
 	// Returns a reference to an internal buffer sized W*H*4. Used for OpenGL texture upload.
-    const std::vector<std::uint8_t>& ResolveToRGBA8();
+    // Only tiles that changed since the last call are resolved again, in tasks on _threadPool
+    const std::vector<std::uint8_t>& ResolveToRGBA8(ThreadPool& _threadPool);
+    // Same colour space and tone mapping, applied to _image (linear RGB, W*H) instead of the accumulated average
+    const std::vector<std::uint8_t>& ResolveToRGBA8(const std::vector<glm::vec3>& _image, ThreadPool& _threadPool);
+
+    // Bilinear upsampling of the average into _out (_width*_height), each film pixel covering a _scale x _scale
+    // block; for previews traced at a fraction of the display's resolution
+    void Upsample(int _scale, int _width, int _height, std::vector<glm::vec3>& _out) const;
 
-	void SetColourSpace(ColourSpace _colourSpace) { mColourSpace = _colourSpace; mDirty = true; }
+	void SetColourSpace(ColourSpace _colourSpace) { mColourSpace = _colourSpace; mAllDirty = true; }
 	ColourSpace GetColourSpace() const { return mColourSpace; }
 
-	void SetToneMap(ToneMap _toneMap) { mToneMap = _toneMap; mDirty = true; }
+	void SetToneMap(ToneMap _toneMap) { mToneMap = _toneMap; mAllDirty = true; }
 	ToneMap GetToneMap() const { return mToneMap; }
 
     int  Width() const { return mWidth; }
@@ -47,16 +158,56 @@ public:
     const std::vector<glm::vec3>& Accum() const { return mAccum; }
     const std::vector<std::uint32_t>& Samples() const { return mSamples; }
 
+    static constexpr int kTileSize = 16;
+
 private:
+    int TileIndex(int _x, int _y) const { return (_y / kTileSize) * mTilesX + (_x / kTileSize); }
+    void MarkTileDirty(int _x, int _y) { mTileDirty[TileIndex(_x, _y)].store(1u, std::memory_order_relaxed); }
+
+    // Whole-image values some layers are shown relative to
+    struct DisplayRange
+    {
+        float maxDepth = 0.0f;
+        uint32_t maxSamples = 1u;
+    };
+    DisplayRange GetDisplayRange(AovLayer _layer) const;
+    // Writes the pixels [_x0, _x1) x [_y0, _y1) of a layer into _out (W*H*4)
+    void ResolveRect(AovLayer _layer, const DisplayRange& _range, int _x0, int _y0, int _x1, int _y1, std::vector<std::uint8_t>& _out) const;
+
+    // 8-bit encoding table of [0,1] for a colour space
+    static const std::uint8_t* EncodeLut(ColourSpace _colourSpace);
+    // Tone map, clamp to [0,1] and encode through _lut into one RGBA8 pixel
+    void EncodeRGBA8(glm::vec3 _c, bool _toneMap, const std::uint8_t* _lut, std::uint8_t* _out) const;
+
 	int mWidth = 0;
 	int mHeight = 0;
 
     std::vector<glm::vec3> mAccum; // Linear sums per pixel
     std::vector<std::uint32_t> mSamples; // Sample counts per pixel
+    std::vector<float> mLumSqAccum; // Sums of squared sample luminance, for the variance
+
+    std::vector<std::atomic<float>> mSplatAccum; // RGB per pixel
+    std::atomic<uint64_t> mLightPaths{ 0 };
+
+    // Feature sums and how many samples carried features
+    std::vector<glm::vec3> mAlbedoAccum;
+    std::vector<glm::vec3> mNormalAccum;
+    std::vector<float> mDepthAccum;
+    std::vector<std::uint32_t> mFeatureSamples;
+    std::vector<std::uint32_t> mObjectId;
+
+    int mTilesX = 0;
+    int mTilesY = 0;
+    std::vector<std::uint8_t> mTileConverged;
+    float mConvergedFraction = 0.0f;
+    AovLayer mDisplayLayer = AovLayer::Colour;
     std::vector<std::uint8_t>  mDisplay8; // Cached RGBA8 output
+    std::vector<int> mResolveTiles; // Tiles ResolveToRGBA8 is redoing
 
 	ColourSpace mColourSpace = ColourSpace::sRGB;
 	ToneMap mToneMap = ToneMap::Reinhard;
 
-	bool mDirty = true; // Accumulation changed since last resolve
+    // What changed since the last resolve: tiles that took samples, or everything (settings, splat normalisation)
+    std::vector<std::atomic<std::uint8_t>> mTileDirty;
+    std::atomic<bool> mAllDirty{ true };
 };
\ No newline at end of file
@@ -0,0 +1,586 @@
+#include "LightSampler.h"
+#include "MathUtil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static inline float SafeSqrt(float _x) { return std::sqrt(std::max(0.0f, _x)); }
+static inline float SafeAcos(float _x) { return std::acos(glm::clamp(_x, -1.0f, 1.0f)); }
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+static inline float CosSubClamped(float _sinA, float _cosA, float _sinB, float _cosB)
+{
+    return (_cosA > _cosB) ? 1.0f : _cosA * _cosB + _sinA * _sinB;
+}
+
+static inline float SinSubClamped(float _sinA, float _cosA, float _sinB, float _cosB)
+{
+    return (_cosA > _cosB) ? 0.0f : _sinA * _cosB - _cosA * _sinB;
+}
+
+// Rodrigues rotation of _v about the unit axis _k
+static inline glm::vec3 RotateAbout(const glm::vec3& _v, const glm::vec3& _k, float _angle)
+{
+    const float c = std::cos(_angle), s = std::sin(_angle);
+    return _v * c + glm::cross(_k, _v) * s + _k * glm::dot(_k, _v) * (1.0f - c);
+}
+
+LightBounds LightBounds::Union(const LightBounds& _a, const LightBounds& _b)
+{
+    if (_a.phi <= 0.0f) return _b;
+    if (_b.phi <= 0.0f) return _a;
+
+    LightBounds out;
+    out.min = glm::min(_a.min, _b.min);
+    out.max = glm::max(_a.max, _b.max);
+    out.phi = _a.phi + _b.phi;
+    out.cosThetaE = std::min(_a.cosThetaE, _b.cosThetaE);
+    out.twoSided = _a.twoSided || _b.twoSided;
+
+    // Smallest cone holding both normal cones
+    const float thetaA = SafeAcos(_a.cosThetaO), thetaB = SafeAcos(_b.cosThetaO);
+    const float thetaD = SafeAcos(glm::dot(_a.w, _b.w));
+    if (std::min(thetaD + thetaB, kPi) <= thetaA) { out.w = _a.w; out.cosThetaO = _a.cosThetaO; return out; }
+    if (std::min(thetaD + thetaA, kPi) <= thetaB) { out.w = _b.w; out.cosThetaO = _b.cosThetaO; return out; }
+
+    const float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+    const glm::vec3 axis = glm::cross(_a.w, _b.w);
+    const float axisLen = glm::length(axis);
+    if (thetaO >= kPi || axisLen <= 1e-7f)
+    {
+        out.w = _a.w;
+        out.cosThetaO = -1.0f;
+        return out;
+    }
+    out.w = glm::normalize(RotateAbout(_a.w, axis / axisLen, thetaO - thetaA));
+    out.cosThetaO = std::cos(thetaO);
+    return out;
+}
+
+float LightBounds::Importance(const glm::vec3& _p, const glm::vec3& _n) const
+{
+    const glm::vec3 centre = 0.5f * (min + max);
+    const glm::vec3 toP = _p - centre;
+    const float radius = 0.5f * glm::length(max - min);
+    const float d2 = std::max(glm::dot(toP, toP), radius); // Keep points inside or near the bounds from blowing up
+
+    const float dist = std::sqrt(glm::dot(toP, toP));
+    const glm::vec3 wi = (dist > 0.0f) ? toP / dist : glm::vec3(0.0f, 0.0f, 1.0f);
+
+    float cosThetaW = glm::dot(w, wi);
+    if (twoSided) cosThetaW = std::fabs(cosThetaW);
+    const float sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+
+    // Half-angle of the cone from _p that contains the bounds
+    float cosThetaB = -1.0f;
+    const bool inside = glm::all(glm::greaterThanEqual(_p, min)) && glm::all(glm::lessThanEqual(_p, max));
+    if (!inside && dist > radius)
+        cosThetaB = SafeSqrt(1.0f - radius * radius / (dist * dist));
+    const float sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+
+    // Smallest angle between a normal in the cone and a direction towards _p, then widened by the bounds
+    const float sinThetaO = SafeSqrt(1.0f - cosThetaO * cosThetaO);
+    const float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    const float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    const float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= cosThetaE)
+        return 0.0f;
+
+    float importance = phi * cosThetaP / d2;
+
+    // Same bound for the receiving surface's cosine
+    if (_n != glm::vec3(0.0f))
+    {
+        const float cosThetaI = std::fabs(glm::dot(wi, _n));
+        const float sinThetaI = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+        importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+    return std::max(importance, 0.0f);
+}
+
+void LightSampler::Clear()
+{
+    mLights.clear();
+    mNodes.clear();
+    mBitTrail.clear();
+    mPowerCdf.clear();
+    mEnvironment = nullptr;
+}
+
+uint32_t LightSampler::Add(const Light& _light)
+{
+    mLights.push_back(_light);
+    return uint32_t(mLights.size() - 1);
+}
+
+LightBounds LightSampler::BoundLight(const Light& _light)
+{
+    LightBounds b;
+    b.phi = _light.power;
+
+    switch (_light.type)
+    {
+    case Light::Type::Sphere:
+        b.min = _light.v0 - glm::vec3(_light.radius);
+        b.max = _light.v0 + glm::vec3(_light.radius);
+        b.cosThetaO = -1.0f; // Normals in every direction
+        break;
+    case Light::Type::Box:
+    {
+        const glm::vec3 extent = glm::abs(_light.v1) + glm::abs(_light.v2) + glm::abs(_light.v3);
+        b.min = _light.v0 - extent;
+        b.max = _light.v0 + extent;
+        b.cosThetaO = -1.0f;
+        break;
+    }
+    case Light::Type::Triangle:
+    {
+        b.min = glm::min(_light.v0, glm::min(_light.v1, _light.v2));
+        b.max = glm::max(_light.v0, glm::max(_light.v1, _light.v2));
+        const glm::vec3 n = glm::cross(_light.v1 - _light.v0, _light.v2 - _light.v0);
+        const float len = glm::length(n);
+        b.w = (len > 0.0f) ? n / len : glm::vec3(0.0f, 0.0f, 1.0f);
+        b.cosThetaO = 1.0f;
+        b.twoSided = true;
+        break;
+    }
+    }
+
+    b.cosThetaE = 0.0f; // Diffuse emitters light the whole hemisphere around each normal
+    return b;
+}
+
+void LightSampler::Build()
+{
+    mNodes.clear();
+    mBitTrail.assign(mLights.size(), 0);
+    mPowerCdf.clear();
+    if (mLights.empty())
+        return;
+
+    // Emission is only estimated (textures, centroid values), so lights with no estimated power
+    // keep a small share instead of becoming unreachable
+    float total = 0.0f;
+    for (const Light& light : mLights)
+        total += std::max(0.0f, light.power);
+    const float floorPower = (total > 0.0f) ? 1e-3f * total / float(mLights.size()) : 1.0f;
+
+    std::vector<std::pair<uint32_t, LightBounds>> lights;
+    lights.reserve(mLights.size());
+    for (size_t i = 0; i < mLights.size(); ++i)
+    {
+        LightBounds b = BoundLight(mLights[i]);
+        b.phi = std::max(b.phi, floorPower);
+        lights.emplace_back(uint32_t(i), b);
+        mPowerCdf.push_back((mPowerCdf.empty() ? 0.0f : mPowerCdf.back()) + b.phi);
+    }
+
+    mNodes.reserve(2 * lights.size());
+    BuildNode(lights, 0, lights.size(), 0, 0);
+}
+
+// Cost of a node for the split search: power times the solid angle its normals can light, times its area
+static float SplitCost(const LightBounds& _b, const glm::vec3& _extent, int _axis)
+{
+    const float thetaO = SafeAcos(_b.cosThetaO), thetaE = SafeAcos(_b.cosThetaE);
+    const float thetaW = std::min(thetaO + thetaE, kPi);
+    const float sinThetaO = SafeSqrt(1.0f - _b.cosThetaO * _b.cosThetaO);
+    const float mOmega = 2.0f * kPi * (1.0f - _b.cosThetaO) +
+        0.5f * kPi * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + _b.cosThetaO);
+
+    // Discourage thin slabs across the long axis of the parent
+    const float kr = std::max(_extent.x, std::max(_extent.y, _extent.z)) / std::max(_extent[_axis], 1e-20f);
+
+    const glm::vec3 d = _b.max - _b.min;
+    const float area = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    return _b.phi * mOmega * kr * area;
+}
+
+uint32_t LightSampler::BuildNode(std::vector<std::pair<uint32_t, LightBounds>>& _lights, size_t _start, size_t _end, uint64_t _bitTrail, int _depth)
+{
+    const uint32_t index = uint32_t(mNodes.size());
+    mNodes.emplace_back();
+
+    if (_end - _start == 1)
+    {
+        mNodes[index].bounds = _lights[_start].second;
+        mNodes[index].childOrLight = _lights[_start].first;
+        mNodes[index].leaf = true;
+        mBitTrail[_lights[_start].first] = _bitTrail;
+        return index;
+    }
+
+    glm::vec3 cMin(std::numeric_limits<float>::max()), cMax(-std::numeric_limits<float>::max());
+    LightBounds all;
+    for (size_t i = _start; i < _end; ++i)
+    {
+        const LightBounds& b = _lights[i].second;
+        const glm::vec3 c = 0.5f * (b.min + b.max);
+        cMin = glm::min(cMin, c);
+        cMax = glm::max(cMax, c);
+        all = LightBounds::Union(all, b);
+    }
+
+    // Binned split on light centroids; the trail is 64 bits, so deep subtrees just halve by count
+    size_t mid = _start + (_end - _start) / 2;
+    const glm::vec3 extent = all.max - all.min;
+    if (_depth < 32)
+    {
+        constexpr int kBuckets = 12;
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1, bestSplit = -1;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (cMax[axis] <= cMin[axis]) continue;
+            const float scale = float(kBuckets) / (cMax[axis] - cMin[axis]);
+
+            LightBounds buckets[kBuckets];
+            for (size_t i = _start; i < _end; ++i)
+            {
+                const float c = 0.5f * (_lights[i].second.min[axis] + _lights[i].second.max[axis]);
+                const int bucket = std::min(int((c - cMin[axis]) * scale), kBuckets - 1);
+                buckets[bucket] = LightBounds::Union(buckets[bucket], _lights[i].second);
+            }
+
+            for (int split = 0; split < kBuckets - 1; ++split)
+            {
+                LightBounds below, above;
+                for (int i = 0; i <= split; ++i) below = LightBounds::Union(below, buckets[i]);
+                for (int i = split + 1; i < kBuckets; ++i) above = LightBounds::Union(above, buckets[i]);
+                if (below.phi <= 0.0f || above.phi <= 0.0f) continue;
+
+                const float cost = SplitCost(below, extent, axis) + SplitCost(above, extent, axis);
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        if (bestAxis >= 0)
+        {
+            const float scale = float(kBuckets) / (cMax[bestAxis] - cMin[bestAxis]);
+            const auto it = std::partition(_lights.begin() + _start, _lights.begin() + _end, [&](const std::pair<uint32_t, LightBounds>& _l)
+                {
+                    const float c = 0.5f * (_l.second.min[bestAxis] + _l.second.max[bestAxis]);
+                    return std::min(int((c - cMin[bestAxis]) * scale), kBuckets - 1) <= bestSplit;
+                });
+            mid = size_t(it - _lights.begin());
+        }
+    }
+
+    if (mid == _start || mid == _end)
+        mid = _start + (_end - _start) / 2;
+
+    BuildNode(_lights, _start, mid, _bitTrail, _depth + 1);
+    const uint32_t second = BuildNode(_lights, mid, _end, _bitTrail | (uint64_t(1) << _depth), _depth + 1);
+
+    mNodes[index].bounds = all;
+    mNodes[index].childOrLight = second;
+    return index;
+}
+
+float LightSampler::SelectionPmf(uint32_t _index, const glm::vec3& _p, const glm::vec3& _n) const
+{
+    uint64_t trail = mBitTrail[_index];
+    float pmf = 1.0f;
+    uint32_t node = 0;
+    while (!mNodes[node].leaf)
+    {
+        const uint32_t children[2] = { node + 1, mNodes[node].childOrLight };
+        const float i0 = mNodes[children[0]].bounds.Importance(_p, _n);
+        const float i1 = mNodes[children[1]].bounds.Importance(_p, _n);
+        if (i0 + i1 <= 0.0f)
+            return 0.0f;
+
+        const int child = int(trail & 1);
+        pmf *= (child ? i1 : i0) / (i0 + i1);
+        node = children[child];
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+bool LightSampler::Sample(const glm::vec3& _p, const glm::vec3& _n, float _uLight, const glm::vec2& _u, LightSample& _out) const
+{
+    float u = _uLight;
+    float pmf = 1.0f;
+
+    const float pEnvironment = EnvironmentProbability();
+    if (pEnvironment > 0.0f)
+    {
+        if (u < pEnvironment)
+        {
+            if (!mEnvironment->Sample(_u, _out.wi, _out.pdf))
+                return false;
+            _out.pdf *= pEnvironment;
+            _out.environment = true;
+            return true;
+        }
+        u = std::min((u - pEnvironment) / (1.0f - pEnvironment), 0.99999994f);
+        pmf = 1.0f - pEnvironment;
+    }
+
+    if (mNodes.empty())
+        return false;
+
+    // Walk down picking children by importance, reusing the remainder of _uLight at each level
+    uint32_t node = 0;
+    while (!mNodes[node].leaf)
+    {
+        const uint32_t children[2] = { node + 1, mNodes[node].childOrLight };
+        const float i0 = mNodes[children[0]].bounds.Importance(_p, _n);
+        const float i1 = mNodes[children[1]].bounds.Importance(_p, _n);
+        if (i0 + i1 <= 0.0f)
+            return false;
+
+        const float p0 = i0 / (i0 + i1);
+        if (u < p0)
+        {
+            u = std::min(u / p0, 0.99999994f);
+            pmf *= p0;
+            node = children[0];
+        }
+        else
+        {
+            u = std::min((u - p0) / (1.0f - p0), 0.99999994f);
+            pmf *= 1.0f - p0;
+            node = children[1];
+        }
+    }
+    if (pmf <= 0.0f)
+        return false;
+
+    const uint32_t index = mNodes[node].childOrLight;
+    const Light& light = mLights[index];
+    if (!SampleShape(light, _p, _u, _out))
+        return false;
+
+    _out.pdf *= pmf;
+    _out.hit.t = _out.dist;
+    _out.hit.object = light.object;
+    _out.hit.primitive = light.primitive;
+    return true;
+}
+
+float LightSampler::Pdf(uint32_t _index, const glm::vec3& _p, const glm::vec3& _n, const glm::vec3& _point) const
+{
+    return (1.0f - EnvironmentProbability()) * SelectionPmf(_index, _p, _n) * ShapePdf(mLights[_index], _p, _point);
+}
+
+float LightSampler::EnvironmentPdf(const glm::vec3& _dir) const
+{
+    return mEnvironment ? EnvironmentProbability() * mEnvironment->Pdf(_dir) : 0.0f;
+}
+
+bool LightSampler::SampleArea(float _uLight, const glm::vec2& _u, uint32_t& _index, glm::vec3& _p, glm::vec3& _n, Hit& _hit, float& _pdf) const
+{
+    if (mPowerCdf.empty())
+        return false;
+
+    const float target = _uLight * mPowerCdf.back();
+    _index = uint32_t(std::min(size_t(std::upper_bound(mPowerCdf.begin(), mPowerCdf.end(), target) - mPowerCdf.begin()), mPowerCdf.size() - 1));
+    const Light& light = mLights[_index];
+    if (light.area <= 0.0f)
+        return false;
+
+    switch (light.type)
+    {
+    case Light::Type::Sphere:
+    {
+        const float z = 1.0f - 2.0f * _u.x;
+        const float r = SafeSqrt(1.0f - z * z);
+        const float phi = 2.0f * kPi * _u.y;
+        _n = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+        _p = light.v0 + _n * light.radius;
+        break;
+    }
+    case Light::Type::Box:
+    {
+        // Same face choice and parameterisation as SampleShape
+        const glm::vec3 axes[3] = { light.v1, light.v2, light.v3 };
+        float faceArea[3];
+        for (int k = 0; k < 3; ++k)
+            faceArea[k] = 4.0f * glm::length(axes[(k + 1) % 3]) * glm::length(axes[(k + 2) % 3]);
+
+        float x = _u.x * light.area;
+        int face = 0;
+        while (face < 5 && x >= faceArea[face / 2])
+        {
+            x -= faceArea[face / 2];
+            ++face;
+        }
+        const int k = face / 2;
+        const float side = (face & 1) ? -1.0f : 1.0f;
+        const float s = glm::clamp(x / std::max(faceArea[k], 1e-20f), 0.0f, 1.0f);
+
+        _n = glm::normalize(axes[k]) * side;
+        _p = light.v0 + side * axes[k] + (2.0f * s - 1.0f) * axes[(k + 1) % 3] + (2.0f * _u.y - 1.0f) * axes[(k + 2) % 3];
+        break;
+    }
+    case Light::Type::Triangle:
+    {
+        const float su = std::sqrt(_u.x);
+        const float u = _u.y * su;
+        const float v = 1.0f - su;
+        _p = (1.0f - u - v) * light.v0 + u * light.v1 + v * light.v2;
+        _n = glm::normalize(glm::cross(light.v1 - light.v0, light.v2 - light.v0));
+        _hit.uv = glm::vec2(u, v);
+        break;
+    }
+    }
+
+    _hit.object = light.object;
+    _hit.primitive = light.primitive;
+    _pdf = AreaPdf(_index);
+    return _pdf > 0.0f;
+}
+
+float LightSampler::AreaPdf(uint32_t _index) const
+{
+    const float previous = (_index > 0) ? mPowerCdf[_index - 1] : 0.0f;
+    const float area = mLights[_index].area;
+    return (area > 0.0f) ? (mPowerCdf[_index] - previous) / (mPowerCdf.back() * area) : 0.0f;
+}
+
+bool LightSampler::SampleShape(const Light& _light, const glm::vec3& _p, const glm::vec2& _u, LightSample& _out)
+{
+    switch (_light.type)
+    {
+    case Light::Type::Sphere:
+    {
+        // Uniform over the cone of directions the sphere subtends
+        const glm::vec3 toCentre = _light.v0 - _p;
+        const float d2 = glm::dot(toCentre, toCentre);
+        const float r2 = _light.radius * _light.radius;
+        if (d2 <= r2) return false;
+
+        const float sin2Max = r2 / d2;
+        const float oneMinusCosMax = (sin2Max < 1e-4f) ? 0.5f * sin2Max : 1.0f - std::sqrt(1.0f - sin2Max); // Stable for far lights
+
+        const float cosT = 1.0f - _u.x * oneMinusCosMax;
+        const float sinT = std::sqrt(std::max(0.0f, 1.0f - cosT * cosT));
+        const float phi = 2.0f * kPi * _u.y;
+
+        const glm::vec3 w = toCentre / std::sqrt(d2);
+        const glm::vec3 up = (std::fabs(w.z) < 0.999f) ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+        const glm::vec3 t = glm::normalize(glm::cross(up, w));
+        const glm::vec3 b = glm::cross(w, t);
+        _out.wi = glm::normalize(sinT * std::cos(phi) * t + sinT * std::sin(phi) * b + cosT * w);
+
+        // Near root of |p + s*wi - c|^2 = r^2; clamped so grazing directions land on the silhouette
+        const float proj = glm::dot(_out.wi, toCentre);
+        const float disc = r2 - (d2 - proj * proj);
+        _out.dist = proj - std::sqrt(std::max(0.0f, disc));
+        _out.p = _p + _out.wi * _out.dist;
+        _out.pdf = 1.0f / (2.0f * kPi * oneMinusCosMax);
+        return true;
+    }
+    case Light::Type::Box:
+    {
+        // Pick a face by area, then a uniform point on it
+        const glm::vec3 axes[3] = { _light.v1, _light.v2, _light.v3 };
+        float faceArea[3];
+        for (int k = 0; k < 3; ++k)
+            faceArea[k] = 4.0f * glm::length(axes[(k + 1) % 3]) * glm::length(axes[(k + 2) % 3]);
+
+        float x = _u.x * _light.area;
+        int face = 0;
+        while (face < 5 && x >= faceArea[face / 2])
+        {
+            x -= faceArea[face / 2];
+            ++face;
+        }
+        const int k = face / 2;
+        const float side = (face & 1) ? -1.0f : 1.0f;
+        const float s = glm::clamp(x / std::max(faceArea[k], 1e-20f), 0.0f, 1.0f);
+
+        const glm::vec3 n = glm::normalize(axes[k]) * side;
+        _out.p = _light.v0 + side * axes[k] + (2.0f * s - 1.0f) * axes[(k + 1) % 3] + (2.0f * _u.y - 1.0f) * axes[(k + 2) % 3];
+
+        const glm::vec3 d = _out.p - _p;
+        _out.dist = glm::length(d);
+        if (_out.dist <= 0.0f) return false;
+        _out.wi = d / _out.dist;
+
+        const float cosL = -glm::dot(n, _out.wi);
+        if (cosL <= 0.0f) return false; // Faces turned away are hidden behind the box itself
+        _out.pdf = _out.dist * _out.dist / (cosL * _light.area);
+        return true;
+    }
+    case Light::Type::Triangle:
+    {
+        // Uniform barycentrics; uv follows the RayTriMT convention (weights of v1 and v2)
+        const float su = std::sqrt(_u.x);
+        const float u = _u.y * su;
+        const float v = 1.0f - su;
+        _out.p = (1.0f - u - v) * _light.v0 + u * _light.v1 + v * _light.v2;
+        _out.hit.uv = glm::vec2(u, v);
+
+        const glm::vec3 d = _out.p - _p;
+        _out.dist = glm::length(d);
+        if (_out.dist <= 0.0f) return false;
+        _out.wi = d / _out.dist;
+
+        // Emissive triangles shine from both sides, like the hit path treats them
+        const glm::vec3 n = glm::normalize(glm::cross(_light.v1 - _light.v0, _light.v2 - _light.v0));
+        const float cosL = std::fabs(glm::dot(n, _out.wi));
+        if (cosL <= 1e-6f) return false;
+        _out.pdf = _out.dist * _out.dist / (cosL * _light.area);
+        return true;
+    }
+    }
+    return false;
+}
+
+float LightSampler::ShapePdf(const Light& _light, const glm::vec3& _p, const glm::vec3& _point)
+{
+    switch (_light.type)
+    {
+    case Light::Type::Sphere:
+    {
+        const glm::vec3 toCentre = _light.v0 - _p;
+        const float d2 = glm::dot(toCentre, toCentre);
+        const float r2 = _light.radius * _light.radius;
+        if (d2 <= r2) return 0.0f;
+
+        const float sin2Max = r2 / d2;
+        const float oneMinusCosMax = (sin2Max < 1e-4f) ? 0.5f * sin2Max : 1.0f - std::sqrt(1.0f - sin2Max);
+        return 1.0f / (2.0f * kPi * oneMinusCosMax);
+    }
+    case Light::Type::Box:
+    {
+        // Face from the axis the point sits furthest out along
+        const glm::vec3 axes[3] = { _light.v1, _light.v2, _light.v3 };
+        const glm::vec3 local = _point - _light.v0;
+        int k = 0;
+        float best = -1.0f;
+        for (int i = 0; i < 3; ++i)
+        {
+            const float rel = std::fabs(glm::dot(local, axes[i])) / std::max(glm::dot(axes[i], axes[i]), 1e-20f);
+            if (rel > best) { best = rel; k = i; }
+        }
+        const glm::vec3 n = glm::normalize(axes[k]) * (glm::dot(local, axes[k]) > 0.0f ? 1.0f : -1.0f);
+
+        const glm::vec3 d = _point - _p;
+        const float dist2 = glm::dot(d, d);
+        const float cosL = -glm::dot(n, d) / std::sqrt(dist2);
+        if (cosL <= 0.0f) return 0.0f;
+        return dist2 / (cosL * _light.area);
+    }
+    case Light::Type::Triangle:
+    {
+        const glm::vec3 n = glm::normalize(glm::cross(_light.v1 - _light.v0, _light.v2 - _light.v0));
+        const glm::vec3 d = _point - _p;
+        const float dist2 = glm::dot(d, d);
+        const float cosL = std::fabs(glm::dot(n, d)) / std::sqrt(dist2);
+        if (cosL <= 1e-6f) return 0.0f;
+        return dist2 / (cosL * _light.area);
+    }
+    }
+    return 0.0f;
+}
\ No newline at end of file
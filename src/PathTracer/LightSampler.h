@@ -0,0 +1,120 @@
+#pragma once
+
+#include "RayObject.h"
+#include "EnvironmentMap.h"
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+// An emitter in a CompiledScene, with its geometry copied so it can be sampled directly
+struct Light
+{
+	enum class Type : uint8_t { Sphere, Box, Triangle };
+	Type type = Type::Sphere;
+
+	// Sphere: v0 = centre. Box: v0 = centre, v1..v3 = world axes scaled by the half extents. Triangle: v0..v2 = vertices
+	glm::vec3 v0{ 0.0f }, v1{ 0.0f }, v2{ 0.0f }, v3{ 0.0f };
+	float radius = 0.0f;
+
+	float area = 0.0f;
+	float power = 0.0f; // Luminance * emitting area, drives how often the light is picked
+
+	// Identifies the emitter's surface in the CompiledScene, so its emission can be evaluated like any hit
+	int object = -1;
+	uint32_t primitive = 0;
+};
+
+// A point on a light as seen from a shading point
+struct LightSample
+{
+	glm::vec3 p{ 0.0f }; // Point on the light
+	glm::vec3 wi{ 0.0f }; // Unit direction from the shading point to p
+	float dist = 0.0f;
+	float pdf = 0.0f; // Per unit solid angle at the shading point, including the light selection probability
+	Hit hit; // Hit record for p along wi, for ComputeSurfaceInteraction
+	bool environment = false; // Direction towards the environment map; p, dist and hit are unused
+};
+
+// Spatial and directional extent of a group of emitters, used to bound their contribution at a point
+struct LightBounds
+{
+	glm::vec3 min{ 0.0f }, max{ 0.0f };
+	glm::vec3 w{ 0.0f, 0.0f, 1.0f }; // Axis of the cone of surface normals
+	float phi = 0.0f; // Total power
+	float cosThetaO = 1.0f; // Spread of the normals around w
+	float cosThetaE = 0.0f; // Emission spread past the normals (hemisphere for diffuse emitters)
+	bool twoSided = false;
+
+	static LightBounds Union(const LightBounds& _a, const LightBounds& _b);
+
+	// Conservative estimate of the contribution at _p on a surface with unit normal _n (zero _n to ignore it)
+	float Importance(const glm::vec3& _p, const glm::vec3& _n) const;
+};
+
+// Picks lights by their estimated contribution at the shading point, by stochastic traversal of a
+// light BVH, and samples points on them for next-event estimation
+class LightSampler
+{
+public:
+	void Clear();
+	uint32_t Add(const Light& _light);
+
+	// Distant lighting sampled alongside the BVH, or nullptr; must outlive the sampler's use
+	void SetEnvironment(const EnvironmentMap* _environment) { mEnvironment = _environment; }
+	const EnvironmentMap* GetEnvironment() const { return mEnvironment; }
+
+	// Builds the light BVH, call after the last Add
+	void Build();
+
+	bool Empty() const { return mLights.empty() && !mEnvironment; }
+	size_t GetLightCount() const { return mLights.size(); }
+
+	// _n is the shading normal at _p (or zero). False if no light can reach _p or the chosen one
+	// cannot be seen from it (back-facing sample, _p inside the light, ...)
+	bool Sample(const glm::vec3& _p, const glm::vec3& _n, float _uLight, const glm::vec2& _u, LightSample& _out) const;
+
+	// Density Sample would give to the direction from _p to _point on light _index
+	float Pdf(uint32_t _index, const glm::vec3& _p, const glm::vec3& _n, const glm::vec3& _point) const;
+	// Density Sample would give to the environment in direction _dir
+	float EnvironmentPdf(const glm::vec3& _dir) const;
+
+	// Light tracing: a light picked in proportion to its power (ignoring the environment) and a point uniform over
+	// its area. _n is the outward normal at the point (either side of a triangle emits); _pdf is per unit area,
+	// including the pick. _hit locates the point for ComputeSurfaceInteraction
+	bool SampleArea(float _uLight, const glm::vec2& _u, uint32_t& _index, glm::vec3& _p, glm::vec3& _n, Hit& _hit, float& _pdf) const;
+	// Density SampleArea gives to any point on light _index
+	float AreaPdf(uint32_t _index) const;
+	const Light& GetLight(uint32_t _index) const { return mLights[_index]; }
+
+	// Chance of Sample picking the environment rather than the BVH
+	float EnvironmentProbability() const { return mEnvironment ? (mNodes.empty() ? 1.0f : 0.5f) : 0.0f; }
+
+private:
+
+	struct Node
+	{
+		LightBounds bounds;
+		uint32_t childOrLight = 0; // Second child for interior nodes (the first follows the node), light index for leaves
+		bool leaf = false;
+	};
+
+	// Probability that traversal from _p reaches light _index
+	float SelectionPmf(uint32_t _index, const glm::vec3& _p, const glm::vec3& _n) const;
+
+	uint32_t BuildNode(std::vector<std::pair<uint32_t, LightBounds>>& _lights, size_t _start, size_t _end, uint64_t _bitTrail, int _depth);
+	static LightBounds BoundLight(const Light& _light);
+
+	// Shape pdfs are per unit solid angle at _p, without the selection probability
+	static bool SampleShape(const Light& _light, const glm::vec3& _p, const glm::vec2& _u, LightSample& _out);
+	static float ShapePdf(const Light& _light, const glm::vec3& _p, const glm::vec3& _point);
+
+	std::vector<Light> mLights;
+	std::vector<Node> mNodes;
+	std::vector<uint64_t> mBitTrail; // Per light, the child taken at each level from the root (bit i = level i)
+	std::vector<float> mPowerCdf; // Running sum of the floored powers, for SampleArea
+
+	const EnvironmentMap* mEnvironment = nullptr;
+};
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+
+// Small helpers shared across the renderer
+
+inline constexpr float kPi = 3.1415926535f;
+
+// Rec. 709 luminance of a linear RGB colour
+inline float Luminance(const glm::vec3& _c)
+{
+	return 0.2126f * _c.r + 0.7152f * _c.g + 0.0722f * _c.b;
+}
+
+// Albedo is clamped before dividing by it, so black surfaces (and emitters) keep their light when radiance
+// is demodulated, as by the denoiser and the radiance cache
+inline glm::vec3 SafeAlbedo(const glm::vec3& _albedo)
+{
+	return glm::max(_albedo, glm::vec3(0.01f));
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "RayObject.h"
 
 #include "ModelLoader.h"
+#include "TriangleBvh.h"
 
 #include "tiny_gltf.h"
 
@@ -15,49 +16,28 @@ public:
 	~Mesh() {}
 
 	bool RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) override;
+	void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const override;
 
-	void UpdateUI() override;
+	bool UpdateUI() override;
 
 	void SetScale(const glm::vec3& _scale) { mScale = _scale; }
 	glm::vec3 GetScale() { return mScale; }
 
-private:
-	glm::vec3 mScale = glm::vec3(1.0f);
-
-	std::shared_ptr<ModelLoader> mModel;
-
-    // BVH build helpers
-    void BuildBVH();
-    uint32_t BuildNode(uint32_t start, uint32_t count); // Returns node index
-
-    // Compute aabb for a range of faces (by indices)
-    void RangeBounds(uint32_t start, uint32_t count, glm::vec3& outMin, glm::vec3& outMax) const;
+	// Object-to-world transform from position/rotation/scale, and its inverse
+	void BuildTransform(glm::mat4& _M, glm::mat4& _Minv) const;
 
-    // Intersection helpers (for traversal)
-    static inline bool RayAabb(const Ray& r, const glm::vec3& bmin, const glm::vec3& bmax, float tMax, float& t0, float& t1);
+	std::shared_ptr<ModelLoader> GetModel() const { return mModel; }
 
-    static inline bool RayTriMT(const Ray& r, const ModelLoader::Face& f, float& t, float& u, float& v);
+	// Shading for one face of mModel (or a copy of it baked to another space by _M / _MinvT)
+	void ComputeFaceInteraction(const ModelLoader::Face& _face, const glm::vec2& _bary, const glm::mat4& _M, const glm::mat3& _MinvT,
+		const Ray& _ray, SurfaceInteraction& _out) const;
 
-    // BVH (flattened, index-based)
-    struct BvhNode
-    {
-        glm::vec3 bmin; // Node AABB
-        glm::vec3 bmax;
-        uint32_t leftFirst; // Inner: index of left child; leaf: start in mFaceIdx
-        uint32_t rightChild;
-        uint32_t count; // Inner: 0; leaf: number of faces in leaf
-    };
-
-    std::vector<BvhNode> mNodes; // Nodes in a flat array
-    std::vector<uint32_t> mFaceIdx; // Permutation of [0..numFaces), leaves are contiguous ranges
-
-    // Precomputed per-face bounds & centroids (object space)
-    std::vector<glm::vec3> mFaceBMin;
-    std::vector<glm::vec3> mFaceBMax;
-    std::vector<glm::vec3> mFaceCentroid;
+private:
+	glm::vec3 mScale = glm::vec3(1.0f);
 
-    unsigned mLeafThreshold = 2; // Max faces per leaf
+	std::shared_ptr<ModelLoader> mModel;
 
+    TriangleBvh mBvh; // Object-space BVH over mModel's faces
 
     void FillMaterialAt(int materialGroup, const glm::vec2& uv, Material& outMat) const;
 };
\ No newline at end of file
@@ -31,6 +31,7 @@ public:
         glm::vec3 position{ 0.0f };
         glm::vec2 texcoord{ 0.0f };
         glm::vec3 normal{ 0.0f };
+        glm::vec4 tangent{ 0.0f }; // xyz = tangent, w = bitangent sign (glTF convention)
     };
 
     struct Face
@@ -99,6 +100,9 @@ public:
     // Embedded images from the glTF (CPU-side, raw bytes).
     const std::vector<EmbeddedImage>& GetEmbeddedImages() const { return m_embeddedImages; }
 
+    // Nearest-texel lookup with wrap repeat, channels normalised to 0..1 (alpha defaults to 1)
+    static glm::vec4 SampleImageNearest(const EmbeddedImage& img, glm::vec2 uv);
+
 private:
     // Geometry
     std::vector<Face> m_faces;
@@ -118,6 +122,12 @@ private:
     // Helpers
     void calculate_dimensions();
     bool LoadGLTF(const std::string& path);
+
+    // Builds tangents for an indexed primitive when the file does not supply TANGENT, one per index (face corner):
+    // corners of a vertex whose faces disagree on handedness or on the tangent direction get their own tangent
+    static void GenerateTangents(const std::vector<uint32_t>& indices,
+        const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+        const std::vector<glm::vec2>& texcoords, std::vector<glm::vec4>& outTangents);
 };
 
 // ===== Implementation =====
@@ -248,6 +258,20 @@ inline bool ModelLoader::LoadGLTF(const std::string& path)
                 }
             }
 
+            // TANGENT (optional, generated below when missing)
+            const float* tanBase = nullptr; size_t tanStride = 0;
+            if (prim.attributes.count("TANGENT"))
+            {
+                const auto& tgAcc = scene.accessors.at(prim.attributes.at("TANGENT"));
+                if (tgAcc.type == TINYGLTF_TYPE_VEC4 && tgAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+                {
+                    const auto& tgView = scene.bufferViews.at(tgAcc.bufferView);
+                    const auto& tgBuf = scene.buffers.at(tgView.buffer);
+                    tanBase = reinterpret_cast<const float*>(tgBuf.data.data() + tgView.byteOffset + tgAcc.byteOffset);
+                    tanStride = tgView.byteStride ? tgView.byteStride : 4 * sizeof(float);
+                }
+            }
+
             // Indices
             if (prim.indices < 0)
                 throw std::runtime_error("Indexed geometry required");
@@ -361,6 +385,27 @@ inline bool ModelLoader::LoadGLTF(const std::string& path)
                 }
             }
 
+            // Read the index list up front so tangents can be generated over the whole primitive
+            std::vector<uint32_t> indices;
+            indices.reserve(iAcc.count);
+            for (size_t k = 0; k < iAcc.count; ++k)
+            {
+                switch (iAcc.componentType)
+                {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                    indices.push_back(*(const uint8_t*)(iBase + k * iStride));
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                    indices.push_back(*(const uint16_t*)(iBase + k * iStride));
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                    indices.push_back(*(const uint32_t*)(iBase + k * iStride));
+                    break;
+                default:
+                    throw std::runtime_error("Unsupported index type");
+                }
+            }
+
             auto fetchVert = [&](Vertex& v, size_t vi)
                 {
                     const float* p = reinterpret_cast<const float*>(posBase + vi * posStride);
@@ -377,37 +422,50 @@ inline bool ModelLoader::LoadGLTF(const std::string& path)
                             reinterpret_cast<const unsigned char*>(uvBase) + vi * uvStride);
                         v.texcoord = { t[0], t[1] };
                     }
+                    if (tanBase)
+                    {
+                        const float* t = reinterpret_cast<const float*>(
+                            reinterpret_cast<const unsigned char*>(tanBase) + vi * tanStride);
+                        v.tangent = { t[0], t[1], t[2], t[3] };
+                    }
                 };
 
-            for (size_t f = 0; f + 2 < iAcc.count; f += 3)
+            // Generate tangents once here so hits only need to interpolate them
+            std::vector<glm::vec4> generatedTangents;
+            if (!tanBase && uvBase && normBase)
             {
-                uint32_t i0 = 0, i1 = 0, i2 = 0;
-                switch (iAcc.componentType)
+                const size_t vertexCount = posAcc.count;
+                std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+                std::vector<glm::vec2> texcoords(vertexCount);
+                for (size_t vi = 0; vi < vertexCount; ++vi)
                 {
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                    i0 = *(const uint8_t*)(iBase + (f + 0) * iStride);
-                    i1 = *(const uint8_t*)(iBase + (f + 1) * iStride);
-                    i2 = *(const uint8_t*)(iBase + (f + 2) * iStride);
-                    break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    i0 = *(const uint16_t*)(iBase + (f + 0) * iStride);
-                    i1 = *(const uint16_t*)(iBase + (f + 1) * iStride);
-                    i2 = *(const uint16_t*)(iBase + (f + 2) * iStride);
-                    break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    i0 = *(const uint32_t*)(iBase + (f + 0) * iStride);
-                    i1 = *(const uint32_t*)(iBase + (f + 1) * iStride);
-                    i2 = *(const uint32_t*)(iBase + (f + 2) * iStride);
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported index type");
+                    Vertex v;
+                    fetchVert(v, vi);
+                    positions[vi] = v.position;
+                    normals[vi] = v.normal;
+                    texcoords[vi] = v.texcoord;
                 }
+                GenerateTangents(indices, positions, normals, texcoords, generatedTangents);
+            }
+
+            for (size_t f = 0; f + 2 < indices.size(); f += 3)
+            {
+                const uint32_t i0 = indices[f + 0];
+                const uint32_t i1 = indices[f + 1];
+                const uint32_t i2 = indices[f + 2];
 
                 Face face;
                 fetchVert(face.a, i0);
                 fetchVert(face.b, i1);
                 fetchVert(face.c, i2);
 
+                if (!generatedTangents.empty())
+                {
+                    face.a.tangent = generatedTangents[f + 0];
+                    face.b.tangent = generatedTangents[f + 1];
+                    face.c.tangent = generatedTangents[f + 2];
+                }
+
                 if (useMat) face.materialGroup = static_cast<int>(groupIndex);
 
                 if (useMat) m_materialGroups[groupIndex].faces.push_back(face);
@@ -419,6 +477,166 @@ inline bool ModelLoader::LoadGLTF(const std::string& path)
     return true;
 }
 
+inline glm::vec4 ModelLoader::SampleImageNearest(const EmbeddedImage& img, glm::vec2 uv)
+{
+    if (img.width <= 0 || img.height <= 0 || img.channels <= 0 || img.data.empty())
+        return glm::vec4(1, 1, 1, 1);
+
+    // Wrap repeat
+    uv = glm::fract(uv);
+    if (uv.x < 0) uv.x += 1.0f;
+    if (uv.y < 0) uv.y += 1.0f;
+
+    const int x = int(uv.x * img.width);
+    const int y = int(uv.y * img.height);
+    const int ix = glm::clamp(x, 0, img.width - 1);
+    const int iy = glm::clamp(y, 0, img.height - 1);
+
+    const int ch = img.channels;
+    const size_t idx = (size_t(iy) * img.width + size_t(ix)) * size_t(ch);
+
+    auto get = [&](int c)->float {
+        return (c < ch) ? (img.data[idx + c] / 255.0f) : (c == 3 ? 1.0f : 0.0f);
+        };
+    return glm::vec4(get(0), get(1), get(2), get(3));
+}
+
+inline void ModelLoader::GenerateTangents(const std::vector<uint32_t>& indices,
+    const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+    const std::vector<glm::vec2>& texcoords, std::vector<glm::vec4>& outTangents)
+{
+    // MikkTSpace-style accumulation: per-face tangent/bitangent directions from the UV gradients,
+    // projected into each vertex's normal plane and weighted by the corner angle. A vertex is split
+    // into groups of corners that agree on handedness and whose tangents lie within kSplitCos of the
+    // group's first, and each group accumulates on its own (mirrored UVs share vertices along the mirror).
+    const float kSplitCos = 0.5f; // 60 degrees
+    const size_t vertexCount = positions.size();
+    const size_t cornerCount = indices.size() / 3 * 3;
+
+    struct Corner
+    {
+        glm::vec3 t{ 0.0f }; // Unit tangent in the vertex normal plane
+        glm::vec3 b{ 0.0f };
+        float weight = 0.0f; // Corner angle, 0 if the face has no usable UV gradient
+        float sign = 1.0f; // Face handedness
+    };
+    std::vector<Corner> corners(cornerCount);
+
+    for (size_t f = 0; f < cornerCount; f += 3)
+    {
+        const uint32_t idx[3] = { indices[f + 0], indices[f + 1], indices[f + 2] };
+        if (idx[0] >= vertexCount || idx[1] >= vertexCount || idx[2] >= vertexCount) continue;
+
+        const glm::vec3 dp1 = positions[idx[1]] - positions[idx[0]];
+        const glm::vec3 dp2 = positions[idx[2]] - positions[idx[0]];
+        const glm::vec2 duv1 = texcoords[idx[1]] - texcoords[idx[0]];
+        const glm::vec2 duv2 = texcoords[idx[2]] - texcoords[idx[0]];
+
+        const float det = duv1.x * duv2.y - duv1.y * duv2.x;
+        if (std::abs(det) < 1e-12f) continue; // Degenerate UVs contribute nothing
+
+        // Only the directions matter, so the 1/det scale is folded into its sign
+        const float s = det > 0.0f ? 1.0f : -1.0f;
+        const glm::vec3 faceT = (dp1 * duv2.y - dp2 * duv1.y) * s;
+        const glm::vec3 faceB = (dp2 * duv1.x - dp1 * duv2.x) * s;
+
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const uint32_t vi = idx[corner];
+            const glm::vec3& n = normals[vi];
+
+            // Corner angle weight
+            const glm::vec3 e0 = positions[idx[(corner + 1) % 3]] - positions[vi];
+            const glm::vec3 e1 = positions[idx[(corner + 2) % 3]] - positions[vi];
+            const float len = glm::length(e0) * glm::length(e1);
+            if (len <= 0.0f) continue;
+            const float angle = std::acos(glm::clamp(glm::dot(e0, e1) / len, -1.0f, 1.0f));
+
+            const glm::vec3 t = faceT - n * glm::dot(n, faceT);
+            const glm::vec3 b = faceB - n * glm::dot(n, faceB);
+            const float tLen = glm::length(t);
+            const float bLen = glm::length(b);
+            if (tLen <= 0.0f) continue;
+
+            Corner& c = corners[f + corner];
+            c.t = t / tLen;
+            c.b = bLen > 0.0f ? b / bLen : glm::vec3(0.0f);
+            c.weight = angle;
+            // Handedness as glTF reconstructs it: bitangent = cross(N, T) * w
+            c.sign = glm::dot(glm::cross(n, c.t), c.b) < 0.0f ? -1.0f : 1.0f;
+        }
+    }
+
+    // Corners of each vertex, in face order
+    std::vector<uint32_t> vertexStart(vertexCount + 1, 0);
+    for (size_t k = 0; k < cornerCount; ++k)
+        if (indices[k] < vertexCount) ++vertexStart[indices[k] + 1];
+    for (size_t vi = 0; vi < vertexCount; ++vi)
+        vertexStart[vi + 1] += vertexStart[vi];
+    std::vector<uint32_t> vertexCorners(vertexStart.back());
+    {
+        std::vector<uint32_t> fill(vertexStart.begin(), vertexStart.end() - 1);
+        for (size_t k = 0; k < cornerCount; ++k)
+            if (indices[k] < vertexCount) vertexCorners[fill[indices[k]]++] = uint32_t(k);
+    }
+
+    struct Group
+    {
+        glm::vec3 seed; // Tangent of the first corner, that the others are compared with
+        float sign;
+        glm::vec3 tan{ 0.0f };
+        glm::vec3 bit{ 0.0f };
+    };
+    std::vector<Group> groups;
+    std::vector<int> cornerGroup(cornerCount, -1);
+
+    outTangents.assign(cornerCount, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    for (size_t vi = 0; vi < vertexCount; ++vi)
+    {
+        groups.clear();
+        for (uint32_t i = vertexStart[vi]; i < vertexStart[vi + 1]; ++i)
+        {
+            const uint32_t k = vertexCorners[i];
+            const Corner& c = corners[k];
+            if (c.weight <= 0.0f) continue;
+
+            size_t g = 0;
+            while (g < groups.size() && (groups[g].sign != c.sign || glm::dot(groups[g].seed, c.t) < kSplitCos))
+                ++g;
+            if (g == groups.size())
+                groups.push_back(Group{ c.t, c.sign });
+            groups[g].tan += c.t * c.weight;
+            groups[g].bit += c.b * c.weight;
+            cornerGroup[k] = int(g);
+        }
+
+        const glm::vec3 n = normals[vi];
+        for (uint32_t i = vertexStart[vi]; i < vertexStart[vi + 1]; ++i)
+        {
+            const uint32_t k = vertexCorners[i];
+
+            // Corners of faces without a UV gradient take the vertex's first group, if it has one
+            glm::vec3 t(0.0f);
+            float w = 1.0f;
+            const int g = cornerGroup[k] >= 0 ? cornerGroup[k] : (groups.empty() ? -1 : 0);
+            if (g >= 0)
+            {
+                t = groups[g].tan - n * glm::dot(n, groups[g].tan);
+                w = groups[g].sign;
+            }
+
+            if (glm::dot(t, t) < 1e-20f)
+            {
+                // No usable UV gradient: any tangent orthogonal to the normal will do
+                const glm::vec3 up = (std::abs(n.z) < 0.999f) ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+                t = glm::cross(up, n);
+                if (glm::dot(t, t) < 1e-20f) t = glm::vec3(1, 0, 0);
+            }
+            outTangents[k] = glm::vec4(glm::normalize(t), w);
+        }
+    }
+}
+
 inline void ModelLoader::calculate_dimensions()
 {
     bool first = true;
@@ -0,0 +1,389 @@
+#include "PathGuiding.h"
+#include "MathUtil.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr int kMaxDTreeDepth = 20;
+static constexpr int kMaxSpatialDepth = 48;
+
+// Area-preserving map between directions and the unit square: x = (cos theta + 1) / 2, y = phi / 2pi
+static inline glm::vec2 DirectionToSquare(const glm::vec3& _dir)
+{
+    const float cosTheta = glm::clamp(_dir.z, -1.0f, 1.0f);
+    float phi = std::atan2(_dir.y, _dir.x);
+    if (phi < 0.0f)
+        phi += 2.0f * kPi;
+    return glm::clamp(glm::vec2((cosTheta + 1.0f) * 0.5f, phi / (2.0f * kPi)), glm::vec2(0.0f), glm::vec2(0x1.fffffep-1f));
+}
+
+static inline glm::vec3 SquareToDirection(const glm::vec2& _p)
+{
+    const float cosTheta = 2.0f * _p.x - 1.0f;
+    const float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = 2.0f * kPi * _p.y;
+    return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+DTree::DTree()
+    : mNodes(1)
+    , mRecorded(4)
+{
+}
+
+DTree::DTree(const DTree& _other)
+    : mNodes(_other.mNodes)
+    , mRecorded(_other.mNodes.size() * 4)
+{
+}
+
+DTree& DTree::operator=(const DTree& _other)
+{
+    if (this != &_other)
+    {
+        mNodes = _other.mNodes;
+        mRecorded = std::vector<std::atomic<float>>(mNodes.size() * 4);
+    }
+    return *this;
+}
+
+glm::vec3 DTree::Sample(glm::vec2 _u, float& _pdf) const
+{
+    glm::vec2 origin(0.0f);
+    float size = 1.0f;
+    float density = 1.0f; // Over the unit square
+
+    uint32_t node = 0;
+    for (;;)
+    {
+        const float* s = mNodes[node].sum;
+        const float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0.0f))
+            break; // Nothing recorded below here: uniform over the rest of the cell
+
+        // Column (cos theta half) first, then the quadrant within it, reusing each number after rescaling
+        const float pLeft = (s[0] + s[2]) / total;
+        const int xBit = (_u.x < pLeft) ? 0 : 1;
+        _u.x = xBit ? (_u.x - pLeft) / (1.0f - pLeft) : _u.x / pLeft;
+
+        const float pBottom = s[xBit] / (s[xBit] + s[xBit + 2]);
+        const int yBit = (_u.y < pBottom) ? 0 : 1;
+        _u.y = yBit ? (_u.y - pBottom) / (1.0f - pBottom) : _u.y / pBottom;
+        _u = glm::clamp(_u, glm::vec2(0.0f), glm::vec2(0x1.fffffep-1f));
+
+        const int c = xBit | (yBit << 1);
+        density *= 4.0f * s[c] / total;
+        size *= 0.5f;
+        origin += glm::vec2(float(xBit), float(yBit)) * size;
+
+        if (!mNodes[node].child[c])
+            break;
+        node = mNodes[node].child[c];
+    }
+
+    // The square covers the 4pi steradians of the sphere with equal area
+    _pdf = density / (4.0f * kPi);
+    return SquareToDirection(origin + _u * size);
+}
+
+float DTree::Pdf(const glm::vec3& _dir) const
+{
+    glm::vec2 p = DirectionToSquare(_dir);
+    float density = 1.0f;
+
+    uint32_t node = 0;
+    for (;;)
+    {
+        const float* s = mNodes[node].sum;
+        const float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0.0f))
+            break;
+
+        const int xBit = (p.x >= 0.5f) ? 1 : 0;
+        const int yBit = (p.y >= 0.5f) ? 1 : 0;
+        const int c = xBit | (yBit << 1);
+        density *= 4.0f * s[c] / total;
+        p = p * 2.0f - glm::vec2(float(xBit), float(yBit));
+
+        if (!mNodes[node].child[c])
+            break;
+        node = mNodes[node].child[c];
+    }
+
+    return density / (4.0f * kPi);
+}
+
+void DTree::Record(const glm::vec3& _dir, float _value)
+{
+    glm::vec2 p = DirectionToSquare(_dir);
+
+    uint32_t node = 0;
+    for (;;)
+    {
+        const int xBit = (p.x >= 0.5f) ? 1 : 0;
+        const int yBit = (p.y >= 0.5f) ? 1 : 0;
+        const int c = xBit | (yBit << 1);
+        mRecorded[node * 4 + c].fetch_add(_value, std::memory_order_relaxed);
+        p = p * 2.0f - glm::vec2(float(xBit), float(yBit));
+
+        if (!mNodes[node].child[c])
+            break;
+        node = mNodes[node].child[c];
+    }
+}
+
+void DTree::Publish()
+{
+    for (size_t i = 0; i < mRecorded.size(); ++i)
+        mNodes[i / 4].sum[i % 4] = mRecorded[i].load(std::memory_order_relaxed);
+}
+
+float DTree::GetRecordedTotal() const
+{
+    return mRecorded[0].load(std::memory_order_relaxed) + mRecorded[1].load(std::memory_order_relaxed)
+        + mRecorded[2].load(std::memory_order_relaxed) + mRecorded[3].load(std::memory_order_relaxed);
+}
+
+DTree DTree::Refine(float _threshold, size_t _maxNodes) const
+{
+    // Breadth first, so when the node budget runs out it is the finest levels that are left out
+    struct Item
+    {
+        uint32_t source; // Node in this tree covering the same cell, 0 if the cell was a leaf here
+        uint32_t target;
+        int depth;
+        float sum; // Flux of the cell, split evenly between children the source does not have
+    };
+
+    DTree out;
+    const float total = Total();
+    std::vector<Item> queue;
+    queue.push_back({ 0, 0, 0, total });
+
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        const Item item = queue[i];
+        const bool hasSource = (i == 0) || item.source != 0;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            const float childSum = hasSource ? mNodes[item.source].sum[c] : item.sum * 0.25f;
+            out.mNodes[item.target].sum[c] = childSum;
+
+            if (!(total > 0.0f) || childSum <= _threshold * total || item.depth + 1 >= kMaxDTreeDepth || out.mNodes.size() >= _maxNodes)
+                continue;
+
+            const uint32_t index = uint32_t(out.mNodes.size());
+            out.mNodes.emplace_back();
+            out.mNodes[item.target].child[c] = index;
+            queue.push_back({ hasSource ? mNodes[item.source].child[c] : 0u, index, item.depth + 1, childSum });
+        }
+    }
+
+    out.mRecorded = std::vector<std::atomic<float>>(out.mNodes.size() * 4);
+    return out;
+}
+
+GuidingField::GuidingField()
+{
+    Reset(glm::vec3(-1.0f), glm::vec3(1.0f));
+}
+
+void GuidingField::Reset(const glm::vec3& _min, const glm::vec3& _max)
+{
+    // An empty scene has min > max; any box will do then
+    const bool valid = glm::all(glm::lessThanEqual(_min, _max));
+    mMin = valid ? _min : glm::vec3(-1.0f);
+    mMax = valid ? _max : glm::vec3(1.0f);
+
+    mNodes.assign(1, Node{});
+    mLeaves.clear();
+    mLeaves.push_back(std::make_unique<Leaf>());
+
+    mIteration = 0;
+    mFramesInIteration = 0;
+}
+
+void GuidingField::Find(const glm::vec3& _p, Lookup& _out) const
+{
+    glm::vec3 lo = mMin, hi = mMax;
+    uint32_t node = 0;
+    while (mNodes[node].axis >= 0)
+    {
+        const int axis = mNodes[node].axis;
+        const float mid = 0.5f * (lo[axis] + hi[axis]);
+        if (_p[axis] < mid)
+        {
+            hi[axis] = mid;
+            node = mNodes[node].index;
+        }
+        else
+        {
+            lo[axis] = mid;
+            node = mNodes[node].index + 1;
+        }
+    }
+
+    _out.leaf = mNodes[node].index;
+    const Leaf& leaf = *mLeaves[_out.leaf];
+    _out.distribution = leaf.sampling.HasDistribution() ? &leaf.sampling : nullptr;
+    _out.bsdfProbability = _out.distribution ? BsdfProbability(leaf) : 1.0f;
+}
+
+float GuidingField::BsdfProbability(const Leaf& _leaf) const
+{
+    // Kept away from 0 and 1 so neither strategy is ever dropped entirely
+    return glm::clamp(1.0f / (1.0f + std::exp(-_leaf.theta)), 0.05f, 0.95f);
+}
+
+void GuidingField::Record(const Lookup& _lookup, const glm::vec3& _dir, float _radiance, float _pdf, float _bsdfPdf, float _guidePdf, float _integrand)
+{
+    Leaf& leaf = *mLeaves[_lookup.leaf];
+    leaf.samples.fetch_add(1, std::memory_order_relaxed);
+
+    if (!(_pdf > 0.0f))
+        return;
+
+    // Radiance over pdf: the recorded sums estimate the radiance integrated over each cell
+    if (_radiance > 0.0f)
+        leaf.building.Record(_dir, _radiance / _pdf);
+
+    if (mLearnSelection && _lookup.distribution)
+    {
+        // One-sample estimate of d KL(integrand || mixture) / d alpha, then through the sigmoid
+        const float alpha = _lookup.bsdfProbability;
+        const float dAlpha = -(_integrand / _pdf) * (_bsdfPdf - _guidePdf) / _pdf;
+        leaf.gradient.fetch_add(dAlpha * alpha * (1.0f - alpha), std::memory_order_relaxed);
+        leaf.gradientCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void GuidingField::EndFrame()
+{
+    if (!IsRecording())
+        return;
+
+    if (mLearnSelection)
+    {
+        const float beta1 = 0.9f, beta2 = 0.999f;
+        for (auto& leaf : mLeaves)
+        {
+            const uint32_t count = leaf->gradientCount.exchange(0, std::memory_order_relaxed);
+            const float sum = leaf->gradient.exchange(0.0f, std::memory_order_relaxed);
+            if (count == 0 || !std::isfinite(sum))
+                continue;
+
+            const float g = sum / float(count);
+            ++leaf->adamStep;
+            leaf->adamM = beta1 * leaf->adamM + (1.0f - beta1) * g;
+            leaf->adamV = beta2 * leaf->adamV + (1.0f - beta2) * g * g;
+            const float m = leaf->adamM / (1.0f - std::pow(beta1, float(leaf->adamStep)));
+            const float v = leaf->adamV / (1.0f - std::pow(beta2, float(leaf->adamStep)));
+            leaf->theta = glm::clamp(leaf->theta - mLearningRate * m / (std::sqrt(v) + 1e-8f), -10.0f, 10.0f);
+        }
+    }
+
+    if (++mFramesInIteration >= (1 << mIteration))
+        EndIteration();
+}
+
+void GuidingField::EndIteration()
+{
+    // What was recorded becomes the distribution to sample; a leaf nothing reached keeps its old one
+    for (auto& leaf : mLeaves)
+    {
+        if (leaf->building.GetRecordedTotal() > 0.0f)
+        {
+            leaf->building.Publish();
+            leaf->sampling = leaf->building;
+        }
+    }
+
+    SplitLeaves();
+
+    // The next iteration records into refined trees, with a node cap that keeps every leaf inside the budget
+    const size_t budget = size_t(mMemoryBudgetMB) << 20;
+    const size_t maxNodes = std::max<size_t>(1, budget / (mLeaves.size() * 2 * DTree::kNodeBytes));
+    for (auto& leaf : mLeaves)
+    {
+        leaf->building = leaf->sampling.Refine(mFluxThreshold, maxNodes);
+        leaf->samples.store(0, std::memory_order_relaxed);
+    }
+
+    ++mIteration;
+    mFramesInIteration = 0;
+}
+
+void GuidingField::SplitLeaves()
+{
+    // Later iterations trace more samples, so the bar rises with sqrt of the sample count (Muller et al.)
+    const float threshold = mSpatialThreshold * std::sqrt(float(1u << std::min(mIteration, 30)));
+    const size_t budget = size_t(mMemoryBudgetMB) << 20;
+    size_t usage = GetMemoryUsage();
+
+    // Nodes appended here are visited too, so a crowded leaf keeps splitting until its halves fit
+    for (size_t n = 0; n < mNodes.size(); ++n)
+    {
+        if (mNodes[n].axis >= 0 || mNodes[n].depth >= kMaxSpatialDepth)
+            continue;
+
+        Leaf& leaf = *mLeaves[mNodes[n].index];
+        const uint32_t samples = leaf.samples.load(std::memory_order_relaxed);
+        const size_t leafBytes = sizeof(Leaf) + 2 * sizeof(Node) + (leaf.sampling.NodeCount() + leaf.building.NodeCount()) * DTree::kNodeBytes;
+        if (float(samples) <= threshold || usage + leafBytes > budget)
+            continue;
+
+        // Both halves start from the parent's distribution, selection state and an even share of its samples
+        auto second = std::make_unique<Leaf>();
+        second->sampling = leaf.sampling;
+        second->building = leaf.building;
+        second->theta = leaf.theta;
+        second->adamM = leaf.adamM;
+        second->adamV = leaf.adamV;
+        second->adamStep = leaf.adamStep;
+        second->samples.store(samples / 2, std::memory_order_relaxed);
+        leaf.samples.store(samples - samples / 2, std::memory_order_relaxed);
+
+        const uint32_t first = uint32_t(mNodes.size());
+        const int depth = mNodes[n].depth + 1;
+        mNodes.push_back(Node{ -1, mNodes[n].index, depth });
+        mNodes.push_back(Node{ -1, uint32_t(mLeaves.size()), depth });
+        mLeaves.push_back(std::move(second));
+
+        mNodes[n].axis = mNodes[n].depth % 3;
+        mNodes[n].index = first;
+        usage += leafBytes;
+    }
+}
+
+size_t GuidingField::GetMemoryUsage() const
+{
+    size_t bytes = mNodes.size() * sizeof(Node);
+    for (const auto& leaf : mLeaves)
+        bytes += sizeof(Leaf) + (leaf->sampling.NodeCount() + leaf->building.NodeCount()) * DTree::kNodeBytes;
+    return bytes;
+}
+
+bool GuidingField::UpdateUI()
+{
+    bool restarted = false;
+    if (ImGui::TreeNode("Path guiding"))
+    {
+        ImGui::Text("Iteration %d of %d, %zu regions, %.1f MB", std::min(mIteration, mTrainingIterations), mTrainingIterations,
+            mLeaves.size(), float(GetMemoryUsage()) / float(1 << 20));
+        ImGui::SliderInt("Training iterations", &mTrainingIterations, 1, 14);
+        ImGui::SliderFloat("Spatial threshold", &mSpatialThreshold, 100.0f, 100000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Flux threshold", &mFluxThreshold, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderInt("Memory budget (MB)", &mMemoryBudgetMB, 16, 4096);
+        ImGui::Checkbox("Learn BSDF selection", &mLearnSelection);
+        if (ImGui::Button("Restart training"))
+        {
+            Reset(mMin, mMax);
+            restarted = true;
+        }
+        ImGui::TreePop();
+    }
+    return restarted;
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Directional quadtree over the sphere of directions (the "D-tree" of Muller et al., "Practical Path Guiding", 2017).
+// Directions map to the unit square by (cos theta, phi), which preserves area, so each node's share of the
+// recorded flux over its share of the area is its density. Sampling reads the published sums; recording
+// goes to a separate atomic copy, so threads can record while others sample.
+class DTree
+{
+public:
+	DTree();
+	// Copies the topology and distribution; the recorded sums start at zero
+	DTree(const DTree& _other);
+	DTree& operator=(const DTree& _other);
+
+	// Direction drawn in proportion to the published flux; _pdf is per unit solid angle
+	glm::vec3 Sample(glm::vec2 _u, float& _pdf) const;
+	float Pdf(const glm::vec3& _dir) const;
+	bool HasDistribution() const { return Total() > 0.0f; }
+
+	// Thread safe: adds _value to every node on the way down to _dir's leaf
+	void Record(const glm::vec3& _dir, float _value);
+	// Makes the recorded sums the distribution used by Sample / Pdf
+	void Publish();
+	float GetRecordedTotal() const;
+
+	// Same distribution with leaves split where they hold more than _threshold of the total flux,
+	// keeping at most _maxNodes nodes; recording starts from zero
+	DTree Refine(float _threshold, size_t _maxNodes) const;
+
+	size_t NodeCount() const { return mNodes.size(); }
+	static constexpr size_t kNodeBytes = 16 + 16 + 16; // Sums, children and recorded sums
+
+private:
+	// Children are indices into mNodes, 0 for none (the root is never a child)
+	struct Node
+	{
+		float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		uint32_t child[4] = { 0, 0, 0, 0 };
+	};
+
+	float Total() const { return mNodes[0].sum[0] + mNodes[0].sum[1] + mNodes[0].sum[2] + mNodes[0].sum[3]; }
+
+	std::vector<Node> mNodes;
+	std::vector<std::atomic<float>> mRecorded; // 4 per node, same order as Node::sum
+};
+
+// Spatial binary tree of D-trees, trained online from the paths TraceRay already traces.
+// Training runs in iterations of 1, 2, 4, ... frames: at the end of each, what was recorded becomes the
+// sampling distribution, crowded spatial leaves are split and the D-trees are refined towards the flux.
+// Each leaf also learns how often to pick BSDF sampling over the guide, by Adam steps on the KL divergence
+// between the mixture and the recorded integrand (Muller, "Practical Path Guiding in Production", 2019).
+class GuidingField
+{
+public:
+	// What TraceRay needs at one vertex
+	struct Lookup
+	{
+		uint32_t leaf = 0;
+		const DTree* distribution = nullptr; // Null until the leaf has a trained distribution
+		float bsdfProbability = 1.0f;
+	};
+
+	GuidingField();
+
+	// Drops everything learnt and starts training again over the box _min, _max
+	void Reset(const glm::vec3& _min, const glm::vec3& _max);
+
+	void Find(const glm::vec3& _p, Lookup& _out) const;
+
+	// False once the training iterations are done; the distributions are then fixed
+	bool IsRecording() const { return mIteration < mTrainingIterations; }
+	// Thread safe. _radiance is the luminance arriving at the vertex from _dir, which was sampled with _pdf;
+	// _bsdfPdf, _guidePdf and _integrand (radiance times BSDF times cosine) feed the selection probability
+	void Record(const Lookup& _lookup, const glm::vec3& _dir, float _radiance, float _pdf, float _bsdfPdf, float _guidePdf, float _integrand);
+
+	// Call between frames from one thread: steps the selection probabilities and ends the iteration when due
+	void EndFrame();
+
+	int GetIteration() const { return mIteration; }
+	size_t GetLeafCount() const { return mLeaves.size(); }
+	size_t GetMemoryUsage() const;
+
+	// True if the training was restarted
+	bool UpdateUI();
+
+private:
+	struct Leaf
+	{
+		DTree sampling;
+		DTree building;
+		std::atomic<uint32_t> samples{ 0 };
+
+		// Selection probability is sigmoid(theta), trained from the averaged gradient once per frame
+		std::atomic<float> gradient{ 0.0f };
+		std::atomic<uint32_t> gradientCount{ 0 };
+		float theta = 0.0f;
+		float adamM = 0.0f;
+		float adamV = 0.0f;
+		int adamStep = 0;
+	};
+
+	// Inner nodes split their box in half along axis; children are index and index + 1
+	struct Node
+	{
+		int axis = -1; // -1 for a leaf, then index is into mLeaves
+		uint32_t index = 0;
+		int depth = 0;
+	};
+
+	void EndIteration();
+	void SplitLeaves();
+	float BsdfProbability(const Leaf& _leaf) const;
+
+	glm::vec3 mMin{ -1.0f };
+	glm::vec3 mMax{ 1.0f };
+	std::vector<Node> mNodes;
+	std::vector<std::unique_ptr<Leaf>> mLeaves;
+
+	int mIteration = 0;
+	int mFramesInIteration = 0;
+
+	int mTrainingIterations = 9;
+	float mSpatialThreshold = 4000.0f; // Samples (scaled by sqrt(2^iteration)) before a spatial leaf splits
+	float mFluxThreshold = 0.01f; // Share of a D-tree's flux above which a node splits
+	int mMemoryBudgetMB = 256;
+	bool mLearnSelection = true;
+	float mLearningRate = 0.01f;
+};
\ No newline at end of file
@@ -1,27 +1,29 @@
 #include "PathTracer.h"
+#include "MathUtil.h"
 
-#include <random>
-#include <thread>
-#include <iostream>
+#include <algorithm>
+#include <limits>
 
-// Thread-local RNG (avoid rand() in threads)
-static thread_local std::mt19937 g_rng{
-    static_cast<unsigned int>(
-        std::hash<std::thread::id>{}(std::this_thread::get_id()) ^ 0x9E3779B97F4A7C15ull
-    )
+static constexpr float kTMin = 1e-4f; // Avoid self-intersection
+static constexpr float kTMax = 1e30f;
+
+// This thread's counts since its last PublishStats, so tracing a path touches no shared cache line
+struct LocalStats
+{
+    uint64_t paths = 0;
+    uint64_t bounces = 0;
+    uint64_t materialSwitches = 0;
+    uint64_t hitJumps = 0;
 };
-static inline float Rand01() {
-    static thread_local std::uniform_real_distribution<float> U(0.0f, 1.0f);
-    return U(g_rng);
-}
+static thread_local LocalStats tLocalStats;
 
 // Cosine-weighted hemisphere sample in LOCAL space (z = up)
-static inline glm::vec3 SampleCosineHemisphereLocal()
+static inline glm::vec3 SampleCosineHemisphereLocal(const glm::vec2& _u)
 {
-    float u1 = Rand01();            // in [0,1)
-    float u2 = Rand01();
+    float u1 = _u.x;            // in [0,1)
+    float u2 = _u.y;
     float r = std::sqrt(u1);
-    float phi = 2.0f * 3.1415926535f * u2;
+    float phi = 2.0f * kPi * u2;
 
     float x = r * std::cos(phi);
     float y = r * std::sin(phi);
@@ -30,53 +32,793 @@ static inline glm::vec3 SampleCosineHemisphereLocal()
     return glm::vec3(x, y, z);
 }
 
-glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
+// GGX normal distribution
+static inline float GgxD(float _cosNh, float _alpha)
 {
-    if (_depth <= 0)
-        return glm::vec3(0.0f);
+    float a2 = _alpha * _alpha;
+    float d = _cosNh * _cosNh * (a2 - 1.0f) + 1.0f;
+    return a2 / (kPi * d * d);
+}
+
+// Smith GGX masking term for one direction (G = G1(wo) * G1(wi))
+static inline float SmithG1(float _cosNw, float _alpha)
+{
+    float cosNw = glm::clamp(_cosNw, 0.0f, 1.0f);
+    float sinNw = std::sqrt(std::max(0.0f, 1.0f - cosNw * cosNw));
+    float tanNw = (cosNw > 0.0f) ? (sinNw / cosNw) : 0.0f;
+    float root = std::sqrt(1.0f + (_alpha * _alpha) * (tanNw * tanNw));
+    return 2.0f / (1.0f + root);
+}
+
+// MIS weight for a sample drawn with density _pdfA when _pdfB could also have produced it
+static inline float PowerHeuristic(float _pdfA, float _pdfB)
+{
+    float a2 = _pdfA * _pdfA;
+    float b2 = _pdfB * _pdfB;
+    return (a2 + b2 > 0.0f) ? a2 / (a2 + b2) : 0.0f;
+}
+
+void PathTracer::CompileScene()
+{
+    if (!mSceneDirty)
+        return;
+
+    mScene.Compile(rayObjects, mEnvironment.get());
+    mSceneDirty = false;
+
+    // What the field learnt belongs to the old scene, and so do the photons and cached light
+    mGuiding.Reset(mScene.GetBoundsMin(), mScene.GetBoundsMax());
+    mPhotons.Clear();
+    mRadianceCache.Reset(mScene.GetBoundsMin(), mScene.GetBoundsMax());
+}
+
+// Guiding only replaces the opaque, rough lobes; glass and mirrors keep their delta sampling
+static inline bool IsGuidable(const Material& _m)
+{
+    return _m.transmission <= 0.0f && _m.roughness > 1e-4f;
+}
+
+// Opaque surfaces with a lobe that can be evaluated for any direction; delta-only materials (glass, perfect mirrors)
+// can only be passed through, never connected to or gathered at
+static inline bool IsConnectible(const Material& _m)
+{
+    const float pT = glm::clamp(_m.transmission, 0.0f, 1.0f);
+    const float roughness = glm::clamp(_m.roughness, 0.0f, 1.0f);
+    return pT < 1.0f && !(roughness <= 1e-4f && _m.metallic >= 1.0f);
+}
+
+// Mostly diffuse surfaces, whose outgoing light hardly depends on the direction it is seen from
+static inline bool IsCacheable(const Material& _m)
+{
+    return _m.transmission <= 0.0f && _m.metallic < 0.5f && _m.roughness >= 0.3f;
+}
+
+// A cacheable vertex of the current path, held until the path ends and the light it sends back is known
+struct CachedVertex
+{
+    glm::vec3 p;
+    glm::vec3 n;
+    glm::vec3 albedo;
+    glm::vec3 throughput; // Up to, not including, this vertex
+    glm::vec3 L; // Path radiance once this vertex's own emission was added
+};
+
+static constexpr int kMaxCachedVertices = 32;
+
+// A guided vertex of the current path, held until the path ends and its incident radiance is known
+struct GuidedVertex
+{
+    GuidingField::Lookup lookup;
+    glm::vec3 direction;
+    glm::vec3 throughput; // Including this vertex's bounce weight
+    glm::vec3 L; // Path radiance once this vertex's own emission and light sample were added
+    glm::vec3 bsdfCos;
+    float pdf;
+    float bsdfPdf;
+    float guidePdf;
+};
+
+static constexpr int kMaxGuidedVertices = 32;
+
+void PathTracer::PublishStats()
+{
+    LocalStats& local = tLocalStats;
+    if (local.paths == 0 && local.materialSwitches == 0 && local.hitJumps == 0)
+        return;
+
+    mStats.paths.fetch_add(local.paths, std::memory_order_relaxed);
+    mStats.bounces.fetch_add(local.bounces, std::memory_order_relaxed);
+    mStats.materialSwitches.fetch_add(local.materialSwitches, std::memory_order_relaxed);
+    mStats.hitJumps.fetch_add(local.hitJumps, std::memory_order_relaxed);
+    local = LocalStats{};
+}
+
+glm::vec3 PathTracer::TraceRay(Ray _ray, Sampler& _sampler, int _depth, bool _albedoOnly, SampleFeatures* _features)
+{
+    glm::vec3 L(0.0f);
+    glm::vec3 throughput(1.0f);
+
+    // Features follow the path through delta lobes, so a mirror shows what it reflects
+    bool recordFeatures = _features != nullptr;
+    float distance = 0.0f;
+
+    GuidedVertex guided[kMaxGuidedVertices];
+    int guidedCount = 0;
+    const bool recordGuiding = mPathGuiding && mGuiding.IsRecording();
+
+    CachedVertex cached[kMaxCachedVertices];
+    int cachedCount = 0;
+    const bool useCache = mRadianceCaching && !_albedoOnly;
+
+    // Previous vertex, for weighting emission found by BSDF sampling
+    glm::vec3 prevP(0.0f);
+    glm::vec3 prevN(0.0f);
+    float prevPdf = 0.0f;
+    bool prevDelta = true;
+
+    // Caustics are gathered once, at the first vertex they can be. From there, bounces through glass or mirrors
+    // alone are counted so that the emission they reach, which the photons already carry, is not added again
+    bool gatherCaustics = mCausticPhotons && !_albedoOnly;
+    int causticBounces = -1; // -1 once off such a chain
+
+    int bounce = 0;
+    for (; bounce < _depth; ++bounce)
+    {
+        _sampler.StartBounce(bounce);
+
+        Hit best{};
+        if (!mScene.Intersect(_ray, kTMin, kTMax, best))
+        {
+            if (recordFeatures)
+                *_features = SampleFeatures{ glm::vec3(1.0f), -_ray.direction, SampleFeatures::kMissDepth };
+
+            const EnvironmentMap* environment = mScene.GetLights().GetEnvironment();
+            if (!environment)
+            {
+                L += throughput * mBackgroundColour;
+                break;
+            }
+
+            // The environment is a light too, so weight it like emission found at a hit
+            float misWeight = 1.0f;
+            if (bounce > 0 && !prevDelta && mNextEventEstimation)
+                misWeight = PowerHeuristic(prevPdf, mScene.GetLights().EnvironmentPdf(_ray.direction));
+            L += throughput * environment->Evaluate(_ray.direction) * misWeight;
+            break;
+        }
+
+        // Shade only the final closest hit
+        SurfaceInteraction si;
+        mScene.ComputeSurfaceInteraction(_ray, best, si);
+
+        distance += best.t;
+        if (recordFeatures)
+            *_features = SampleFeatures{ si.mat.albedo, glm::normalize(si.n), distance, mScene.GetObjectIndex(best) + 1 };
+
+        if (_albedoOnly)
+        {
+            // If we're not tracing rays, just return the albedo at the hit
+            // Make colours darker if they are further away to allow perspective for same colours
+            // Colours stop getting darker at a distance of 20 units
+            glm::vec3 albedo = si.mat.albedo;
+            float dist = glm::clamp(best.t / 20.f, 0.0f, 0.8f);
+
+            L = albedo * (1.0f - dist);
+            break;
+        }
+
+        // Emission at the hit. If the previous vertex also sampled lights directly,
+        // this is the BSDF half of the MIS pair and is weighted against that strategy
+        const glm::vec3 Le = si.mat.emissionColour * si.mat.emissionStrength;
+        if (Le != glm::vec3(0.0f) && !(causticBounces > 0 && mScene.GetLightIndex(best) >= 0))
+        {
+            float misWeight = 1.0f;
+            if (bounce > 0 && !prevDelta && mNextEventEstimation)
+            {
+                const int light = mScene.GetLightIndex(best);
+                if (light >= 0)
+                    misWeight = PowerHeuristic(prevPdf, mScene.GetLights().Pdf(uint32_t(light), prevP, prevN, si.p));
+            }
+            L += throughput * Le * misWeight;
+        }
+
+        if (useCache && IsCacheable(si.mat))
+        {
+            // Far enough along, the cache stands in for everything the path would gather from here on
+            const glm::vec3 n = glm::normalize(si.n);
+            glm::vec3 cachedLight;
+            if (bounce >= mRadianceCache.GetLookupBounce() && mRadianceCache.Lookup(si.p, n, cachedLight))
+            {
+                L += throughput * SafeAlbedo(si.mat.albedo) * cachedLight;
+                break;
+            }
+            if (cachedCount < kMaxCachedVertices)
+                cached[cachedCount++] = CachedVertex{ si.p, n, si.mat.albedo, throughput, L };
+        }
+
+        const bool gatherHere = gatherCaustics && IsConnectible(si.mat);
+        if (gatherHere)
+        {
+            L += throughput * GatherPhotons(_ray, si);
+            gatherCaustics = false;
+        }
+
+        GuidingField::Lookup guide;
+        const bool useGuiding = mPathGuiding && IsGuidable(si.mat);
+        if (useGuiding)
+            mGuiding.Find(si.p, guide);
+
+        // Next-event estimation; a light found at the last vertex would be past the depth limit
+        if (mNextEventEstimation && bounce + 1 < _depth)
+            L += throughput * SampleDirectLight(_ray, si, _sampler, useGuiding ? &guide : nullptr);
+
+        glm::vec3 weight;
+        Ray next;
+        float bsdfPdf = 0.0f, guidePdf = 0.0f;
+        if (useGuiding)
+        {
+            if (!SampleGuidedBounce(_ray, si, _sampler, guide, weight, next, prevPdf, bsdfPdf, guidePdf))
+                break;
+            prevDelta = false;
+        }
+        else if (!SampleBounce(_ray, si, _sampler, weight, next, prevPdf, prevDelta))
+        {
+            break;
+        }
+
+        if (gatherHere)
+            causticBounces = prevDelta ? -1 : 0;
+        else if (causticBounces >= 0)
+            causticBounces = prevDelta ? causticBounces + 1 : -1;
+
+        recordFeatures = recordFeatures && prevDelta;
+        prevP = si.p;
+        prevN = glm::normalize(si.n);
+        throughput *= weight;
+        _ray = next;
+
+        if (useGuiding && recordGuiding && guidedCount < kMaxGuidedVertices)
+            guided[guidedCount++] = GuidedVertex{ guide, next.direction, throughput, L, weight * prevPdf, prevPdf, bsdfPdf, guidePdf };
+
+        // Russian roulette: once past the minimum depth, continue with probability tied to throughput
+        // and divide the survivors by it, so the estimate stays unbiased while dim paths stop early
+        if (bounce + 1 >= mRouletteMinDepth)
+        {
+            const float pContinue = glm::clamp(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.05f, 0.95f);
+            if (_sampler.Get1D() >= pContinue)
+                break;
+            throughput /= pContinue;
+        }
+    }
+
+    // Radiance arriving at a guided vertex is what the path gathered after it, over the throughput up to it
+    for (int i = 0; i < guidedCount; ++i)
+    {
+        const GuidedVertex& v = guided[i];
+        const glm::vec3 gathered = L - v.L;
+        const glm::vec3 Li(v.throughput.x > 0.0f ? gathered.x / v.throughput.x : 0.0f,
+                           v.throughput.y > 0.0f ? gathered.y / v.throughput.y : 0.0f,
+                           v.throughput.z > 0.0f ? gathered.z / v.throughput.z : 0.0f);
+        mGuiding.Record(v.lookup, v.direction, Luminance(Li), v.pdf, v.bsdfPdf, v.guidePdf, Luminance(Li * v.bsdfCos));
+    }
+
+    // Likewise the light a cached vertex sends back is what the path gathered after it, over the throughput up to it
+    for (int i = 0; i < cachedCount; ++i)
+    {
+        const CachedVertex& v = cached[i];
+        const glm::vec3 gathered = L - v.L;
+        const glm::vec3 Lo(v.throughput.x > 0.0f ? gathered.x / v.throughput.x : 0.0f,
+                           v.throughput.y > 0.0f ? gathered.y / v.throughput.y : 0.0f,
+                           v.throughput.z > 0.0f ? gathered.z / v.throughput.z : 0.0f);
+        mRadianceCache.Record(v.p, v.n, Lo / SafeAlbedo(v.albedo));
+    }
+
+    ++tLocalStats.paths;
+    tLocalStats.bounces += uint64_t(std::min(bounce + 1, _depth));
+
+    return L;
+}
+
+struct PathTracer::PathQueue
+{
+    // Per path, indexed by the ray's position in the batch
+    std::vector<glm::vec3> origin;
+    std::vector<glm::vec3> direction;
+    std::vector<float> ior;
+    std::vector<glm::vec3> throughput;
+    std::vector<glm::vec3> L;
+    std::vector<glm::vec3> prevP;
+    std::vector<glm::vec3> prevN;
+    std::vector<float> prevPdf;
+    std::vector<uint8_t> prevDelta;
+    std::vector<Hit> hit;
+    std::vector<uint8_t> found;
+    std::vector<Sampler> sampler;
+
+    // First-hit features, while recordFeatures is set, and the distance travelled so far
+    std::vector<SampleFeatures> features;
+    std::vector<uint8_t> recordFeatures;
+    std::vector<float> distance;
+
+    // Paths still bouncing, and the ones that survive the current shade pass
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> next;
+
+    // Active paths grouped by material key (misses first) so shading stays on one material's data
+    std::vector<uint32_t> bucketStart;
+    std::vector<uint32_t> sorted;
+
+    // (octant, Morton code) << 32 | path, for reordering rays before traversal
+    std::vector<uint64_t> rayKeys;
+
+    // Shadow rays queued by the shade pass; contribution is already scaled by path throughput
+    std::vector<glm::vec3> shadowOrigin;
+    std::vector<glm::vec3> shadowDirection;
+    std::vector<float> shadowTMax;
+    std::vector<glm::vec3> shadowContribution;
+    std::vector<uint32_t> shadowPath;
+
+    Ray GetRay(uint32_t _path) const
+    {
+        Ray ray;
+        ray.origin = origin[_path];
+        ray.direction = direction[_path];
+        ray.currentIOR = ior[_path];
+        return ray;
+    }
+
+    void SetRay(uint32_t _path, const Ray& _ray)
+    {
+        origin[_path] = _ray.origin;
+        direction[_path] = _ray.direction;
+        ior[_path] = _ray.currentIOR;
+    }
+};
+
+void PathTracer::TraceBatch(const std::vector<Ray>& _rays, const std::vector<Sampler>& _samplers, int _depth, bool _albedoOnly, std::vector<glm::vec3>& _out, std::vector<SampleFeatures>* _features)
+{
+    // Reused between calls so a thread only allocates for its largest batch
+    static thread_local PathQueue queue;
+    PathQueue& q = queue;
+
+    GeneratePaths(q, _rays, _samplers);
+    q.recordFeatures.assign(_rays.size(), _features ? 1 : 0);
+
+    uint64_t segments = 0;
+    for (int bounce = 0; bounce < _depth && !q.active.empty(); ++bounce)
+    {
+        // A path ending at bounce b traced b + 1 segments, the same count TraceRay reports
+        segments += q.active.size();
+
+        // Camera rays are already coherent in scanline order; after the first bounce they scatter
+        if (mSortRays && bounce > 0)
+            SortRays(q);
+        ExtendPaths(q);
+        ShadePaths(q, bounce, _depth, _albedoOnly);
+        TraceShadowRays(q);
+        q.active.swap(q.next);
+    }
+
+    // Accumulate
+    _out.assign(q.L.begin(), q.L.end());
+    if (_features)
+        _features->assign(q.features.begin(), q.features.end());
+
+    tLocalStats.paths += _rays.size();
+    tLocalStats.bounces += segments;
+}
+
+void PathTracer::GeneratePaths(PathQueue& _q, const std::vector<Ray>& _rays, const std::vector<Sampler>& _samplers)
+{
+    const size_t count = _rays.size();
+    _q.origin.resize(count);
+    _q.direction.resize(count);
+    _q.ior.resize(count);
+    _q.throughput.assign(count, glm::vec3(1.0f));
+    _q.L.assign(count, glm::vec3(0.0f));
+    _q.prevP.assign(count, glm::vec3(0.0f));
+    _q.prevN.assign(count, glm::vec3(0.0f));
+    _q.prevPdf.assign(count, 0.0f);
+    _q.prevDelta.assign(count, 1);
+    _q.hit.resize(count);
+    _q.found.resize(count);
+    _q.sampler.assign(_samplers.begin(), _samplers.end());
+    _q.features.assign(count, SampleFeatures{});
+    _q.distance.assign(count, 0.0f);
+
+    _q.active.resize(count);
+    for (uint32_t i = 0; i < uint32_t(count); ++i)
+    {
+        _q.SetRay(i, _rays[i]);
+        _q.active[i] = i;
+    }
+}
 
-    const float kTMin = 1e-4f; // Avoid self-intersection
-    const float kTMax = 1e30f;
+// Spreads the low 10 bits of _v so there are two zero bits between each
+static inline uint32_t ExpandBits(uint32_t _v)
+{
+    _v = (_v * 0x00010001u) & 0xFF0000FFu;
+    _v = (_v * 0x00000101u) & 0x0F00F00Fu;
+    _v = (_v * 0x00000011u) & 0xC30C30C3u;
+    _v = (_v * 0x00000005u) & 0x49249249u;
+    return _v;
+}
+
+void PathTracer::SortRays(PathQueue& _q)
+{
+    if (_q.active.size() < 2)
+        return;
 
-    Hit best{};
-    bool hitSomething = false;
-    float closestT = kTMax;
+    // 9 bits per axis over the bounds of this batch's origins, leaving room for the octant and path index in 64 bits
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
+    for (uint32_t path : _q.active)
+    {
+        lo = glm::min(lo, _q.origin[path]);
+        hi = glm::max(hi, _q.origin[path]);
+    }
+    const glm::vec3 extent = hi - lo;
+    const glm::vec3 scale(extent.x > 0.0f ? 511.0f / extent.x : 0.0f, extent.y > 0.0f ? 511.0f / extent.y : 0.0f, extent.z > 0.0f ? 511.0f / extent.z : 0.0f);
 
-    for (const auto& obj : rayObjects)
+    // Direction octant is the most significant part of the key: rays heading the same way visit the BVH
+    // children in the same order, and within an octant nearby origins start from the same nodes
+    _q.rayKeys.clear();
+    for (uint32_t path : _q.active)
     {
-        Hit h{};
-        if (obj->RayIntersect(_ray, kTMin, closestT, h))
+        const glm::vec3& d = _q.direction[path];
+        const uint32_t octant = (d.x < 0.0f ? 1u : 0u) | (d.y < 0.0f ? 2u : 0u) | (d.z < 0.0f ? 4u : 0u);
+
+        const glm::uvec3 cell = glm::uvec3((_q.origin[path] - lo) * scale);
+        const uint32_t morton = (ExpandBits(cell.x) << 2) | (ExpandBits(cell.y) << 1) | ExpandBits(cell.z);
+
+        _q.rayKeys.push_back((uint64_t(octant << 27 | morton) << 32) | path);
+    }
+    std::sort(_q.rayKeys.begin(), _q.rayKeys.end());
+
+    for (size_t i = 0; i < _q.rayKeys.size(); ++i)
+        _q.active[i] = uint32_t(_q.rayKeys[i]);
+}
+
+void PathTracer::ExtendPaths(PathQueue& _q)
+{
+    uint64_t jumps = 0;
+    uint64_t previous = ~0ull;
+    for (uint32_t path : _q.active)
+    {
+        _q.hit[path] = Hit{};
+        _q.found[path] = mScene.Intersect(_q.GetRay(path), kTMin, kTMax, _q.hit[path]) ? 1 : 0;
+
+        // A ray ending on a different primitive from the last one has touched different leaf and face data
+        const uint64_t target = _q.found[path] ? (uint64_t(uint32_t(_q.hit[path].object)) << 32 | _q.hit[path].primitive) : ~1ull;
+        jumps += (target != previous) ? 1 : 0;
+        previous = target;
+    }
+    tLocalStats.hitJumps += jumps;
+}
+
+void PathTracer::ShadePaths(PathQueue& _q, int _bounce, int _depth, bool _albedoOnly)
+{
+    _q.next.clear();
+    _q.shadowOrigin.clear();
+    _q.shadowDirection.clear();
+    _q.shadowTMax.clear();
+    _q.shadowContribution.clear();
+    _q.shadowPath.clear();
+
+    // Misses share key 0, every material key is shifted up by one
+    auto keyOf = [&](uint32_t _path) { return _q.found[_path] ? size_t(mScene.GetMaterialKey(_q.hit[_path])) + 1 : 0; };
+
+    const std::vector<uint32_t>* order = &_q.active;
+    if (mSortHits)
+    {
+        // Counting sort of the active paths by material key
+        const size_t buckets = mScene.GetMaterialKeyCount() + 1;
+        _q.bucketStart.assign(buckets + 1, 0);
+        for (uint32_t path : _q.active)
+            ++_q.bucketStart[keyOf(path) + 1];
+        for (size_t b = 1; b <= buckets; ++b)
+            _q.bucketStart[b] += _q.bucketStart[b - 1];
+
+        _q.sorted.resize(_q.active.size());
+        for (uint32_t path : _q.active)
+            _q.sorted[_q.bucketStart[keyOf(path)]++] = path;
+        order = &_q.sorted;
+    }
+
+    uint64_t switches = 0;
+    size_t previous = ~size_t(0);
+    for (uint32_t path : *order)
+    {
+        const size_t key = keyOf(path);
+        switches += (key != previous) ? 1 : 0;
+        previous = key;
+
+        ShadePath(_q, path, _bounce, _depth, _albedoOnly);
+    }
+    tLocalStats.materialSwitches += switches;
+}
+
+void PathTracer::ShadePath(PathQueue& _q, uint32_t _path, int _bounce, int _depth, bool _albedoOnly)
+{
+    // Same per-vertex work as one iteration of TraceRay; the path is pushed to _q.next if it carries on
+    const Ray ray = _q.GetRay(_path);
+    glm::vec3& L = _q.L[_path];
+    glm::vec3& throughput = _q.throughput[_path];
+    Sampler& sampler = _q.sampler[_path];
+    sampler.StartBounce(_bounce);
+
+    if (!_q.found[_path])
+    {
+        if (_q.recordFeatures[_path])
+            _q.features[_path] = SampleFeatures{ glm::vec3(1.0f), -ray.direction, SampleFeatures::kMissDepth };
+
+        const EnvironmentMap* environment = mScene.GetLights().GetEnvironment();
+        if (!environment)
         {
-            if (h.t >= closestT)
-				continue;
-            // If the object filled h.t < closestT, its the new best hit
-            hitSomething = true;
-            closestT = h.t;
-            best = h;
+            L += throughput * mBackgroundColour;
+            return;
         }
+
+        float misWeight = 1.0f;
+        if (_bounce > 0 && !_q.prevDelta[_path] && mNextEventEstimation)
+            misWeight = PowerHeuristic(_q.prevPdf[_path], mScene.GetLights().EnvironmentPdf(ray.direction));
+        L += throughput * environment->Evaluate(ray.direction) * misWeight;
+        return;
     }
 
-    if (!hitSomething)
-        return mBackgroundColour;
+    const Hit& hit = _q.hit[_path];
+    SurfaceInteraction si;
+    mScene.ComputeSurfaceInteraction(ray, hit, si);
+
+    _q.distance[_path] += hit.t;
+    if (_q.recordFeatures[_path])
+        _q.features[_path] = SampleFeatures{ si.mat.albedo, glm::normalize(si.n), _q.distance[_path], mScene.GetObjectIndex(hit) + 1 };
 
     if (_albedoOnly)
     {
-        // If were not tracing rays, just return the albedo at the hit
-        // Make colours darker if they are further away to allow perspective for same colours
-		// Colours stop getting darker at a distance of 20 units
-		glm::vec3 albedo = best.mat->albedo;
-		float dist = glm::clamp(closestT / 20.f, 0.0f, 0.8f);
+        float dist = glm::clamp(hit.t / 20.f, 0.0f, 0.8f);
+        L = si.mat.albedo * (1.0f - dist);
+        return;
+    }
+
+    const glm::vec3 Le = si.mat.emissionColour * si.mat.emissionStrength;
+    if (Le != glm::vec3(0.0f))
+    {
+        float misWeight = 1.0f;
+        if (_bounce > 0 && !_q.prevDelta[_path] && mNextEventEstimation)
+        {
+            const int light = mScene.GetLightIndex(hit);
+            if (light >= 0)
+                misWeight = PowerHeuristic(_q.prevPdf[_path], mScene.GetLights().Pdf(uint32_t(light), _q.prevP[_path], _q.prevN[_path], si.p));
+        }
+        L += throughput * Le * misWeight;
+    }
+
+    // Queue the shadow ray rather than tracing it here, so all occlusion tests run in their own pass
+    if (mNextEventEstimation && _bounce + 1 < _depth)
+    {
+        Ray shadow;
+        float shadowTMax;
+        glm::vec3 contribution;
+        if (PrepareDirectLight(ray, si, sampler, shadow, shadowTMax, contribution))
+        {
+            _q.shadowOrigin.push_back(shadow.origin);
+            _q.shadowDirection.push_back(shadow.direction);
+            _q.shadowTMax.push_back(shadowTMax);
+            _q.shadowContribution.push_back(throughput * contribution);
+            _q.shadowPath.push_back(_path);
+        }
+    }
+
+    glm::vec3 weight;
+    Ray next;
+    float pdf;
+    bool delta;
+    if (!SampleBounce(ray, si, sampler, weight, next, pdf, delta))
+        return;
+
+    _q.recordFeatures[_path] &= delta ? 1 : 0;
+    _q.prevP[_path] = si.p;
+    _q.prevN[_path] = glm::normalize(si.n);
+    _q.prevPdf[_path] = pdf;
+    _q.prevDelta[_path] = delta ? 1 : 0;
+    throughput *= weight;
+    _q.SetRay(_path, next);
+
+    if (_bounce + 1 >= mRouletteMinDepth)
+    {
+        const float pContinue = glm::clamp(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.05f, 0.95f);
+        if (sampler.Get1D() >= pContinue)
+            return;
+        throughput /= pContinue;
+    }
+
+    _q.next.push_back(_path);
+}
+
+void PathTracer::TraceShadowRays(PathQueue& _q)
+{
+    Ray shadow;
+    for (size_t i = 0; i < _q.shadowPath.size(); ++i)
+    {
+        shadow.origin = _q.shadowOrigin[i];
+        shadow.direction = _q.shadowDirection[i];
+        if (!mScene.Occluded(shadow, kTMin, _q.shadowTMax[i]))
+            _q.L[_q.shadowPath[i]] += _q.shadowContribution[i];
+    }
+}
+
+glm::vec3 PathTracer::SampleDirectLight(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, const GuidingField::Lookup* _guide)
+{
+    Ray shadow;
+    float shadowTMax;
+    glm::vec3 contribution;
+    if (!PrepareDirectLight(_ray, _si, _sampler, shadow, shadowTMax, contribution, _guide) || mScene.Occluded(shadow, kTMin, shadowTMax))
+        return glm::vec3(0.0f);
+    return contribution;
+}
+
+bool PathTracer::PrepareDirectLight(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, Ray& _shadow, float& _shadowTMax, glm::vec3& _contribution, const GuidingField::Lookup* _guide)
+{
+    // Drawn before any early out, so the dimensions used by the rest of the bounce depend neither on the
+    // material nor on whether the scene has lights
+    const float uLight = _sampler.Get1D();
+    const glm::vec2 uPoint = _sampler.Get2D();
+
+    const LightSampler& lights = mScene.GetLights();
+    if (lights.Empty())
+        return false;
+
+    // Only the opaque lobes are light sampled; fully transmissive surfaces never pick them
+    const Material& m = _si.mat;
+    const float pT = glm::clamp(m.transmission, 0.0f, 1.0f);
+    if (pT >= 1.0f)
+        return false;
+
+    const float roughness = glm::clamp(m.roughness, 0.0f, 1.0f);
+    const bool specularDelta = roughness <= 1e-4f;
+    if (specularDelta && m.metallic >= 1.0f)
+        return false; // Perfect mirror, nothing to evaluate
+
+    const glm::vec3 n = glm::normalize(_si.n);
+    LightSample ls;
+    if (!lights.Sample(_si.p, n, uLight, uPoint, ls) || (!ls.environment && !mScene.IsOpaque(ls.hit)))
+        return false;
+
+    const float cosNi = glm::dot(n, ls.wi);
+    if (cosNi <= 0.0f)
+        return false;
+
+    glm::vec3 fDiffuse, fSpecular;
+    float pdfDiffuse, pdfSpecular;
+    EvaluateBsdf(_ray, _si, ls.wi, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+
+    glm::vec3 Le;
+    if (ls.environment)
+    {
+        Le = lights.GetEnvironment()->Evaluate(ls.wi);
+    }
+    else
+    {
+        SurfaceInteraction lightSi;
+        mScene.ComputeSurfaceInteraction(Ray(_si.p, ls.wi), ls.hit, lightSi);
+        Le = lightSi.mat.emissionColour * lightSi.mat.emissionStrength;
+    }
+
+    // Each lobe is its own BSDF strategy in SampleBounce, so each gets its own weight against light sampling.
+    // A guided vertex samples the whole BSDF and the guide as one mixture, so light sampling competes with that
+    glm::vec3 f;
+    if (_guide)
+    {
+        const float guidePdf = _guide->distribution ? _guide->distribution->Pdf(ls.wi) : 0.0f;
+        const float mixturePdf = _guide->bsdfProbability * (pdfDiffuse + pdfSpecular) + (1.0f - _guide->bsdfProbability) * guidePdf;
+        f = (fDiffuse + fSpecular) * PowerHeuristic(ls.pdf, mixturePdf);
+    }
+    else
+    {
+        f = fDiffuse * PowerHeuristic(ls.pdf, pdfDiffuse) + fSpecular * PowerHeuristic(ls.pdf, pdfSpecular);
+    }
+    _contribution = Le * f * (cosNi / ls.pdf);
+
+    // Shadow ray, stopping just short of the light so the light itself does not count
+    _shadow = Ray(_si.p + n * kTMin, ls.wi);
+    _shadowTMax = ls.environment ? kTMax : ls.dist * 0.999f;
+    return _contribution != glm::vec3(0.0f);
+}
+
+void PathTracer::EvaluateBsdf(const Ray& _ray, const SurfaceInteraction& _si, const glm::vec3& _wi, glm::vec3& _fDiffuse, float& _pdfDiffuse, glm::vec3& _fSpecular, float& _pdfSpecular) const
+{
+    const Material& m = _si.mat;
+    const float pT = glm::clamp(m.transmission, 0.0f, 1.0f);
+    const float roughness = glm::clamp(m.roughness, 0.0f, 1.0f);
+    const bool specularDelta = roughness <= 1e-4f;
+
+    const glm::vec3 n = glm::normalize(_si.n);
+    const glm::vec3 wo = glm::normalize(-_ray.direction);
+    const float cosNi = std::max(0.0f, glm::dot(n, _wi));
+    const float cosNo = std::max(0.0f, glm::dot(n, wo));
+
+    // Same lobes and selection probabilities as SampleBounce, evaluated for a given direction
+    const glm::vec3 F0 = glm::mix(glm::vec3(0.04f), m.albedo, glm::vec3(m.metallic));
+    const float alpha = std::max(1e-4f, roughness * roughness);
+    const glm::vec3 Fv = F0 + (glm::vec3(1.0f) - F0) * std::pow(1.0f - cosNo, 5.0f);
+    const float specProb = glm::clamp((Fv.x + Fv.y + Fv.z) * (1.0f / 3.0f), 0.05f, 0.95f);
+    const float opaqueProb = std::max(1e-3f, 1.0f - pT);
+
+    _fDiffuse = (1.0f - m.metallic) * m.albedo / kPi;
+    _pdfDiffuse = opaqueProb * (1.0f - specProb) * cosNi / kPi;
+
+    _fSpecular = glm::vec3(0.0f);
+    _pdfSpecular = 0.0f;
+    if (!specularDelta && cosNo > 0.0f && cosNi > 0.0f)
+    {
+        const glm::vec3 h = glm::normalize(wo + _wi);
+        const float cosNh = std::max(0.0f, glm::dot(n, h));
+        const float cosVh = std::max(0.0f, glm::dot(wo, h));
+        const glm::vec3 F = F0 + (glm::vec3(1.0f) - F0) * std::pow(1.0f - cosVh, 5.0f);
+        const float D = GgxD(cosNh, alpha);
+        const float G = SmithG1(cosNo, alpha) * SmithG1(cosNi, alpha);
+
+        _fSpecular = F * (D * G / (4.0f * cosNo * cosNi));
+        _pdfSpecular = opaqueProb * specProb * D * cosNh / std::max(1e-6f, 4.0f * cosVh);
+    }
+}
+
+bool PathTracer::SampleGuidedBounce(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, const GuidingField::Lookup& _guide, glm::vec3& _weight, Ray& _next, float& _pdf, float& _bsdfPdf, float& _guidePdf)
+{
+    const float uStrategy = _sampler.Get1D();
+    const glm::vec2 uGuide = _sampler.Get2D();
+    const glm::vec3 n = glm::normalize(_si.n);
+
+    // Pick a strategy, then weight the direction by the density of the whole mixture (one-sample MIS with the balance heuristic)
+    glm::vec3 wi;
+    if (!_guide.distribution || uStrategy < _guide.bsdfProbability)
+    {
+        glm::vec3 weight;
+        Ray next;
+        float pdf;
+        bool delta;
+        if (!SampleBounce(_ray, _si, _sampler, weight, next, pdf, delta))
+            return false;
+        wi = next.direction;
+    }
+    else
+    {
+        float pdf;
+        wi = _guide.distribution->Sample(uGuide, pdf);
+    }
+
+    const float cosNi = glm::dot(n, wi);
+    if (cosNi <= 0.0f)
+        return false;
 
-		return albedo * (1.0f - dist);
-	}
-    
-    const Material& m = *best.mat;
-    
-    // Start with emission at the hit
-    glm::vec3 L = m.emissionColour * m.emissionStrength;
+    glm::vec3 fDiffuse, fSpecular;
+    float pdfDiffuse, pdfSpecular;
+    EvaluateBsdf(_ray, _si, wi, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+
+    _bsdfPdf = pdfDiffuse + pdfSpecular;
+    _guidePdf = _guide.distribution ? _guide.distribution->Pdf(wi) : 0.0f;
+    _pdf = _guide.bsdfProbability * _bsdfPdf + (1.0f - _guide.bsdfProbability) * _guidePdf;
+    if (!(_pdf > 0.0f))
+        return false;
+
+    _weight = (fDiffuse + fSpecular) * (cosNi / _pdf);
+    _next = Ray(_si.p + n * kTMin, wi);
+    return true;
+}
+
+bool PathTracer::SampleBounce(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, glm::vec3& _weight, Ray& _next, float& _pdf, bool& _delta)
+{
+    const Material& m = _si.mat;
+
+    // A fixed set of numbers per bounce: the transmission coin, the lobe coin (reflect vs refract, or
+    // specular vs diffuse) and the direction within the chosen lobe
+    const float uTransmit = _sampler.Get1D();
+    const float uLobe = _sampler.Get1D();
+    const glm::vec2 uDirection = _sampler.Get2D();
 
     // Cosine-weighted diffuse bounce
-    glm::vec3 n = glm::normalize(best.n); // Outward geometric normal
+    glm::vec3 n = glm::normalize(_si.n); // Outward geometric normal
     glm::vec3 t, b;
     // Choose a helper to avoid degeneracy
     if (std::fabs(n.z) < 0.999f)
@@ -98,12 +840,12 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
 
     // Stage A: Transmission super-lobe coin flip
     const float pT = glm::clamp(m.transmission, 0.0f, 1.0f);
-    if (pT > 0.0f && Rand01() < pT)
+    if (pT > 0.0f && uTransmit < pT)
     {
         // Interface Fresnel (dielectric) using current medium -> target medium
         float eta_i = _ray.currentIOR;
         float eta_m = m.IOR;
-        float eta_t = best.frontFace ? eta_m : 1.0f; // entering vs exiting to air
+        float eta_t = _si.frontFace ? eta_m : 1.0f; // entering vs exiting to air
         float eta = eta_i / eta_t;
 
         float cos_i = glm::clamp(glm::dot(-_ray.direction, n), 0.0f, 1.0f);
@@ -119,7 +861,7 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         const float F_MIN = 0.05f; // tune: 0.020.1 generally stable
         float pR = TIR ? 1.0f : F;   // no F_MIN clamp
 
-        if (Rand01() < pR)
+        if (uLobe < pR)
         {
             // Rough REFLECTION (GGX) inside interface branch
             glm::vec3 hL;
@@ -127,8 +869,8 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
                 hL = glm::vec3(0, 0, 1);
             }
             else {
-                float u1 = Rand01(), u2 = Rand01();
-                float phi = 2.0f * 3.1415926535f * u1;
+                float u1 = uDirection.x, u2 = uDirection.y;
+                float phi = 2.0f * kPi * u1;
                 float a2 = alpha * alpha;
                 float tan2t = a2 * u2 / std::max(1e-6f, 1.0f - u2);
                 float cosT = 1.0f / std::sqrt(1.0f + tan2t);
@@ -138,7 +880,7 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
 
             // reflect woL around hL (same as your GGX)
             glm::vec3 wiL = glm::reflect(-woL, glm::normalize(hL));
-            if (wiL.z <= 0.0f) return L;
+            if (wiL.z <= 0.0f) return false;
 
             glm::vec3 wi = glm::normalize(wiL.x * t + wiL.y * b + wiL.z * n);
 
@@ -150,18 +892,7 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
             glm::vec3 one(1.0f);
             glm::vec3 Fmicro = F0 + (one - F0) * std::pow(1.0f - glm::clamp(cosVh, 0.0f, 1.0f), 5.0f);
 
-            float a2 = alpha * alpha;
-            float d = cosNh * cosNh * (a2 - 1.0f) + 1.0f;
-            float D = a2 / (3.1415926535f * d * d);
-
-            auto G1 = [&](float c) {
-                c = glm::clamp(c, 0.0f, 1.0f);
-                float s = std::sqrt(std::max(0.0f, 1.0f - c * c));
-                float t = (c > 0.0f) ? (s / c) : 0.0f;
-                float r = std::sqrt(1.0f + (alpha * alpha) * (t * t));
-                return 2.0f / (1.0f + r);
-                };
-            float G = G1(cosNo) * G1(cosNi);
+            float G = SmithG1(cosNo, alpha) * SmithG1(cosNi, alpha);
 
             float denom = std::max(1e-6f, cosNo * cosNh);
             glm::vec3 weight = (Fmicro * (G * cosVh)) / denom;
@@ -171,12 +902,14 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
             weight /= selPdf;
 
             Ray next;
-            next.origin = best.p + wi * kTMin;     // offset along chosen dir
+            next.origin = _si.p + wi * kTMin;     // offset along chosen dir
             next.direction = wi;
             next.currentIOR = _ray.currentIOR;
 
-            L += weight * TraceRay(next, _depth - 1);
-            return L;
+            _weight = weight;
+            _next = next;
+            _delta = true; // Interface lobes are never light sampled
+            return true;
         }
         else
         {
@@ -192,12 +925,14 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
                 float weight = (1.0f - F) / selPdf;  // importance correction
 
                 Ray next;
-                next.origin = best.p + tdir * kTMin; // offset along chosen dir
+                next.origin = _si.p + tdir * kTMin; // offset along chosen dir
                 next.direction = tdir;
                 next.currentIOR = eta_t; // toggle medium
 
-                L += weight * TraceRay(next, _depth - 1);
-                return L;
+                _weight = glm::vec3(weight);
+                _next = next;
+                _delta = true;
+                return true;
             }
             // If TIR, we would have gone to reflection path above (pR==1).
         }
@@ -210,7 +945,7 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
 
     float specProb = glm::clamp((Fv.x + Fv.y + Fv.z) * (1.0f / 3.0f), 0.05f, 0.95f);
 
-    if (Rand01() < specProb)
+    if (uLobe < specProb)
     {
         // Specular / GGX reflection
 
@@ -223,9 +958,9 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         }
         else
         {
-            float u1 = Rand01();
-            float u2 = Rand01();
-            float phi = 2.0f * 3.1415926535f * u1;
+            float u1 = uDirection.x;
+            float u2 = uDirection.y;
+            float phi = 2.0f * kPi * u1;
 
             float a2 = alpha * alpha;
             float tan2t = a2 * u2 / std::max(1e-6f, 1.0f - u2);
@@ -237,7 +972,7 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         // Reflect woL around hL
         glm::vec3 wiL = glm::reflect(-woL, glm::normalize(hL));
         if (wiL.z <= 0.0f)
-            return L; // below the surface -> no contribution this sample
+            return false; // below the surface -> no contribution this sample
 
         // World-space outgoing
         glm::vec3 wi = glm::normalize(wiL.x * t + wiL.y * b + wiL.z * n);
@@ -250,21 +985,8 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         // Fresnel-Schlick at vh
         glm::vec3 F = F0 + (one - F0) * std::pow(1.0f - glm::clamp(cosVh, 0.0f, 1.0f), 5.0f);
 
-        // GGX NDF D
-        float a2 = alpha * alpha;
-        float d = cosNh * cosNh * (a2 - 1.0f) + 1.0f;
-        float D = a2 / (3.1415926535f * d * d);
-
         // Smith GGX masking-shadowing G (separable G1)
-        auto G1 = [&](float cosNw)
-            {
-            cosNw = glm::clamp(cosNw, 0.0f, 1.0f);
-            float sinNw = std::sqrt(std::max(0.0f, 1.0f - cosNw * cosNw));
-            float tanNw = (cosNw > 0.0f) ? (sinNw / cosNw) : 0.0f;
-            float root = std::sqrt(1.0f + (alpha * alpha) * (tanNw * tanNw));
-            return 2.0f / (1.0f + root);
-            };
-        float G = G1(cosNo) * G1(cosNi);
+        float G = SmithG1(cosNo, alpha) * SmithG1(cosNi, alpha);
 
         // Importance sampling via half-vector:
         // weight = (fr * cos) / pdf = F * G * cosVh / (cosNo * cosNh)
@@ -276,19 +998,22 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         weight /= std::max(1e-3f, 1.0f - pT);
 
         Ray next;
-        next.origin = best.p + n * kTMin;
+        next.origin = _si.p + n * kTMin;
         next.direction = wi;
 
-        L += weight * TraceRay(next, _depth - 1);
+        _weight = weight;
+        _next = next;
+        _pdf = std::max(1e-3f, 1.0f - pT) * std::max(1e-3f, specProb) * GgxD(cosNh, alpha) * cosNh / std::max(1e-6f, 4.0f * cosVh);
+        _delta = roughness <= 1e-4f;
     }
     else
     {
         // Diffuse (Lambertian)
-        glm::vec3 dLocal = SampleCosineHemisphereLocal();
+        glm::vec3 dLocal = SampleCosineHemisphereLocal(uDirection);
         glm::vec3 dWorld = glm::normalize(dLocal.x * t + dLocal.y * b + dLocal.z * n);
 
         Ray next;
-        next.origin = best.p + n * kTMin;
+        next.origin = _si.p + n * kTMin;
         next.direction = dWorld;
 
         // Cosine-weighted Lambert: throughput *= albedo
@@ -296,8 +1021,647 @@ glm::vec3 PathTracer::TraceRay(Ray _ray, int _depth, bool _albedoOnly)
         glm::vec3 weight = ((1.0f - m.metallic) * m.albedo) / std::max(1e-3f, (1.0f - specProb));
         weight /= std::max(1e-3f, 1.0f - pT);
 
-        L += weight * TraceRay(next, _depth - 1);
+        _weight = weight;
+        _next = next;
+        _pdf = std::max(1e-3f, 1.0f - pT) * std::max(1e-3f, 1.0f - specProb) * dLocal.z / kPi;
+        _delta = false;
     }
 
+    return true;
+}
+
+static constexpr int kMaxBdptVertices = 32;
+
+struct PathTracer::BdptVertex
+{
+    enum class Type : uint8_t { Camera, Light, Surface };
+
+    Type type = Type::Surface;
+    glm::vec3 p{ 0.0f };
+    glm::vec3 n{ 0.0f }; // Surface: shading normal facing the arriving ray. Light: the emitting side. Camera: view direction
+    glm::vec3 wo{ 0.0f }; // Surface: unit direction back along the arriving ray
+    SurfaceInteraction si; // Surface and light vertices
+    glm::vec3 beta{ 1.0f }; // Subpath throughput up to this vertex
+    float pdfFwd = 0.0f; // Area density of this vertex as its own subpath sampled it
+    float pdfRev = 0.0f; // Area density of this vertex had the other subpath sampled it
+    bool delta = false; // Left through a delta lobe
+    int light = -1; // Emitter index in the light sampler, for light vertices and surfaces that emit
+
+    // Camera subpaths only: the numbers for this vertex's light connection, drawn with its bounce
+    float uLight = 0.0f;
+    glm::vec2 uLightPoint{ 0.0f };
+};
+
+// Solid-angle density at _from converted to area density at _to
+static inline float ConvertDensity(float _pdf, const glm::vec3& _from, const glm::vec3& _to, const glm::vec3* _toNormal)
+{
+    const glm::vec3 d = _to - _from;
+    const float dist2 = glm::dot(d, d);
+    if (dist2 <= 0.0f)
+        return 0.0f;
+    float pdf = _pdf / dist2;
+    if (_toNormal)
+        pdf *= std::fabs(glm::dot(*_toNormal, d)) / std::sqrt(dist2);
+    return pdf;
+}
+
+glm::vec3 PathTracer::TraceBidirectional(Ray _ray, Sampler& _sampler, int _depth, const Camera& _camera, glm::ivec2 _windowSize, Film& _film, SampleFeatures* _features)
+{
+    static thread_local std::vector<BdptVertex> cameraPath;
+    static thread_local std::vector<BdptVertex> lightPath;
+    cameraPath.clear();
+    lightPath.clear();
+
+    _depth = std::min(_depth, kMaxBdptVertices - 1);
+
+    // GetRay's directions have density pdf and importance pdf / cos, so the camera throughput starts at 1
+    float pdf;
+    _camera.Importance(_ray.direction, _windowSize, pdf);
+    BdptVertex camera;
+    camera.type = BdptVertex::Type::Camera;
+    camera.p = _ray.origin;
+    camera.n = _camera.GetForward();
+    cameraPath.push_back(camera);
+
+    // A path of _depth segments has _depth + 1 vertices; either side needs at least one of them from the other
+    glm::vec3 L = WalkSubpath(_ray, _sampler, 0, glm::vec3(1.0f), pdf, _depth + 1, true, cameraPath, _features);
+    GenerateLightSubpath(_sampler, _depth, _depth, lightPath);
+
+    for (int t = 1; t <= int(cameraPath.size()); ++t)
+    {
+        for (int s = 0; s <= int(lightPath.size()); ++s)
+        {
+            // s = t = 1 would need the camera to see the light point it sampled itself; s = 0, t = 2 covers it
+            const int segments = s + t - 1;
+            if (segments < 1 || segments > _depth || (s == 1 && t == 1))
+                continue;
+
+            glm::vec2 raster;
+            const glm::vec3 contribution = ConnectSubpaths(lightPath, cameraPath, s, t, _camera, _windowSize, raster);
+            if (contribution == glm::vec3(0.0f))
+                continue;
+
+            if (t == 1)
+                _film.AddSplat(int(raster.x), int(raster.y), contribution);
+            else
+                L += contribution;
+        }
+    }
+
+    ++tLocalStats.paths;
+    tLocalStats.bounces += uint64_t(cameraPath.size() - 1 + lightPath.size());
+
     return L;
+}
+
+glm::vec3 PathTracer::WalkSubpath(Ray _ray, Sampler& _sampler, int _firstBounce, glm::vec3 _beta, float _pdf, int _maxVertices, bool _fromCamera, std::vector<BdptVertex>& _path, SampleFeatures* _features)
+{
+    glm::vec3 escaped(0.0f);
+    bool recordFeatures = _features != nullptr;
+    float distance = 0.0f;
+    float pdfFwd = _pdf;
+
+    for (int bounce = 0; int(_path.size()) < _maxVertices; ++bounce)
+    {
+        _sampler.StartBounce(_firstBounce + bounce);
+
+        Hit best{};
+        if (!mScene.Intersect(_ray, kTMin, kTMax, best))
+        {
+            if (recordFeatures)
+                *_features = SampleFeatures{ glm::vec3(1.0f), -_ray.direction, SampleFeatures::kMissDepth };
+            if (!_fromCamera)
+                break;
+
+            // The environment is never where a light subpath starts, so only the camera path and its light
+            // connection can find it: the same two-way MIS as TraceRay
+            const LightSampler& lights = mScene.GetLights();
+            const EnvironmentMap* environment = lights.GetEnvironment();
+            if (!environment)
+            {
+                escaped = _beta * mBackgroundColour;
+                break;
+            }
+
+            const BdptVertex& prev = _path.back();
+            float misWeight = 1.0f;
+            if (prev.type == BdptVertex::Type::Surface && !prev.delta)
+                misWeight = PowerHeuristic(pdfFwd, lights.EnvironmentPdf(_ray.direction));
+            escaped = _beta * environment->Evaluate(_ray.direction) * misWeight;
+            break;
+        }
+
+        BdptVertex v;
+        mScene.ComputeSurfaceInteraction(_ray, best, v.si);
+        v.p = v.si.p;
+        v.n = glm::normalize(v.si.n);
+        v.wo = -_ray.direction;
+        v.beta = _beta;
+        v.pdfFwd = ConvertDensity(pdfFwd, _path.back().p, v.p, &v.n);
+        if (v.si.mat.emissionStrength > 0.0f)
+            v.light = mScene.GetLightIndex(best);
+
+        distance += best.t;
+        if (recordFeatures)
+            *_features = SampleFeatures{ v.si.mat.albedo, v.n, distance, mScene.GetObjectIndex(best) + 1 };
+
+        // Same order as TraceRay: light sample numbers, then the bounce, then roulette
+        if (_fromCamera)
+        {
+            v.uLight = _sampler.Get1D();
+            v.uLightPoint = _sampler.Get2D();
+        }
+
+        _path.push_back(v);
+        if (int(_path.size()) >= _maxVertices)
+            break;
+
+        BdptVertex& current = _path.back();
+        BdptVertex& previous = _path[_path.size() - 2];
+
+        glm::vec3 weight;
+        Ray next;
+        float pdf;
+        bool delta;
+        if (!SampleBounce(_ray, current.si, _sampler, weight, next, pdf, delta))
+            break;
+
+        float pdfRev = 0.0f;
+        if (delta)
+        {
+            current.delta = true;
+            pdf = 0.0f;
+        }
+        else
+        {
+            // Both lobes could have produced the direction, so weight by their sum; connections evaluate
+            // the whole BSDF too, and the strategies have to agree on what they estimate
+            glm::vec3 fDiffuse, fSpecular;
+            float pdfDiffuse, pdfSpecular;
+            EvaluateBsdf(_ray, current.si, next.direction, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+            pdf = pdfDiffuse + pdfSpecular;
+            if (!(pdf > 0.0f))
+                break;
+            weight = (fDiffuse + fSpecular) * (std::max(0.0f, glm::dot(current.n, next.direction)) / pdf);
+
+            EvaluateBsdf(Ray(next.origin, -next.direction), current.si, current.wo, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+            pdfRev = pdfDiffuse + pdfSpecular;
+        }
+        previous.pdfRev = ConvertDensity(pdfRev, current.p, previous.p, previous.type == BdptVertex::Type::Camera ? nullptr : &previous.n);
+
+        recordFeatures = recordFeatures && delta;
+        _beta *= weight;
+        pdfFwd = pdf;
+        _ray = next;
+
+        if (bounce + 1 >= mRouletteMinDepth)
+        {
+            const float pContinue = glm::clamp(std::max(_beta.x, std::max(_beta.y, _beta.z)), 0.05f, 0.95f);
+            if (_sampler.Get1D() >= pContinue)
+                break;
+            _beta /= pContinue;
+        }
+    }
+
+    return escaped;
+}
+
+void PathTracer::GenerateLightSubpath(Sampler& _sampler, int _firstBounce, int _maxVertices, std::vector<BdptVertex>& _path)
+{
+    const LightSampler& lights = mScene.GetLights();
+    if (_maxVertices <= 0 || lights.GetLightCount() == 0)
+        return;
+
+    _sampler.StartBounce(_firstBounce);
+    float uLight = _sampler.Get1D();
+    const glm::vec2 uPoint = _sampler.Get2D();
+    const glm::vec2 uDirection = _sampler.Get2D();
+
+    // Light connections pick the environment this often; a light subpath then has no start, so the light
+    // vertex densities agree between the strategies
+    const float pEnvironment = lights.EnvironmentProbability();
+    if (uLight < pEnvironment)
+        return;
+    uLight = std::min((uLight - pEnvironment) / (1.0f - pEnvironment), 0.99999994f);
+
+    BdptVertex v;
+    uint32_t index;
+    glm::vec3 p, n, direction;
+    float pdfPoint, pdfDirection;
+    if (!SampleEmission(uLight, uPoint, uDirection, index, p, n, direction, v.si, pdfPoint, pdfDirection))
+        return;
+    pdfPoint *= 1.0f - pEnvironment;
+
+    const glm::vec3 Le = v.si.mat.emissionColour * v.si.mat.emissionStrength;
+    v.type = BdptVertex::Type::Light;
+    v.p = p;
+    v.n = n;
+    v.light = int(index);
+    v.beta = Le / pdfPoint;
+    v.pdfFwd = pdfPoint;
+    _path.push_back(v);
+
+    const glm::vec3 beta = Le * (glm::dot(n, direction) / (pdfPoint * pdfDirection));
+    WalkSubpath(Ray(p + n * kTMin, direction), _sampler, _firstBounce + 1, beta, pdfDirection, _maxVertices, false, _path, nullptr);
+}
+
+bool PathTracer::SampleEmission(float _uLight, const glm::vec2& _uPoint, glm::vec2 _uDirection, uint32_t& _light, glm::vec3& _p, glm::vec3& _n, glm::vec3& _direction, SurfaceInteraction& _si, float& _pdfPoint, float& _pdfDirection)
+{
+    const LightSampler& lights = mScene.GetLights();
+    Hit hit{};
+    if (!lights.SampleArea(_uLight, _uPoint, _light, _p, _n, hit, _pdfPoint) || !mScene.IsOpaque(hit))
+        return false;
+
+    // Cosine-weighted about the normal; emissive triangles shine from both sides, so pick one
+    _pdfDirection = 1.0f / kPi;
+    if (lights.GetLight(_light).type == Light::Type::Triangle)
+    {
+        _pdfDirection *= 0.5f;
+        if (_uDirection.x < 0.5f)
+        {
+            _n = -_n;
+            _uDirection.x *= 2.0f;
+        }
+        else
+        {
+            _uDirection.x = std::min((_uDirection.x - 0.5f) * 2.0f, 0.99999994f);
+        }
+    }
+    const glm::vec3 local = SampleCosineHemisphereLocal(_uDirection);
+    const glm::vec3 t = glm::normalize(glm::cross(std::fabs(_n.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0), _n));
+    const glm::vec3 b = glm::cross(_n, t);
+    _direction = glm::normalize(local.x * t + local.y * b + local.z * _n);
+    _pdfDirection *= local.z;
+    if (!(_pdfDirection > 0.0f))
+        return false;
+
+    // Emission can be textured, so evaluate it like a hit seen from the emitted direction
+    hit.t = 1.0f;
+    mScene.ComputeSurfaceInteraction(Ray(_p + _direction, -_direction), hit, _si);
+    return _si.mat.emissionColour * _si.mat.emissionStrength != glm::vec3(0.0f);
+}
+
+glm::vec3 PathTracer::ConnectSubpaths(const std::vector<BdptVertex>& _lightPath, const std::vector<BdptVertex>& _cameraPath, int _s, int _t, const Camera& _camera, glm::ivec2 _windowSize, glm::vec2& _raster)
+{
+    const LightSampler& lights = mScene.GetLights();
+    glm::vec3 L(0.0f);
+    BdptVertex sampled;
+
+    if (_s == 0)
+    {
+        // The camera subpath ran into an emitter; its normal faces the arriving ray, so this is the emitting side
+        const BdptVertex& pt = _cameraPath[_t - 1];
+        if (pt.type != BdptVertex::Type::Surface)
+            return L;
+        L = pt.beta * pt.si.mat.emissionColour * pt.si.mat.emissionStrength;
+    }
+    else if (_t == 1)
+    {
+        // Light tracing: connect the light subpath straight to the camera
+        const BdptVertex& qs = _lightPath[_s - 1];
+        if (qs.type != BdptVertex::Type::Surface || !IsConnectible(qs.si.mat) || !_camera.Project(qs.p, _windowSize, _raster))
+            return L;
+
+        const glm::vec3 cameraP = _cameraPath[0].p;
+        const glm::vec3 d = cameraP - qs.p;
+        const float dist = glm::length(d);
+        const glm::vec3 wi = d / dist;
+        float pdf;
+        const float importance = _camera.Importance(-wi, _windowSize, pdf);
+        const float cosQs = glm::dot(qs.n, wi);
+        if (importance <= 0.0f || cosQs <= 0.0f)
+            return L;
+
+        sampled = _cameraPath[0];
+        L = qs.beta * EvaluateVertex(qs, wi) * (importance * cosQs * glm::dot(_cameraPath[0].n, -wi) / (dist * dist));
+        if (L == glm::vec3(0.0f) || mScene.Occluded(Ray(qs.p + qs.n * kTMin, wi), kTMin, dist * 0.999f))
+            return glm::vec3(0.0f);
+    }
+    else if (_s == 1)
+    {
+        // Light sample from the camera vertex, like next-event estimation
+        const BdptVertex& pt = _cameraPath[_t - 1];
+        if (pt.type != BdptVertex::Type::Surface || !IsConnectible(pt.si.mat))
+            return L;
+
+        const float pEnvironment = lights.EnvironmentProbability();
+        if (pt.uLight < pEnvironment)
+        {
+            // Only this and the camera path hitting the sky can make the path, so weight against BSDF sampling alone
+            glm::vec3 wi;
+            float pdf;
+            if (!lights.GetEnvironment()->Sample(pt.uLightPoint, wi, pdf))
+                return L;
+            pdf *= pEnvironment;
+            const float cosPt = glm::dot(pt.n, wi);
+            if (cosPt <= 0.0f || !(pdf > 0.0f))
+                return L;
+
+            glm::vec3 fDiffuse, fSpecular;
+            float pdfDiffuse, pdfSpecular;
+            EvaluateBsdf(Ray(pt.p, -pt.wo), pt.si, wi, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+            L = pt.beta * (fDiffuse + fSpecular) * lights.GetEnvironment()->Evaluate(wi) * (cosPt / pdf * PowerHeuristic(pdf, pdfDiffuse + pdfSpecular));
+            if (L == glm::vec3(0.0f) || mScene.Occluded(Ray(pt.p + pt.n * kTMin, wi), kTMin, kTMax))
+                return glm::vec3(0.0f);
+            return L;
+        }
+
+        const float uLight = std::min((pt.uLight - pEnvironment) / (1.0f - pEnvironment), 0.99999994f);
+        uint32_t index;
+        glm::vec3 p, n;
+        Hit hit{};
+        float pdfPoint;
+        if (!lights.SampleArea(uLight, pt.uLightPoint, index, p, n, hit, pdfPoint) || !mScene.IsOpaque(hit))
+            return L;
+        pdfPoint *= 1.0f - pEnvironment;
+
+        const glm::vec3 d = p - pt.p;
+        const float dist = glm::length(d);
+        if (dist <= 0.0f)
+            return L;
+        const glm::vec3 wi = d / dist;
+        float cosLight = -glm::dot(n, wi);
+        if (lights.GetLight(index).type == Light::Type::Triangle && cosLight < 0.0f)
+        {
+            n = -n;
+            cosLight = -cosLight;
+        }
+        const float cosPt = glm::dot(pt.n, wi);
+        if (cosLight <= 0.0f || cosPt <= 0.0f)
+            return L;
+
+        sampled.type = BdptVertex::Type::Light;
+        hit.t = dist;
+        mScene.ComputeSurfaceInteraction(Ray(pt.p, wi), hit, sampled.si);
+        sampled.p = p;
+        sampled.n = n;
+        sampled.light = int(index);
+        sampled.pdfFwd = pdfPoint;
+
+        const glm::vec3 Le = sampled.si.mat.emissionColour * sampled.si.mat.emissionStrength;
+        L = pt.beta * EvaluateVertex(pt, wi) * Le * (cosPt * cosLight / (dist * dist * pdfPoint));
+        if (L == glm::vec3(0.0f) || mScene.Occluded(Ray(pt.p + pt.n * kTMin, wi), kTMin, dist * 0.999f))
+            return glm::vec3(0.0f);
+    }
+    else
+    {
+        // Join two surface vertices with a shadow ray
+        const BdptVertex& qs = _lightPath[_s - 1];
+        const BdptVertex& pt = _cameraPath[_t - 1];
+        if (qs.type != BdptVertex::Type::Surface || pt.type != BdptVertex::Type::Surface || !IsConnectible(qs.si.mat) || !IsConnectible(pt.si.mat))
+            return L;
+
+        const glm::vec3 d = qs.p - pt.p;
+        const float dist = glm::length(d);
+        if (dist <= 0.0f)
+            return L;
+        const glm::vec3 wi = d / dist;
+        const float cosPt = glm::dot(pt.n, wi);
+        const float cosQs = -glm::dot(qs.n, wi);
+        if (cosPt <= 0.0f || cosQs <= 0.0f)
+            return L;
+
+        L = qs.beta * EvaluateVertex(qs, -wi) * EvaluateVertex(pt, wi) * pt.beta * (cosPt * cosQs / (dist * dist));
+        if (L == glm::vec3(0.0f) || mScene.Occluded(Ray(pt.p + pt.n * kTMin, wi), kTMin, dist * 0.999f))
+            return glm::vec3(0.0f);
+    }
+
+    if (L == glm::vec3(0.0f))
+        return L;
+    return L * BdptMisWeight(_lightPath, _cameraPath, sampled, _s, _t, _camera, _windowSize);
+}
+
+float PathTracer::BdptMisWeight(const std::vector<BdptVertex>& _lightPath, const std::vector<BdptVertex>& _cameraPath, const BdptVertex& _sampled, int _s, int _t, const Camera& _camera, glm::ivec2 _windowSize) const
+{
+    if (_s + _t == 2)
+        return 1.0f;
+
+    // The connection's endpoints, with the freshly sampled one standing in for s = 1 or t = 1, and their neighbours
+    const BdptVertex* qs = (_s == 1) ? &_sampled : (_s > 1 ? &_lightPath[_s - 1] : nullptr);
+    const BdptVertex* pt = (_t == 1) ? &_sampled : &_cameraPath[_t - 1];
+    const BdptVertex* qsMinus = (_s > 1) ? &_lightPath[_s - 2] : nullptr;
+    const BdptVertex* ptMinus = (_t > 1) ? &_cameraPath[_t - 2] : nullptr;
+
+    // Emitters the light sampler does not know about (fallback objects) are only ever found by the camera path
+    if (_s == 0 && pt->light < 0)
+        return 1.0f;
+
+    // Copies of the subpath densities, with the reverse densities the connection gives its four nearest vertices;
+    // the connected endpoints are never delta
+    float lightFwd[kMaxBdptVertices], lightRev[kMaxBdptVertices], cameraFwd[kMaxBdptVertices], cameraRev[kMaxBdptVertices];
+    bool lightDelta[kMaxBdptVertices], cameraDelta[kMaxBdptVertices];
+    for (int i = 0; i < _s; ++i)
+    {
+        const BdptVertex& v = (i == _s - 1) ? *qs : _lightPath[i];
+        lightFwd[i] = v.pdfFwd;
+        lightRev[i] = v.pdfRev;
+        lightDelta[i] = v.delta;
+    }
+    for (int i = 0; i < _t; ++i)
+    {
+        const BdptVertex& v = (i == _t - 1) ? *pt : _cameraPath[i];
+        cameraFwd[i] = v.pdfFwd;
+        cameraRev[i] = v.pdfRev;
+        cameraDelta[i] = v.delta;
+    }
+
+    cameraDelta[_t - 1] = false;
+    cameraRev[_t - 1] = qs ? VertexPdf(*qs, qsMinus, *pt, _camera, _windowSize) : LightOriginPdf(*pt);
+    if (ptMinus)
+        cameraRev[_t - 2] = qs ? VertexPdf(*pt, qs, *ptMinus, _camera, _windowSize) : EmissionPdf(*pt, *ptMinus);
+    if (qs)
+    {
+        lightDelta[_s - 1] = false;
+        lightRev[_s - 1] = VertexPdf(*pt, ptMinus, *qs, _camera, _windowSize);
+    }
+    if (qsMinus)
+        lightRev[_s - 2] = VertexPdf(*qs, pt, *qsMinus, _camera, _windowSize);
+
+    // Power heuristic: the other strategies' densities relative to this one, found by moving the connection
+    // one vertex at a time. Delta densities are stored as 0 and cancel, so they count as 1
+    auto remap = [](float _pdf) { return _pdf != 0.0f ? _pdf : 1.0f; };
+    float sum = 0.0f;
+
+    float ratio = 1.0f;
+    for (int i = _t - 1; i > 0; --i)
+    {
+        ratio *= remap(cameraRev[i]) / remap(cameraFwd[i]);
+        if (!cameraDelta[i] && !cameraDelta[i - 1])
+            sum += ratio * ratio;
+    }
+
+    ratio = 1.0f;
+    for (int i = _s - 1; i >= 0; --i)
+    {
+        ratio *= remap(lightRev[i]) / remap(lightFwd[i]);
+        if (!lightDelta[i] && !(i > 0 && lightDelta[i - 1]))
+            sum += ratio * ratio;
+    }
+
+    return 1.0f / (1.0f + sum);
+}
+
+glm::vec3 PathTracer::EvaluateVertex(const BdptVertex& _v, const glm::vec3& _wi) const
+{
+    if (glm::dot(_v.n, _wi) <= 0.0f || glm::dot(_v.n, _v.wo) <= 0.0f)
+        return glm::vec3(0.0f);
+
+    glm::vec3 fDiffuse, fSpecular;
+    float pdfDiffuse, pdfSpecular;
+    EvaluateBsdf(Ray(_v.p + _v.wo, -_v.wo), _v.si, _wi, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+    return fDiffuse + fSpecular;
+}
+
+float PathTracer::VertexPdf(const BdptVertex& _v, const BdptVertex* _prev, const BdptVertex& _next, const Camera& _camera, glm::ivec2 _windowSize) const
+{
+    if (_v.type == BdptVertex::Type::Light)
+        return EmissionPdf(_v, _next);
+
+    const glm::vec3 d = _next.p - _v.p;
+    const float dist = glm::length(d);
+    if (dist <= 0.0f)
+        return 0.0f;
+    const glm::vec3 wn = d / dist;
+
+    float pdf = 0.0f;
+    if (_v.type == BdptVertex::Type::Camera)
+    {
+        _camera.Importance(wn, _windowSize, pdf);
+    }
+    else
+    {
+        if (!_prev)
+            return 0.0f;
+        const glm::vec3 wp = glm::normalize(_prev->p - _v.p);
+        glm::vec3 fDiffuse, fSpecular;
+        float pdfDiffuse, pdfSpecular;
+        EvaluateBsdf(Ray(_prev->p, -wp), _v.si, wn, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+        pdf = pdfDiffuse + pdfSpecular;
+    }
+
+    return ConvertDensity(pdf, _v.p, _next.p, _next.type == BdptVertex::Type::Camera ? nullptr : &_next.n);
+}
+
+float PathTracer::EmissionPdf(const BdptVertex& _v, const BdptVertex& _next) const
+{
+    if (_v.light < 0)
+        return 0.0f;
+
+    const glm::vec3 d = _next.p - _v.p;
+    const float dist = glm::length(d);
+    if (dist <= 0.0f)
+        return 0.0f;
+
+    // Same cosine lobes as GenerateLightSubpath
+    float cosTheta = glm::dot(_v.n, d / dist);
+    float pdfDirection = 1.0f / kPi;
+    if (mScene.GetLights().GetLight(uint32_t(_v.light)).type == Light::Type::Triangle)
+    {
+        cosTheta = std::fabs(cosTheta);
+        pdfDirection *= 0.5f;
+    }
+    if (cosTheta <= 0.0f)
+        return 0.0f;
+
+    return ConvertDensity(pdfDirection * cosTheta, _v.p, _next.p, _next.type == BdptVertex::Type::Camera ? nullptr : &_next.n);
+}
+
+float PathTracer::LightOriginPdf(const BdptVertex& _v) const
+{
+    if (_v.light < 0)
+        return 0.0f;
+    const LightSampler& lights = mScene.GetLights();
+    return (1.0f - lights.EnvironmentProbability()) * lights.AreaPdf(uint32_t(_v.light));
+}
+
+static constexpr int kPhotonBatches = 64;
+
+void PathTracer::TracePhotons(ThreadPool& _threadPool, int _iteration, int _depth)
+{
+    const float radius = mPhotons.RadiusAt(_iteration, glm::length(mScene.GetBoundsMax() - mScene.GetBoundsMin()));
+    const uint32_t count = uint32_t(mPhotons.GetPhotonsPerFrame());
+
+    mPhotonBatches.resize(kPhotonBatches);
+    for (int i = 0; i < kPhotonBatches; ++i)
+    {
+        const uint32_t first = uint32_t(uint64_t(count) * i / kPhotonBatches);
+        const uint32_t last = uint32_t(uint64_t(count) * (i + 1) / kPhotonBatches);
+        std::vector<Photon>& batch = mPhotonBatches[i];
+        _threadPool.EnqueueTask([=, this, &batch] { TracePhotonBatch(first, last, count, uint32_t(_iteration), _depth, batch); });
+    }
+    _threadPool.WaitForCompletion();
+
+    mPhotons.Build(mPhotonBatches, radius, _threadPool);
+}
+
+void PathTracer::TracePhotonBatch(uint32_t _first, uint32_t _last, uint32_t _count, uint32_t _iteration, int _depth, std::vector<Photon>& _out)
+{
+    _out.clear();
+    if (mScene.GetLights().GetLightCount() == 0)
+        return;
+
+    for (uint32_t i = _first; i < _last; ++i)
+    {
+        // The frame's photons are consecutive points of one Sobol sequence, scrambled afresh each frame
+        Sampler sampler(Sampler::Type::Sobol, glm::ivec2(0), i, _iteration);
+        sampler.StartBounce(0);
+        const float uLight = sampler.Get1D();
+        const glm::vec2 uPoint = sampler.Get2D();
+        const glm::vec2 uDirection = sampler.Get2D();
+
+        uint32_t light;
+        glm::vec3 p, n, direction;
+        SurfaceInteraction si;
+        float pdfPoint, pdfDirection;
+        if (!SampleEmission(uLight, uPoint, uDirection, light, p, n, direction, si, pdfPoint, pdfDirection))
+            continue;
+
+        glm::vec3 power = si.mat.emissionColour * si.mat.emissionStrength * (glm::dot(n, direction) / (pdfPoint * pdfDirection * float(_count)));
+        Ray ray(p + n * kTMin, direction);
+
+        // A caustic starts at the first delta bounce and ends at the first other one; the photon is stored
+        // at every surface it could be gathered at in between
+        bool caustic = false;
+        for (int bounce = 1; bounce < _depth; ++bounce)
+        {
+            sampler.StartBounce(bounce);
+
+            Hit hit{};
+            if (!mScene.Intersect(ray, kTMin, kTMax, hit))
+                break;
+            mScene.ComputeSurfaceInteraction(ray, hit, si);
+            if (caustic && IsConnectible(si.mat))
+                _out.push_back(Photon{ si.p, -ray.direction, glm::normalize(si.n), power });
+
+            glm::vec3 weight;
+            Ray next;
+            float pdf;
+            bool delta;
+            if (!SampleBounce(ray, si, sampler, weight, next, pdf, delta) || !delta)
+                break;
+            caustic = true;
+            power *= weight;
+            ray = next;
+        }
+    }
+}
+
+glm::vec3 PathTracer::GatherPhotons(const Ray& _ray, const SurfaceInteraction& _si) const
+{
+    const glm::vec3 n = glm::normalize(_si.n);
+    glm::vec3 sum(0.0f);
+    mPhotons.ForEachNear(_si.p, [&](const Photon& _photon)
+        {
+            // Only photons on this side of the same surface, not the far side of a thin wall or round a corner
+            if (glm::dot(_photon.n, n) <= 0.0f || glm::dot(_photon.wi, n) <= 0.0f)
+                return;
+
+            glm::vec3 fDiffuse, fSpecular;
+            float pdfDiffuse, pdfSpecular;
+            EvaluateBsdf(_ray, _si, _photon.wi, fDiffuse, pdfDiffuse, fSpecular, pdfSpecular);
+            sum += (fDiffuse + fSpecular) * _photon.power;
+        });
+
+    const float radius = mPhotons.GetRadius();
+    return sum / (kPi * radius * radius);
 }
\ No newline at end of file
@@ -1,24 +1,198 @@
 #pragma once
 
 #include "RayObject.h"
+#include "CompiledScene.h"
+#include "EnvironmentMap.h"
+#include "Sampler.h"
+#include "Film.h"
+#include "PathGuiding.h"
+#include "PhotonMap.h"
+#include "RadianceCache.h"
+#include "ThreadPool.h"
+#include "Camera.h"
 
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <cstdint>
+
+// How camera samples are turned into colour; chosen per render job
+enum class Integrator
+{
+	Path, // TraceRay, or TraceBatch for the wavefront variant
+	Bidirectional // TraceBidirectional
+};
 
 class PathTracer
 {
 public:
-	glm::vec3 TraceRay(Ray _ray, int _depth, bool _albedoOnly = false);
+	// _sampler supplies every random decision along the path. If _features is set it receives the albedo, normal,
+	// distance and object of the first vertex the path does not leave through a mirror or glass lobe
+	glm::vec3 TraceRay(Ray _ray, Sampler& _sampler, int _depth, bool _albedoOnly = false, SampleFeatures* _features = nullptr);
+
+	// Wavefront mode: traces all of _rays together, running each stage (extend, shade, shadow) as its own
+	// pass over the batch instead of one whole path at a time. _out[i] is an estimate of TraceRay(_rays[i], _samplers[i])
+	void TraceBatch(const std::vector<Ray>& _rays, const std::vector<Sampler>& _samplers, int _depth, bool _albedoOnly, std::vector<glm::vec3>& _out, std::vector<SampleFeatures>* _features = nullptr);
+
+	// Bidirectional path tracing: a light subpath is traced alongside the camera path and every pair of their vertices
+	// is connected, each strategy weighted by MIS. Light reaching diffuse surfaces through glass, which the camera
+	// path can only find by chance, is picked up by the light subpath. Returns the strategies that land in this
+	// sample's pixel; light tracing strategies land anywhere and are splatted into _film (thread safe).
+	// Call _film.AddLightPaths with the number of calls made
+	glm::vec3 TraceBidirectional(Ray _ray, Sampler& _sampler, int _depth, const Camera& _camera, glm::ivec2 _windowSize, Film& _film, SampleFeatures* _features = nullptr);
 
 	const std::vector<std::shared_ptr<RayObject>>& GetRayObjects() { return rayObjects; }
-	void AddRayObject(std::shared_ptr<RayObject> _rayObject) { rayObjects.push_back(_rayObject); }
+	void AddRayObject(std::shared_ptr<RayObject> _rayObject) { rayObjects.push_back(_rayObject); mSceneDirty = true; }
 
 	// Scene management
 	int GetSizeOfRayObjects() { return rayObjects.size(); }
-	void ClearScene() { rayObjects.clear(); }
+	void ClearScene() { rayObjects.clear(); mSceneDirty = true; }
+
+	// TraceRay only sees the compiled scene: mark it dirty after editing objects,
+	// then compile from the main thread before the next frame is traced
+	void MarkSceneDirty() { mSceneDirty = true; }
+	void CompileScene();
+
+	// Image-based lighting for rays that leave the scene; without one they see the flat background colour
+	void SetEnvironment(std::shared_ptr<EnvironmentMap> _environment) { mEnvironment = _environment; mSceneDirty = true; }
+	std::shared_ptr<EnvironmentMap> GetEnvironment() { return mEnvironment; }
+
+	// Paths stop at _depth, or earlier by Russian roulette once this many bounces have been traced
+	void SetRouletteMinDepth(int _depth) { mRouletteMinDepth = _depth; }
+	int GetRouletteMinDepth() { return mRouletteMinDepth; }
+
+	// Explicit light sampling at each vertex, combined with BSDF sampling by MIS
+	void SetNextEventEstimation(bool _enabled) { mNextEventEstimation = _enabled; }
+	bool GetNextEventEstimation() { return mNextEventEstimation; }
+
+	// TraceRay only: sample opaque surfaces from a mix of the BSDF and a learnt distribution of incident light,
+	// training it from the same paths. The field restarts whenever the scene is recompiled
+	void SetPathGuiding(bool _enabled) { mPathGuiding = _enabled; }
+	bool GetPathGuiding() { return mPathGuiding; }
+	// Call EndFrame on it after each traced frame while guiding is on
+	GuidingField& GetGuidingField() { return mGuiding; }
+
+	// TraceRay only: caustics, light reaching a diffuse or glossy surface through glass or mirrors alone, are gathered
+	// from a photon map at the first such surface a camera path reaches, instead of being left to the path to find
+	void SetCausticPhotons(bool _enabled) { mCausticPhotons = _enabled; }
+	bool GetCausticPhotons() { return mCausticPhotons; }
+	// Call before tracing each frame while caustic photons are on. _iteration counts the frames in the accumulation
+	// from 1 and sets the gather radius; photon paths stop at _depth like camera paths
+	void TracePhotons(ThreadPool& _threadPool, int _iteration, int _depth);
+	PhotonMap& GetPhotonMap() { return mPhotons; }
+
+	// TraceRay only: every path feeds a world-space cache of the light leaving diffuse surfaces, and from the cache's
+	// lookup bounce on stops at the first cached surface it reaches, taking the rest from the cache. Biased, but
+	// indirect lighting looks close to converged after a few frames. The cache is cleared whenever the scene is recompiled
+	void SetRadianceCaching(bool _enabled) { mRadianceCaching = _enabled; }
+	bool GetRadianceCaching() { return mRadianceCaching; }
+	// Call EndFrame on it after each traced frame while the cache is on
+	RadianceCache& GetRadianceCache() { return mRadianceCache; }
+
+	// TraceBatch only: shade hits grouped by material, and reorder secondary rays by direction octant
+	// and origin Morton code before each extend pass
+	void SetSortHits(bool _enabled) { mSortHits = _enabled; }
+	bool GetSortHits() { return mSortHits; }
+	void SetSortRays(bool _enabled) { mSortRays = _enabled; }
+	bool GetSortRays() { return mSortRays; }
+
+	// Paths and ray segments traced since the last ResetStats, summed over all threads.
+	// Each thread counts its own and adds them to these totals in PublishStats, so call that at the end of every task
+	uint64_t GetPathCount() const { return mStats.paths.load(std::memory_order_relaxed); }
+	uint64_t GetBounceCount() const { return mStats.bounces.load(std::memory_order_relaxed); }
+	// TraceBatch coherence, a portable stand-in for cache-miss counts: how often consecutive shaded hits
+	// change material, and how often consecutive traced rays end on a different object or block of faces
+	uint64_t GetMaterialSwitchCount() const { return mStats.materialSwitches.load(std::memory_order_relaxed); }
+	uint64_t GetHitJumpCount() const { return mStats.hitJumps.load(std::memory_order_relaxed); }
+	void ResetStats() { mStats.paths = 0; mStats.bounces = 0; mStats.materialSwitches = 0; mStats.hitJumps = 0; }
+	// Adds what the calling thread traced since its last call to the totals above
+	void PublishStats();
 
 private:
+	// SoA path and shadow ray state for TraceBatch, one per thread
+	struct PathQueue;
+
+	void GeneratePaths(PathQueue& _q, const std::vector<Ray>& _rays, const std::vector<Sampler>& _samplers);
+	void SortRays(PathQueue& _q);
+	void ExtendPaths(PathQueue& _q);
+	void ShadePaths(PathQueue& _q, int _bounce, int _depth, bool _albedoOnly);
+	void ShadePath(PathQueue& _q, uint32_t _path, int _bounce, int _depth, bool _albedoOnly);
+	void TraceShadowRays(PathQueue& _q);
+
+	// Picks the next lobe at _si; false if the path ends here, else the throughput weight and continuation ray,
+	// the lobe's solid-angle pdf (with its selection probability) and whether it is a delta / never light-sampled lobe
+	bool SampleBounce(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, glm::vec3& _weight, Ray& _next, float& _pdf, bool& _delta);
+
+	// Bidirectional path vertex, see PathTracer.cpp
+	struct BdptVertex;
+
+	// Extends _path (which holds its endpoint) by following _ray, appending a vertex per hit until _maxVertices;
+	// _pdf is the solid-angle density of _ray at the endpoint. Camera subpaths return what escaped the scene
+	glm::vec3 WalkSubpath(Ray _ray, Sampler& _sampler, int _firstBounce, glm::vec3 _beta, float _pdf, int _maxVertices, bool _fromCamera, std::vector<BdptVertex>& _path, SampleFeatures* _features);
+	void GenerateLightSubpath(Sampler& _sampler, int _firstBounce, int _maxVertices, std::vector<BdptVertex>& _path);
+	// MIS weighted contribution of strategy (s, t); for t = 1 it belongs at _raster instead of this pixel
+	glm::vec3 ConnectSubpaths(const std::vector<BdptVertex>& _lightPath, const std::vector<BdptVertex>& _cameraPath, int _s, int _t, const Camera& _camera, glm::ivec2 _windowSize, glm::vec2& _raster);
+	float BdptMisWeight(const std::vector<BdptVertex>& _lightPath, const std::vector<BdptVertex>& _cameraPath, const BdptVertex& _sampled, int _s, int _t, const Camera& _camera, glm::ivec2 _windowSize) const;
+	// BSDF at a surface vertex from its arriving direction to _wi (zero below the surface)
+	glm::vec3 EvaluateVertex(const BdptVertex& _v, const glm::vec3& _wi) const;
+	// Area density at _next of _v sampling a direction towards it, having arrived from _prev
+	float VertexPdf(const BdptVertex& _v, const BdptVertex* _prev, const BdptVertex& _next, const Camera& _camera, glm::ivec2 _windowSize) const;
+	// Area density at _next of light vertex _v emitting towards it, and of the light subpath starting at _v
+	float EmissionPdf(const BdptVertex& _v, const BdptVertex& _next) const;
+	float LightOriginPdf(const BdptVertex& _v) const;
+
+	// Start of a light path: a light picked by power, a point uniform over its area and a cosine-weighted direction.
+	// _n faces the emitted side; _si holds the emission and _pdfPoint is per unit area, including the pick
+	bool SampleEmission(float _uLight, const glm::vec2& _uPoint, glm::vec2 _uDirection, uint32_t& _light, glm::vec3& _p, glm::vec3& _n, glm::vec3& _direction, SurfaceInteraction& _si, float& _pdfPoint, float& _pdfDirection);
+
+	// Traces photons [_first, _last) of the _count emitted this frame into _out
+	void TracePhotonBatch(uint32_t _first, uint32_t _last, uint32_t _count, uint32_t _iteration, int _depth, std::vector<Photon>& _out);
+	// Caustic radiance leaving _si back along _ray, estimated from the photons around it
+	glm::vec3 GatherPhotons(const Ray& _ray, const SurfaceInteraction& _si) const;
+
+	// SampleBounce's opaque lobes mixed with the guiding distribution; the weight and _pdf are for the mixture,
+	// _bsdfPdf and _guidePdf are the two strategies' densities for the chosen direction
+	bool SampleGuidedBounce(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, const GuidingField::Lookup& _guide, glm::vec3& _weight, Ray& _next, float& _pdf, float& _bsdfPdf, float& _guidePdf);
+
+	// SampleBounce's opaque lobes for a given direction: BSDF values and solid-angle pdfs with their selection probabilities
+	void EvaluateBsdf(const Ray& _ray, const SurfaceInteraction& _si, const glm::vec3& _wi, glm::vec3& _fDiffuse, float& _pdfDiffuse, glm::vec3& _fSpecular, float& _pdfSpecular) const;
+
+	// One light sample with a shadow ray, MIS weighted against the BSDF lobes (or the guided mixture if _guide is set);
+	// not scaled by path throughput
+	glm::vec3 SampleDirectLight(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, const GuidingField::Lookup* _guide = nullptr);
+	// SampleDirectLight without the shadow test: the contribution if the shadow ray is unoccluded up to _shadowTMax
+	bool PrepareDirectLight(const Ray& _ray, const SurfaceInteraction& _si, Sampler& _sampler, Ray& _shadow, float& _shadowTMax, glm::vec3& _contribution, const GuidingField::Lookup* _guide = nullptr);
+
 	glm::vec3 mBackgroundColour{ 0.2f, 0.2f, 0.2f };
+	std::shared_ptr<EnvironmentMap> mEnvironment;
 
 	std::vector<std::shared_ptr<RayObject>> rayObjects;
+
+	CompiledScene mScene;
+	bool mSceneDirty = true;
+
+	GuidingField mGuiding;
+	bool mPathGuiding = false;
+
+	PhotonMap mPhotons;
+	std::vector<std::vector<Photon>> mPhotonBatches; // Per build task, kept to reuse their allocations
+	bool mCausticPhotons = false;
+
+	RadianceCache mRadianceCache;
+	bool mRadianceCaching = false;
+
+	int mRouletteMinDepth = 3;
+	bool mNextEventEstimation = true;
+	bool mSortHits = true;
+	bool mSortRays = true;
+
+	// On cache lines of their own, so publishing never invalidates the line the settings above are read from
+	struct alignas(64) SharedStats
+	{
+		std::atomic<uint64_t> paths{ 0 };
+		std::atomic<uint64_t> bounces{ 0 };
+		std::atomic<uint64_t> materialSwitches{ 0 };
+		std::atomic<uint64_t> hitJumps{ 0 };
+	};
+	SharedStats mStats;
 };
\ No newline at end of file
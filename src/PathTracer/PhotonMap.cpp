@@ -0,0 +1,87 @@
+#include "PhotonMap.h"
+
+#include <IMGUI/imgui.h>
+
+#include <atomic>
+#include <cmath>
+
+float PhotonMap::RadiusAt(int _iteration, float _sceneSize) const
+{
+    // r_i^2 = r_1^2 * prod_{k=1}^{i-1} (k + alpha) / (k + 1), written with gamma functions
+    const float i = float(std::max(_iteration, 1));
+    const float shrink = std::exp(std::lgamma(i + mAlpha) - std::lgamma(1.0f + mAlpha) - std::lgamma(i + 1.0f));
+    return mInitialRadius * _sceneSize * std::sqrt(shrink);
+}
+
+uint32_t PhotonMap::Bucket(const glm::ivec3& _cell) const
+{
+    // Spatial hash of Teschner et al. 2003
+    return ((uint32_t(_cell.x) * 73856093u) ^ (uint32_t(_cell.y) * 19349663u) ^ (uint32_t(_cell.z) * 83492791u)) & mBucketMask;
+}
+
+void PhotonMap::Build(const std::vector<std::vector<Photon>>& _batches, float _radius, ThreadPool& _threadPool)
+{
+    mRadius = _radius;
+    mCellSize = std::max(2.0f * _radius, 1e-6f);
+
+    size_t total = 0;
+    for (const std::vector<Photon>& batch : _batches)
+        total += batch.size();
+
+    // About one photon per bucket
+    uint32_t bucketCount = 1;
+    while (bucketCount < total)
+        bucketCount <<= 1;
+    mBucketMask = bucketCount - 1;
+
+    // Counting sort by bucket: count in parallel, prefix sum, then scatter in parallel
+    std::vector<std::atomic<uint32_t>> cursor(bucketCount);
+    for (const std::vector<Photon>& batch : _batches)
+    {
+        _threadPool.EnqueueTask([&] {
+            for (const Photon& photon : batch)
+                cursor[Bucket(CellOf(photon.p))].fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    _threadPool.WaitForCompletion();
+
+    mBucketStart.resize(bucketCount + 1);
+    uint32_t start = 0;
+    for (uint32_t b = 0; b < bucketCount; ++b)
+    {
+        mBucketStart[b] = start;
+        start += cursor[b].load(std::memory_order_relaxed);
+        cursor[b].store(mBucketStart[b], std::memory_order_relaxed);
+    }
+    mBucketStart[bucketCount] = start;
+
+    mPhotons.resize(total);
+    for (const std::vector<Photon>& batch : _batches)
+    {
+        _threadPool.EnqueueTask([&] {
+            for (const Photon& photon : batch)
+                mPhotons[cursor[Bucket(CellOf(photon.p))].fetch_add(1, std::memory_order_relaxed)] = photon;
+        });
+    }
+    _threadPool.WaitForCompletion();
+}
+
+void PhotonMap::Clear()
+{
+    mPhotons.clear();
+    mBucketStart.clear();
+}
+
+bool PhotonMap::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Caustic photons"))
+    {
+        ImGui::Text("%zu photons stored, radius %.4f", mPhotons.size(), mRadius);
+        changed |= ImGui::SliderInt("Photons per frame", &mPhotonsPerFrame, 1 << 12, 1 << 22, "%d", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Initial radius", &mInitialRadius, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Alpha", &mAlpha, 0.1f, 0.99f, "%.2f");
+        ImGui::TreePop();
+    }
+    return changed;
+}
\ No newline at end of file
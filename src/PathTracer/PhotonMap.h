@@ -0,0 +1,100 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <GLM/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A photon stored where it reached a diffuse or glossy surface through glass or mirrors
+struct Photon
+{
+	glm::vec3 p{ 0.0f };
+	glm::vec3 wi{ 0.0f }; // Unit direction back the way it came
+	glm::vec3 n{ 0.0f }; // Surface normal on the side it arrived
+	glm::vec3 power{ 0.0f }; // Flux, already divided by the number of photons emitted
+};
+
+// Caustic photons for progressive photon mapping. Every frame traces a fresh set, hashed into a uniform grid
+// of cells one gather diameter wide, so a lookup visits at most 2x2x2 cells. The gather radius shrinks from
+// frame to frame on the schedule of Knaus and Zwicker ("Progressive Photon Mapping: A Probabilistic Approach",
+// 2011), so the average of the per-frame estimates the film accumulates converges to the true caustics.
+class PhotonMap
+{
+public:
+	// Gather radius for frame _iteration (from 1) of an accumulation, in a scene _sceneSize across
+	float RadiusAt(int _iteration, float _sceneSize) const;
+
+	// Replaces the map with the photons of _batches, gathered within _radius; one build task per batch on _threadPool
+	void Build(const std::vector<std::vector<Photon>>& _batches, float _radius, ThreadPool& _threadPool);
+	void Clear();
+
+	// Calls _visit(photon) for every stored photon within the radius of _p
+	template <typename Visit>
+	void ForEachNear(const glm::vec3& _p, const Visit& _visit) const;
+
+	float GetRadius() const { return mRadius; }
+	size_t GetPhotonCount() const { return mPhotons.size(); }
+	void SetPhotonsPerFrame(int _count) { mPhotonsPerFrame = _count; }
+	int GetPhotonsPerFrame() const { return mPhotonsPerFrame; }
+
+	// True if a setting changed
+	bool UpdateUI();
+
+private:
+	glm::ivec3 CellOf(const glm::vec3& _p) const { return glm::ivec3(glm::floor(_p / mCellSize)); }
+	uint32_t Bucket(const glm::ivec3& _cell) const;
+
+	int mPhotonsPerFrame = 1 << 17; // Emitted; only those reaching a surface through glass or mirrors are kept
+	float mInitialRadius = 0.01f; // Of the scene's diagonal
+	float mAlpha = 2.0f / 3.0f; // Share of the radius kept each frame; lower shrinks faster
+
+	float mRadius = 0.0f;
+	float mCellSize = 1.0f;
+	uint32_t mBucketMask = 0;
+
+	std::vector<Photon> mPhotons; // Ordered by bucket
+	std::vector<uint32_t> mBucketStart; // Per bucket, its first photon; one extra entry holds the total
+};
+
+template <typename Visit>
+void PhotonMap::ForEachNear(const glm::vec3& _p, const Visit& _visit) const
+{
+	if (mPhotons.empty())
+		return;
+
+	// Cells are one diameter wide, so the sphere reaches at most the cell holding _p and its nearer neighbour
+	// on each axis. Cells sharing a bucket hand back each other's photons too, which the distance test rejects;
+	// a bucket two of the cells share is only read once
+	const float radius2 = mRadius * mRadius;
+	const glm::vec3 q = _p / mCellSize;
+	const glm::ivec3 cell(glm::floor(q));
+	const glm::vec3 f = q - glm::floor(q);
+	const glm::ivec3 lo = cell - glm::ivec3(glm::lessThan(f, glm::vec3(0.5f)));
+	const glm::ivec3 hi = lo + glm::ivec3(1);
+
+	uint32_t visited[8];
+	int visitedCount = 0;
+	for (int z = lo.z; z <= hi.z; ++z)
+	{
+		for (int y = lo.y; y <= hi.y; ++y)
+		{
+			for (int x = lo.x; x <= hi.x; ++x)
+			{
+				const uint32_t bucket = Bucket(glm::ivec3(x, y, z));
+				if (std::find(visited, visited + visitedCount, bucket) != visited + visitedCount)
+					continue;
+				visited[visitedCount++] = bucket;
+
+				for (uint32_t i = mBucketStart[bucket]; i < mBucketStart[bucket + 1]; ++i)
+				{
+					const glm::vec3 d = mPhotons[i].p - _p;
+					if (glm::dot(d, d) <= radius2)
+						_visit(mPhotons[i]);
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,659 @@
+#include "PrimitiveBatch.h"
+
+#include <IMGUI/imgui.h>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <bit>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Padding lanes hold NaN so every ordered comparison on them fails and they never report a hit
+static const float kPad = std::numeric_limits<float>::quiet_NaN();
+
+// Grows an SoA array by a whole SIMD step when the next primitive would start a new one
+static inline void PushLane(std::vector<float>& _array, size_t _index, float _value)
+{
+    if (_index % PrimitiveBatch::kLanes == 0)
+        _array.insert(_array.end(), PrimitiveBatch::kLanes, kPad);
+    _array[_index] = _value;
+}
+
+PrimitiveBatch::PrimitiveBatch(std::string _name)
+{
+    mName = _name;
+}
+
+uint32_t PrimitiveBatch::AddMaterial(const Material& _material)
+{
+    mMaterials.push_back(_material);
+    return uint32_t(mMaterials.size() - 1);
+}
+
+uint32_t PrimitiveBatch::AddSphere(const glm::vec3& _centre, float _radius, uint32_t _materialIndex)
+{
+    const size_t i = mSphereCount++;
+    PushLane(mSphereX, i, _centre.x);
+    PushLane(mSphereY, i, _centre.y);
+    PushLane(mSphereZ, i, _centre.z);
+    PushLane(mSphereRadius, i, _radius);
+    mSphereMaterial.push_back(_materialIndex);
+    mSphereIndex.push_back(uint32_t(i));
+    mSphereLane.push_back(uint32_t(i));
+    mSphereNodes.clear();
+    return uint32_t(i);
+}
+
+uint32_t PrimitiveBatch::AddBox(const glm::vec3& _centre, const glm::vec3& _rotation, const glm::vec3& _size, uint32_t _materialIndex)
+{
+    // Same Euler order as Box
+    glm::mat4 R = glm::mat4(1.0f);
+    R = glm::rotate(R, glm::radians(_rotation.x), glm::vec3(1, 0, 0));
+    R = glm::rotate(R, glm::radians(_rotation.y), glm::vec3(0, 1, 0));
+    R = glm::rotate(R, glm::radians(_rotation.z), glm::vec3(0, 0, 1));
+    const glm::mat3 localFromWorld = glm::transpose(glm::mat3(R));
+
+    float rot[9];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            rot[r * 3 + c] = localFromWorld[c][r]; // glm is column-major
+
+    return PushBox(_centre, rot, _size * 0.5f, _materialIndex);
+}
+
+uint32_t PrimitiveBatch::PushBox(const glm::vec3& _centre, const float _localFromWorld[9], const glm::vec3& _half, uint32_t _materialIndex)
+{
+    const size_t i = mBoxCount++;
+    PushLane(mBoxX, i, _centre.x);
+    PushLane(mBoxY, i, _centre.y);
+    PushLane(mBoxZ, i, _centre.z);
+    for (int k = 0; k < 9; ++k)
+        PushLane(mBoxRot[k], i, _localFromWorld[k]);
+    PushLane(mBoxHalfX, i, _half.x);
+    PushLane(mBoxHalfY, i, _half.y);
+    PushLane(mBoxHalfZ, i, _half.z);
+    mBoxMaterial.push_back(_materialIndex);
+    mBoxIndex.push_back(uint32_t(i));
+    mBoxLane.push_back(uint32_t(i));
+    mBoxNodes.clear();
+    return uint32_t(i);
+}
+
+void PrimitiveBatch::Append(const PrimitiveBatch& _other)
+{
+    const uint32_t materialBase = uint32_t(mMaterials.size());
+    mMaterials.insert(mMaterials.end(), _other.mMaterials.begin(), _other.mMaterials.end());
+
+    for (size_t i = 0; i < _other.mSphereCount; ++i)
+    {
+        glm::vec3 centre;
+        float radius;
+        _other.GetSphere(i, centre, radius);
+        AddSphere(centre, radius, materialBase + _other.mSphereMaterial[i]);
+    }
+
+    for (size_t i = 0; i < _other.mBoxCount; ++i)
+    {
+        const size_t lane = _other.mBoxLane[i];
+        float rot[9];
+        for (int k = 0; k < 9; ++k)
+            rot[k] = _other.mBoxRot[k][lane];
+        PushBox(glm::vec3(_other.mBoxX[lane], _other.mBoxY[lane], _other.mBoxZ[lane]), rot,
+            glm::vec3(_other.mBoxHalfX[lane], _other.mBoxHalfY[lane], _other.mBoxHalfZ[lane]), materialBase + _other.mBoxMaterial[i]);
+    }
+}
+
+const Material& PrimitiveBatch::GetPrimitiveMaterial(uint32_t _primitive) const
+{
+    if (_primitive & kBoxBit)
+        return mMaterials[mBoxMaterial[_primitive & ~kBoxBit]];
+    return mMaterials[mSphereMaterial[_primitive]];
+}
+
+void PrimitiveBatch::GetSphere(size_t _index, glm::vec3& _centre, float& _radius) const
+{
+    const size_t lane = mSphereLane[_index];
+    _centre = glm::vec3(mSphereX[lane], mSphereY[lane], mSphereZ[lane]);
+    _radius = mSphereRadius[lane];
+}
+
+void PrimitiveBatch::GetBox(size_t _index, glm::vec3& _centre, glm::vec3 _halfAxes[3]) const
+{
+    const size_t lane = mBoxLane[_index];
+    _centre = glm::vec3(mBoxX[lane], mBoxY[lane], mBoxZ[lane]);
+    const float half[3] = { mBoxHalfX[lane], mBoxHalfY[lane], mBoxHalfZ[lane] };
+
+    // Rows of localFromWorld are the box axes in world space
+    for (int axis = 0; axis < 3; ++axis)
+        _halfAxes[axis] = glm::vec3(mBoxRot[axis * 3 + 0][lane], mBoxRot[axis * 3 + 1][lane], mBoxRot[axis * 3 + 2][lane]) * half[axis];
+}
+
+void PrimitiveBatch::Clear()
+{
+    mSphereX.clear(); mSphereY.clear(); mSphereZ.clear(); mSphereRadius.clear();
+    mSphereMaterial.clear(); mSphereIndex.clear(); mSphereLane.clear();
+    mSphereNodes.clear();
+    mSphereCount = 0;
+
+    mBoxX.clear(); mBoxY.clear(); mBoxZ.clear();
+    for (auto& row : mBoxRot) row.clear();
+    mBoxHalfX.clear(); mBoxHalfY.clear(); mBoxHalfZ.clear();
+    mBoxMaterial.clear(); mBoxIndex.clear(); mBoxLane.clear();
+    mBoxNodes.clear();
+    mBoxCount = 0;
+
+    mMaterials.clear();
+}
+
+// Moves the lane _order[k] to lane k; lanes past the end of _order keep their padding
+template <typename T>
+static void PermuteLanes(std::vector<T>& _array, const std::vector<uint32_t>& _order)
+{
+    std::vector<T> out(_array);
+    for (size_t k = 0; k < _order.size(); ++k)
+        out[k] = _array[_order[k]];
+    _array.swap(out);
+}
+
+void PrimitiveBatch::Build()
+{
+    std::vector<glm::vec3> bmin(mSphereCount), bmax(mSphereCount);
+    for (size_t lane = 0; lane < mSphereCount; ++lane)
+    {
+        const glm::vec3 centre(mSphereX[lane], mSphereY[lane], mSphereZ[lane]);
+        bmin[lane] = centre - glm::vec3(mSphereRadius[lane]);
+        bmax[lane] = centre + glm::vec3(mSphereRadius[lane]);
+    }
+
+    std::vector<uint32_t> order;
+    mSphereNodes = BuildGroups(order, bmin, bmax);
+    for (auto* array : { &mSphereX, &mSphereY, &mSphereZ, &mSphereRadius })
+        PermuteLanes(*array, order);
+    PermuteLanes(mSphereIndex, order);
+    for (size_t lane = 0; lane < mSphereCount; ++lane)
+        mSphereLane[mSphereIndex[lane]] = uint32_t(lane);
+
+    bmin.resize(mBoxCount);
+    bmax.resize(mBoxCount);
+    for (size_t i = 0; i < mBoxCount; ++i)
+    {
+        glm::vec3 centre, halfAxes[3];
+        GetBox(i, centre, halfAxes);
+        const glm::vec3 extent = glm::abs(halfAxes[0]) + glm::abs(halfAxes[1]) + glm::abs(halfAxes[2]);
+        bmin[mBoxLane[i]] = centre - extent;
+        bmax[mBoxLane[i]] = centre + extent;
+    }
+
+    mBoxNodes = BuildGroups(order, bmin, bmax);
+    for (auto* array : { &mBoxX, &mBoxY, &mBoxZ, &mBoxHalfX, &mBoxHalfY, &mBoxHalfZ })
+        PermuteLanes(*array, order);
+    for (auto& row : mBoxRot)
+        PermuteLanes(row, order);
+    PermuteLanes(mBoxIndex, order);
+    for (size_t lane = 0; lane < mBoxCount; ++lane)
+        mBoxLane[mBoxIndex[lane]] = uint32_t(lane);
+}
+
+std::vector<PrimitiveBatch::BvhNode> PrimitiveBatch::BuildGroups(std::vector<uint32_t>& _order, const std::vector<glm::vec3>& _bmin, const std::vector<glm::vec3>& _bmax)
+{
+    const uint32_t count = uint32_t(_bmin.size());
+    _order.resize(count);
+    std::iota(_order.begin(), _order.end(), 0u);
+
+    std::vector<BvhNode> nodes;
+    if (count == 0)
+        return nodes;
+    nodes.reserve(2 * ((count + kLanes - 1) / kLanes));
+
+    // Median splits on whole groups, so every group but the last is full and each leaf is exactly one group
+    auto buildNode = [&](auto& _self, uint32_t _start, uint32_t _count) -> uint32_t
+        {
+            const uint32_t nodeIndex = uint32_t(nodes.size());
+            nodes.push_back(BvhNode{});
+
+            glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+            glm::vec3 cmin = bmin, cmax = bmax;
+            for (uint32_t i = _start; i < _start + _count; ++i)
+            {
+                const uint32_t lane = _order[i];
+                bmin = glm::min(bmin, _bmin[lane]);
+                bmax = glm::max(bmax, _bmax[lane]);
+                const glm::vec3 centroid = (_bmin[lane] + _bmax[lane]) * 0.5f;
+                cmin = glm::min(cmin, centroid);
+                cmax = glm::max(cmax, centroid);
+            }
+            nodes[nodeIndex].bmin = bmin;
+            nodes[nodeIndex].bmax = bmax;
+
+            if (_count <= uint32_t(kLanes))
+            {
+                nodes[nodeIndex].leftFirst = _start / kLanes;
+                nodes[nodeIndex].rightChild = 0;
+                nodes[nodeIndex].count = 1; // LEAF
+                return nodeIndex;
+            }
+
+            // Split along the widest spread of centres
+            const glm::vec3 extent = cmax - cmin;
+            const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+            const uint32_t leftCount = (_count / 2 + kLanes - 1) / kLanes * kLanes;
+            std::nth_element(_order.begin() + _start, _order.begin() + _start + leftCount, _order.begin() + _start + _count,
+                [&](uint32_t _a, uint32_t _b) { return _bmin[_a][axis] + _bmax[_a][axis] < _bmin[_b][axis] + _bmax[_b][axis]; });
+
+            const uint32_t left = _self(_self, _start, leftCount);
+            const uint32_t right = _self(_self, _start + leftCount, _count - leftCount);
+            nodes[nodeIndex].leftFirst = left;
+            nodes[nodeIndex].rightChild = right;
+            nodes[nodeIndex].count = 0; // INNER
+            return nodeIndex;
+        };
+    buildNode(buildNode, 0, count);
+    return nodes;
+}
+
+bool PrimitiveBatch::RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out)
+{
+    return Intersect(_ray, _tMin, _tMax, _out);
+}
+
+// Slab test against a node's bounds; _tEntry is where the ray enters them
+static inline bool RayAabb(const glm::vec3& _origin, const glm::vec3& _invD, const glm::vec3& _bmin, const glm::vec3& _bmax, float _tMin, float _tMax, float& _tEntry)
+{
+    const glm::vec3 t1 = (_bmin - _origin) * _invD;
+    const glm::vec3 t2 = (_bmax - _origin) * _invD;
+    const glm::vec3 tNear = glm::min(t1, t2);
+    const glm::vec3 tFar = glm::max(t1, t2);
+    _tEntry = std::max(tNear.x, std::max(tNear.y, tNear.z));
+    const float tExit = std::min(tFar.x, std::min(tFar.y, tFar.z));
+    return tExit >= std::max(_tEntry, _tMin) && _tEntry <= _tMax;
+}
+
+template <typename TestGroup>
+bool PrimitiveBatch::TraverseGroups(const std::vector<BvhNode>& _nodes, size_t _count, const Ray& _ray, float _tMin, float& _closest, bool _anyHit, TestGroup&& _testGroup) const
+{
+    bool hit = false;
+    if (_nodes.empty())
+    {
+        for (size_t group = 0; group * kLanes < _count; ++group)
+        {
+            if (!_testGroup(group, _closest)) continue;
+            hit = true;
+            if (_anyHit) return true;
+        }
+        return hit;
+    }
+
+    const glm::vec3 invD(
+        _ray.direction.x != 0.0f ? 1.0f / _ray.direction.x : 1e30f,
+        _ray.direction.y != 0.0f ? 1.0f / _ray.direction.y : 1e30f,
+        _ray.direction.z != 0.0f ? 1.0f / _ray.direction.z : 1e30f);
+
+    uint32_t stack[64];
+    int sp = 0;
+    stack[sp++] = 0u; // root
+
+    while (sp)
+    {
+        const BvhNode& node = _nodes[stack[--sp]];
+        float tEntry;
+        if (!RayAabb(_ray.origin, invD, node.bmin, node.bmax, _tMin, _closest, tEntry)) continue;
+
+        if (node.count > 0) // leaf
+        {
+            if (!_testGroup(node.leftFirst, _closest)) continue;
+            hit = true;
+            if (_anyHit) return true; // Shadow rays only need to know something is in the way
+            continue;
+        }
+
+        // Inner: visit the nearer child first so it can shorten the other's range
+        const BvhNode& left = _nodes[node.leftFirst];
+        const BvhNode& right = _nodes[node.rightChild];
+        float lt, rt;
+        const bool hitL = RayAabb(_ray.origin, invD, left.bmin, left.bmax, _tMin, _closest, lt);
+        const bool hitR = RayAabb(_ray.origin, invD, right.bmin, right.bmax, _tMin, _closest, rt);
+
+        if (hitL && hitR)
+        {
+            if (lt < rt) { stack[sp++] = node.rightChild; stack[sp++] = node.leftFirst; }
+            else { stack[sp++] = node.leftFirst; stack[sp++] = node.rightChild; }
+        }
+        else if (hitL) { stack[sp++] = node.leftFirst; }
+        else if (hitR) { stack[sp++] = node.rightChild; }
+    }
+    return hit;
+}
+
+bool PrimitiveBatch::Intersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) const
+{
+    float closest = _tMax;
+    int bestSphere = -1;
+    int bestBox = -1;
+
+    TraverseGroups(mSphereNodes, mSphereCount, _ray, _tMin, closest, false,
+        [&](size_t _group, float& _closest) { return IntersectSphereGroup(_group, _ray, _tMin, _closest, bestSphere); });
+    // Only accepts boxes closer than the best sphere
+    TraverseGroups(mBoxNodes, mBoxCount, _ray, _tMin, closest, false,
+        [&](size_t _group, float& _closest) { return IntersectBoxGroup(_group, _ray, _tMin, _closest, bestBox); });
+
+    if (bestBox >= 0)
+    {
+        _out.t = closest;
+        _out.primitive = kBoxBit | mBoxIndex[bestBox];
+        return true;
+    }
+    if (bestSphere >= 0)
+    {
+        _out.t = closest;
+        _out.primitive = mSphereIndex[bestSphere];
+        return true;
+    }
+    return false;
+}
+
+bool PrimitiveBatch::Occluded(const Ray& _ray, float _tMin, float _tMax) const
+{
+    float closest = _tMax;
+    int best = -1;
+
+    if (TraverseGroups(mSphereNodes, mSphereCount, _ray, _tMin, closest, true,
+        [&](size_t _group, float& _closest) { return IntersectSphereGroup(_group, _ray, _tMin, _closest, best); }))
+        return true;
+    return TraverseGroups(mBoxNodes, mBoxCount, _ray, _tMin, closest, true,
+        [&](size_t _group, float& _closest) { return IntersectBoxGroup(_group, _ray, _tMin, _closest, best); });
+}
+
+bool PrimitiveBatch::IntersectSphereGroup(size_t _group, const Ray& _ray, float _tMin, float& _closest, int& _best) const
+{
+    const float a = glm::dot(_ray.direction, _ray.direction);
+    const float invA = 1.0f / a;
+    const size_t i = _group * kLanes;
+
+#if defined(__AVX__)
+    const __m256 ox = _mm256_set1_ps(_ray.origin.x), oy = _mm256_set1_ps(_ray.origin.y), oz = _mm256_set1_ps(_ray.origin.z);
+    const __m256 dx = _mm256_set1_ps(_ray.direction.x), dy = _mm256_set1_ps(_ray.direction.y), dz = _mm256_set1_ps(_ray.direction.z);
+    const __m256 va = _mm256_set1_ps(a), vInvA = _mm256_set1_ps(invA);
+    const __m256 tMin = _mm256_set1_ps(_tMin);
+    const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256 zero = _mm256_setzero_ps();
+
+    // Quadratic |oc + t*d|^2 = r^2 with half-b, same as Sphere::RayIntersect
+    const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&mSphereX[i]));
+    const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&mSphereY[i]));
+    const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&mSphereZ[i]));
+    const __m256 r = _mm256_loadu_ps(&mSphereRadius[i]);
+
+    const __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+    const __m256 c = _mm256_sub_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+        _mm256_mul_ps(r, r));
+    const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(va, c));
+    const __m256 hasRoots = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+    if (_mm256_movemask_ps(hasRoots) == 0) return false;
+
+    const __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+    const __m256 closest = _mm256_set1_ps(_closest);
+    const __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, h), sq), vInvA);
+    const __m256 tFar = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, h), sq), vInvA);
+
+    // Nearest root in range, else the far root
+    const __m256 nearOk = _mm256_and_ps(_mm256_cmp_ps(tNear, tMin, _CMP_GE_OQ), _mm256_cmp_ps(tNear, closest, _CMP_LE_OQ));
+    const __m256 farOk = _mm256_and_ps(_mm256_cmp_ps(tFar, tMin, _CMP_GE_OQ), _mm256_cmp_ps(tFar, closest, _CMP_LE_OQ));
+    const __m256 t = _mm256_blendv_ps(tFar, tNear, nearOk);
+    const __m256 hitMask = _mm256_and_ps(hasRoots, _mm256_or_ps(nearOk, farOk));
+    if (_mm256_movemask_ps(hitMask) == 0) return false;
+
+    // Horizontal min over the hitting lanes
+    const __m256 tHits = _mm256_blendv_ps(inf, t, hitMask);
+    __m256 m = _mm256_min_ps(tHits, _mm256_permute2f128_ps(tHits, tHits, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    const int lane = std::countr_zero(uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tHits, m, _CMP_EQ_OQ))));
+    _closest = _mm256_cvtss_f32(m);
+    _best = int(i) + lane;
+    return true;
+#else
+    bool hit = false;
+    const size_t end = std::min(i + kLanes, mSphereCount); // Padding lanes would pass the tests below as NaN
+    for (size_t lane = i; lane < end; ++lane)
+    {
+        const glm::vec3 oc = _ray.origin - glm::vec3(mSphereX[lane], mSphereY[lane], mSphereZ[lane]);
+        const float h = glm::dot(oc, _ray.direction);
+        const float c = glm::dot(oc, oc) - mSphereRadius[lane] * mSphereRadius[lane];
+        const float disc = h * h - a * c;
+        if (disc < 0.0f) continue;
+
+        const float sq = std::sqrt(disc);
+        float t = (-h - sq) * invA;
+        if (t < _tMin || t > _closest)
+        {
+            t = (-h + sq) * invA;
+            if (t < _tMin || t > _closest) continue;
+        }
+        _closest = t;
+        _best = int(lane);
+        hit = true;
+    }
+    return hit;
+#endif
+}
+
+bool PrimitiveBatch::IntersectBoxGroup(size_t _group, const Ray& _ray, float _tMin, float& _closest, int& _best) const
+{
+    const size_t i = _group * kLanes;
+
+#if defined(__AVX__)
+    const __m256 ox = _mm256_set1_ps(_ray.origin.x), oy = _mm256_set1_ps(_ray.origin.y), oz = _mm256_set1_ps(_ray.origin.z);
+    const __m256 dx = _mm256_set1_ps(_ray.direction.x), dy = _mm256_set1_ps(_ray.direction.y), dz = _mm256_set1_ps(_ray.direction.z);
+    const __m256 tMin = _mm256_set1_ps(_tMin);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 big = _mm256_set1_ps(1e30f);
+    const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+
+    auto row = [&](int _r, __m256 _x, __m256 _y, __m256 _z) {
+        return _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_loadu_ps(&mBoxRot[_r * 3 + 0][i]), _x),
+            _mm256_mul_ps(_mm256_loadu_ps(&mBoxRot[_r * 3 + 1][i]), _y)),
+            _mm256_mul_ps(_mm256_loadu_ps(&mBoxRot[_r * 3 + 2][i]), _z));
+        };
+
+    // Ray into each box's local frame
+    const __m256 px = _mm256_sub_ps(ox, _mm256_loadu_ps(&mBoxX[i]));
+    const __m256 py = _mm256_sub_ps(oy, _mm256_loadu_ps(&mBoxY[i]));
+    const __m256 pz = _mm256_sub_ps(oz, _mm256_loadu_ps(&mBoxZ[i]));
+
+    __m256 tEntry = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    __m256 tExit = inf;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const __m256 ro = row(axis, px, py, pz);
+        const __m256 rd = row(axis, dx, dy, dz);
+        const __m256 half = _mm256_loadu_ps(axis == 0 ? &mBoxHalfX[i] : (axis == 1 ? &mBoxHalfY[i] : &mBoxHalfZ[i]));
+
+        // Same large stand-in as IntersectBox where the ray runs parallel to the slab, so a ray on a face gives 0 not NaN
+        const __m256 invD = _mm256_blendv_ps(_mm256_div_ps(one, rd), big, _mm256_cmp_ps(rd, zero, _CMP_EQ_OQ));
+        const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, half), ro), invD);
+        const __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(half, ro), invD);
+        tEntry = _mm256_max_ps(tEntry, _mm256_min_ps(t1, t2));
+        tExit = _mm256_min_ps(tExit, _mm256_max_ps(t1, t2));
+    }
+
+    // Entry if in range, else exit (ray starts inside)
+    const __m256 closest = _mm256_set1_ps(_closest);
+    const __m256 overlap = _mm256_and_ps(_mm256_cmp_ps(tExit, tEntry, _CMP_GE_OQ), _mm256_cmp_ps(tExit, tMin, _CMP_GE_OQ));
+    const __m256 t = _mm256_blendv_ps(tExit, tEntry, _mm256_cmp_ps(tEntry, tMin, _CMP_GE_OQ));
+    const __m256 hitMask = _mm256_and_ps(overlap, _mm256_cmp_ps(t, closest, _CMP_LE_OQ));
+    if (_mm256_movemask_ps(hitMask) == 0) return false;
+
+    const __m256 tHits = _mm256_blendv_ps(inf, t, hitMask);
+    __m256 m = _mm256_min_ps(tHits, _mm256_permute2f128_ps(tHits, tHits, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    const int lane = std::countr_zero(uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tHits, m, _CMP_EQ_OQ))));
+    _closest = _mm256_cvtss_f32(m);
+    _best = int(i) + lane;
+    return true;
+#else
+    bool hit = false;
+    const size_t end = std::min(i + kLanes, mBoxCount);
+    for (size_t lane = i; lane < end; ++lane)
+    {
+        float t;
+        if (IntersectBox(lane, _ray, _tMin, _closest, t))
+        {
+            _closest = t;
+            _best = int(lane);
+            hit = true;
+        }
+    }
+    return hit;
+#endif
+}
+
+bool PrimitiveBatch::IntersectBox(size_t _lane, const Ray& _ray, float _tMin, float _tMax, float& _t) const
+{
+    const size_t i = _lane;
+    const glm::vec3 p = _ray.origin - glm::vec3(mBoxX[i], mBoxY[i], mBoxZ[i]);
+    const glm::vec3 half(mBoxHalfX[i], mBoxHalfY[i], mBoxHalfZ[i]);
+
+    float tEntry = -std::numeric_limits<float>::infinity();
+    float tExit = std::numeric_limits<float>::infinity();
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const glm::vec3 rotRow(mBoxRot[axis * 3 + 0][i], mBoxRot[axis * 3 + 1][i], mBoxRot[axis * 3 + 2][i]);
+        const float ro = glm::dot(rotRow, p);
+        const float rd = glm::dot(rotRow, _ray.direction);
+
+        // Handle near-zeros in direction by using large numbers for invDir
+        const float invD = rd != 0.0f ? 1.0f / rd : 1e30f;
+        const float t1 = (-half[axis] - ro) * invD;
+        const float t2 = (half[axis] - ro) * invD;
+
+        tEntry = std::max(tEntry, std::min(t1, t2));
+        tExit = std::min(tExit, std::max(t1, t2));
+    }
+
+    if (tExit < tEntry || tExit < _tMin) return false;
+
+    _t = (tEntry >= _tMin) ? tEntry : tExit; // start inside box -> exit is first valid
+    return _t <= _tMax;
+}
+
+uint32_t PrimitiveBatch::GetBoxFace(const Ray& _ray, const Hit& _hit) const
+{
+    const size_t i = mBoxLane[_hit.primitive & ~kBoxBit];
+    const glm::vec3 p = _ray.origin - glm::vec3(mBoxX[i], mBoxY[i], mBoxZ[i]);
+    const glm::vec3 half(mBoxHalfX[i], mBoxHalfY[i], mBoxHalfZ[i]);
+
+    // The slabs as Box::RayIntersect sees them, so the same face wins
+    glm::vec3 rdLocal, tMin3, tMax3;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const glm::vec3 rotRow(mBoxRot[axis * 3 + 0][i], mBoxRot[axis * 3 + 1][i], mBoxRot[axis * 3 + 2][i]);
+        const float ro = glm::dot(rotRow, p);
+        const float rd = glm::dot(rotRow, _ray.direction);
+        const float invD = rd != 0.0f ? 1.0f / rd : (rd > 0.0f ? 1e30f : -1e30f);
+        const float t1 = (-half[axis] - ro) * invD;
+        const float t2 = (half[axis] - ro) * invD;
+        rdLocal[axis] = rd;
+        tMin3[axis] = std::min(t1, t2);
+        tMax3[axis] = std::max(t1, t2);
+    }
+    const float tEntry = std::max(tMin3.x, std::max(tMin3.y, tMin3.z));
+    const float tExit = std::min(tMax3.x, std::min(tMax3.y, tMax3.z));
+
+    int axis;
+    float outwardSign;
+    if (std::abs(_hit.t - tEntry) <= std::abs(_hit.t - tExit))
+    {
+        // Entering: the slab that entered last, its face looks back against the ray
+        axis = (tMin3.x >= tMin3.y && tMin3.x >= tMin3.z) ? 0 : (tMin3.y >= tMin3.z ? 1 : 2);
+        outwardSign = rdLocal[axis] > 0.0f ? -1.0f : 1.0f;
+    }
+    else
+    {
+        // Exiting from inside: the slab that exited first, its face looks along the ray
+        axis = (tMax3.x <= tMax3.y && tMax3.x <= tMax3.z) ? 0 : (tMax3.y <= tMax3.z ? 1 : 2);
+        outwardSign = rdLocal[axis] > 0.0f ? 1.0f : -1.0f;
+    }
+    return uint32_t(axis * 2 + (outwardSign < 0.0f ? 1 : 0));
+}
+
+void PrimitiveBatch::ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const
+{
+    _out.p = _ray.origin + _hit.t * _ray.direction;
+
+    glm::vec3 outward;
+    uint32_t material;
+
+    if (_hit.primitive & kBoxBit)
+    {
+        const uint32_t b = _hit.primitive & ~kBoxBit;
+        const size_t lane = mBoxLane[b];
+
+        // Outward normal of the face Box would report for this hit
+        const uint32_t face = GetBoxFace(_ray, _hit);
+        glm::vec3 nLocal(0.0f);
+        nLocal[face / 2] = (face & 1u) ? -1.0f : 1.0f;
+
+        // localFromWorld is a rotation, so worldFromLocal * n is its transpose applied to n
+        outward = glm::vec3(
+            mBoxRot[0][lane] * nLocal.x + mBoxRot[3][lane] * nLocal.y + mBoxRot[6][lane] * nLocal.z,
+            mBoxRot[1][lane] * nLocal.x + mBoxRot[4][lane] * nLocal.y + mBoxRot[7][lane] * nLocal.z,
+            mBoxRot[2][lane] * nLocal.x + mBoxRot[5][lane] * nLocal.y + mBoxRot[8][lane] * nLocal.z);
+        outward = glm::normalize(outward);
+        material = mBoxMaterial[b];
+    }
+    else
+    {
+        const uint32_t s = _hit.primitive;
+        const size_t lane = mSphereLane[s];
+        outward = (_out.p - glm::vec3(mSphereX[lane], mSphereY[lane], mSphereZ[lane])) / mSphereRadius[lane];
+        material = mSphereMaterial[s];
+    }
+
+    // Face-forward the shading normal and record which side we hit
+    _out.frontFace = glm::dot(_ray.direction, outward) < 0.0f;
+    _out.n = _out.frontFace ? outward : -outward;
+    _out.mat = mMaterials[material];
+}
+
+bool PrimitiveBatch::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode(mName.c_str()))
+    {
+        ImGui::Text("%zu spheres, %zu boxes", mSphereCount, mBoxCount);
+
+        for (int i = 0; i < (int)mMaterials.size(); i++)
+        {
+            ImGui::PushID(i);
+            if (ImGui::TreeNode("Material", "Material %i", i))
+            {
+                Material& mat = mMaterials[i];
+                changed |= ImGui::ColorEdit3("Albedo", &mat.albedo.r);
+                changed |= ImGui::SliderFloat("Roughness", &mat.roughness, 0.0f, 1.0f);
+                changed |= ImGui::SliderFloat("Metallic", &mat.metallic, 0.0f, 1.0f);
+                changed |= ImGui::ColorEdit3("Emission Colour", &mat.emissionColour.r);
+                changed |= ImGui::SliderFloat("Emission Strength", &mat.emissionStrength, 0.0f, 100.0f);
+                changed |= ImGui::SliderFloat("Index of Refraction", &mat.IOR, 1.0f, 3.0f);
+                changed |= ImGui::SliderFloat("Transmission", &mat.transmission, 0.0f, 1.0f);
+                ImGui::TreePop();
+            }
+            ImGui::PopID();
+        }
+        ImGui::TreePop();
+    }
+    return changed;
+}
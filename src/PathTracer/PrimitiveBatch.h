@@ -0,0 +1,111 @@
+#pragma once
+
+#include "RayObject.h"
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Many spheres and boxes in one object, stored as SoA arrays and intersected kLanes at a time (AVX when built with it).
+// Primitives live in world space and reference a material by index, so large procedural scenes
+// cost one object in the PathTracer loop instead of one shared_ptr and virtual call per primitive.
+// Build sorts them into spatially coherent lane groups under a BVH, so a ray only tests the groups it passes near.
+class PrimitiveBatch : public RayObject
+{
+public:
+	PrimitiveBatch(std::string _name);
+	~PrimitiveBatch() {}
+
+	bool RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) override;
+	bool Intersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) const;
+	// Any hit in (_tMin, _tMax), stopping at the first lane group that has one
+	bool Occluded(const Ray& _ray, float _tMin, float _tMax) const;
+	void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const override;
+
+	bool UpdateUI() override;
+
+	// Returns the index to pass to AddSphere/AddBox
+	uint32_t AddMaterial(const Material& _material);
+
+	uint32_t AddSphere(const glm::vec3& _centre, float _radius, uint32_t _materialIndex);
+	// _rotation is Euler degrees (same convention as Box)
+	uint32_t AddBox(const glm::vec3& _centre, const glm::vec3& _rotation, const glm::vec3& _size, uint32_t _materialIndex);
+
+	// Copies every primitive and material of _other into this batch (material indices are remapped)
+	void Append(const PrimitiveBatch& _other);
+
+	void Clear();
+
+	// Regroups the primitives by position and builds the BVH over their lane groups; call after the last
+	// Add/Append. Primitive indices are kept. Until then every group is tested
+	void Build();
+
+	size_t GetSphereCount() const { return mSphereCount; }
+	size_t GetBoxCount() const { return mBoxCount; }
+
+	std::vector<Material>& GetMaterials() { return mMaterials; }
+	const Material& GetPrimitiveMaterial(uint32_t _primitive) const;
+	uint32_t GetPrimitiveMaterialIndex(uint32_t _primitive) const { return (_primitive & kBoxBit) ? mBoxMaterial[_primitive & ~kBoxBit] : mSphereMaterial[_primitive]; }
+	size_t GetMaterialCount() const { return mMaterials.size(); }
+
+	// World-space geometry, e.g. for building light sources
+	void GetSphere(size_t _index, glm::vec3& _centre, float& _radius) const;
+	// _halfAxes are the box's world axes scaled by its half extents
+	void GetBox(size_t _index, glm::vec3& _centre, glm::vec3 _halfAxes[3]) const;
+	// Face of a box hit, numbered as Box does: axis * 2, plus 1 for the face on the negative side
+	uint32_t GetBoxFace(const Ray& _ray, const Hit& _hit) const;
+
+	static constexpr int kLanes = 8; // Primitives per SIMD step, arrays are padded to a multiple of this
+
+	// Hit.primitive: index of the sphere, or kBoxBit | index of the box
+	static constexpr uint32_t kBoxBit = 0x80000000u;
+
+private:
+	// BVH over lane groups (flattened, index-based); a leaf is one group of kLanes primitives
+	struct BvhNode
+	{
+		glm::vec3 bmin; // Node AABB
+		glm::vec3 bmax;
+		uint32_t leftFirst; // Inner: index of left child; leaf: lane group
+		uint32_t rightChild;
+		uint32_t count; // Inner: 0; leaf: 1
+	};
+
+	uint32_t PushBox(const glm::vec3& _centre, const float _localFromWorld[9], const glm::vec3& _half, uint32_t _materialIndex);
+
+	// Scalar slab test for one box lane (non-AVX fallback)
+	bool IntersectBox(size_t _lane, const Ray& _ray, float _tMin, float _tMax, float& _t) const;
+
+	// Closest hit among the kLanes primitives of a group that is nearer than _closest; _best is the lane
+	bool IntersectSphereGroup(size_t _group, const Ray& _ray, float _tMin, float& _closest, int& _best) const;
+	bool IntersectBoxGroup(size_t _group, const Ray& _ray, float _tMin, float& _closest, int& _best) const;
+
+	// Calls _testGroup(group, closest) on the groups whose bounds the ray enters before _closest,
+	// or on every group when _nodes is empty; returns whether any test hit
+	template <typename TestGroup>
+	bool TraverseGroups(const std::vector<BvhNode>& _nodes, size_t _count, const Ray& _ray, float _tMin, float& _closest, bool _anyHit, TestGroup&& _testGroup) const;
+
+	// Orders _order (lanes) so that each run of kLanes is spatially coherent and returns the BVH over those runs
+	static std::vector<BvhNode> BuildGroups(std::vector<uint32_t>& _order, const std::vector<glm::vec3>& _bmin, const std::vector<glm::vec3>& _bmax);
+
+	// Spheres (SoA, in lane order)
+	std::vector<float> mSphereX, mSphereY, mSphereZ, mSphereRadius;
+	std::vector<uint32_t> mSphereMaterial; // By sphere index
+	std::vector<uint32_t> mSphereIndex; // Sphere index in each lane
+	std::vector<uint32_t> mSphereLane; // Lane of each sphere index
+	std::vector<BvhNode> mSphereNodes; // Empty until Build
+	size_t mSphereCount = 0;
+
+	// Boxes (SoA, in lane order): centre, localFromWorld rotation (row-major, 9 arrays) and half extents
+	std::vector<float> mBoxX, mBoxY, mBoxZ;
+	std::vector<float> mBoxRot[9];
+	std::vector<float> mBoxHalfX, mBoxHalfY, mBoxHalfZ;
+	std::vector<uint32_t> mBoxMaterial; // By box index
+	std::vector<uint32_t> mBoxIndex; // Box index in each lane
+	std::vector<uint32_t> mBoxLane; // Lane of each box index
+	std::vector<BvhNode> mBoxNodes;
+	size_t mBoxCount = 0;
+
+	std::vector<Material> mMaterials;
+};
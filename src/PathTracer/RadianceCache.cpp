@@ -0,0 +1,158 @@
+#include "RadianceCache.h"
+#include "MathUtil.h"
+#include "Film.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr int kMaxProbes = 16;
+static constexpr int kCoordinateBits = 20;
+
+// 64-bit finaliser of SplitMix64
+static inline uint64_t Mix(uint64_t _x)
+{
+    _x ^= _x >> 30;
+    _x *= 0xbf58476d1ce4e5b9ull;
+    _x ^= _x >> 27;
+    _x *= 0x94d049bb133111ebull;
+    _x ^= _x >> 31;
+    return _x;
+}
+
+RadianceCache::RadianceCache()
+{
+    Reset(glm::vec3(-1.0f), glm::vec3(1.0f));
+}
+
+void RadianceCache::Reset(const glm::vec3& _min, const glm::vec3& _max)
+{
+    mMin = _min;
+    mMax = _max;
+    mCellSize = std::max(glm::length(_max - _min) * mRelativeCellSize, 1e-6f);
+    mCells = std::vector<Cell>(size_t(1) << mTableBits);
+    mUsedCells = 0;
+}
+
+uint64_t RadianceCache::Key(const glm::vec3& _p, const glm::vec3& _n) const
+{
+    // Cell coordinates from the scene's corner, then the normal's dominant axis and its sign
+    const glm::vec3 q = glm::floor((_p - mMin) / mCellSize);
+    const glm::vec3 a = glm::abs(_n);
+    const int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+
+    const float maxCoordinate = float((1 << kCoordinateBits) - 1);
+    uint64_t key = 0;
+    for (int i = 0; i < 3; ++i)
+        key = (key << kCoordinateBits) | uint64_t(glm::clamp(q[i], 0.0f, maxCoordinate));
+    key = (key << 3) | uint64_t(axis * 2 + (_n[axis] < 0.0f ? 1 : 0));
+    return key + 1; // Never 0, which marks an empty slot
+}
+
+RadianceCache::Cell* RadianceCache::FindOrInsert(uint64_t _key)
+{
+    const size_t mask = mCells.size() - 1;
+    size_t slot = size_t(Mix(_key)) & mask;
+    for (int i = 0; i < kMaxProbes; ++i, slot = (slot + 1) & mask)
+    {
+        uint64_t existing = mCells[slot].key.load(std::memory_order_relaxed);
+        if (existing == 0 && mCells[slot].key.compare_exchange_strong(existing, _key, std::memory_order_relaxed))
+            return &mCells[slot];
+        // Either already there, or another thread just claimed the slot (possibly for this key)
+        if (existing == _key)
+            return &mCells[slot];
+    }
+    return nullptr;
+}
+
+const RadianceCache::Cell* RadianceCache::Find(uint64_t _key) const
+{
+    const size_t mask = mCells.size() - 1;
+    size_t slot = size_t(Mix(_key)) & mask;
+    for (int i = 0; i < kMaxProbes; ++i, slot = (slot + 1) & mask)
+    {
+        const uint64_t existing = mCells[slot].key.load(std::memory_order_relaxed);
+        if (existing == _key)
+            return &mCells[slot];
+        if (existing == 0)
+            return nullptr;
+    }
+    return nullptr;
+}
+
+void RadianceCache::Record(const glm::vec3& _p, const glm::vec3& _n, const glm::vec3& _value)
+{
+    Cell* cell = FindOrInsert(Key(_p, _n));
+    if (!cell)
+        return;
+
+    glm::vec3 value = _value;
+    const float lum = Luminance(value);
+    if (!(lum >= 0.0f))
+        return; // NaN
+    if (lum > Film::kMaxSampleLuminance)
+        value *= Film::kMaxSampleLuminance / lum;
+
+    for (int c = 0; c < 3; ++c)
+        cell->pending[c].fetch_add(value[c], std::memory_order_relaxed);
+    cell->pendingCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool RadianceCache::Lookup(const glm::vec3& _p, const glm::vec3& _n, glm::vec3& _value) const
+{
+    const Cell* cell = Find(Key(_p, _n));
+    if (!cell || cell->samples < uint32_t(mMinSamples))
+        return false;
+    _value = cell->value;
+    return true;
+}
+
+void RadianceCache::EndFrame()
+{
+    // A running mean until the cell has mHistory samples, then an exponential average over about that many
+    mUsedCells = 0;
+    for (Cell& cell : mCells)
+    {
+        if (cell.key.load(std::memory_order_relaxed) == 0)
+            continue;
+        ++mUsedCells;
+
+        const uint32_t count = cell.pendingCount.load(std::memory_order_relaxed);
+        if (count == 0)
+            continue;
+
+        const glm::vec3 mean = glm::vec3(cell.pending[0].load(std::memory_order_relaxed),
+                                         cell.pending[1].load(std::memory_order_relaxed),
+                                         cell.pending[2].load(std::memory_order_relaxed)) / float(count);
+        cell.samples += count;
+        const float weight = std::min(1.0f, float(count) / float(std::min(cell.samples, uint32_t(mHistory))));
+        cell.value += (mean - cell.value) * weight;
+
+        for (int c = 0; c < 3; ++c)
+            cell.pending[c].store(0.0f, std::memory_order_relaxed);
+        cell.pendingCount.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool RadianceCache::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Radiance cache"))
+    {
+        ImGui::Text("%zu of %zu cells used, %.1f MB", mUsedCells, mCells.size(), float(mCells.size() * sizeof(Cell)) / float(1 << 20));
+        changed |= ImGui::SliderInt("Lookup bounce", &mLookupBounce, 1, 4);
+        ImGui::SliderInt("Min samples", &mMinSamples, 1, 64);
+        ImGui::SliderInt("History", &mHistory, 16, 4096, "%d", ImGuiSliderFlags_Logarithmic);
+
+        // These change what a key means, so the cache starts again
+        bool restart = ImGui::SliderFloat("Cell size", &mRelativeCellSize, 0.001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+        restart |= ImGui::SliderInt("Table size (log2)", &mTableBits, 14, 24);
+        restart |= ImGui::Button("Clear cache");
+        if (restart)
+            Reset(mMin, mMax);
+        changed |= restart;
+        ImGui::TreePop();
+    }
+    return changed;
+}
\ No newline at end of file
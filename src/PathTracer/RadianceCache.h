@@ -0,0 +1,66 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// World-space cache of the light leaving diffuse surfaces, for a quick preview of indirect lighting.
+// Positions are hashed into a grid of cells, split by the normal's dominant axis so a floor and the wall beside it
+// stay apart, held in a fixed-size table with open addressing. Paths record what each vertex sends back along them
+// over the surface's albedo, so texture is applied at the lookup instead of being blurred with the lighting
+// (path space filtering, Binder et al. 2018). Paths can then stop after a bounce or two and take the rest from
+// the cache; as those paths feed it too, each update carries the light one bounce further.
+class RadianceCache
+{
+public:
+	RadianceCache();
+
+	// Drops every entry; cells are sized relative to the box _min, _max
+	void Reset(const glm::vec3& _min, const glm::vec3& _max);
+
+	// Thread safe: adds one sample of the light leaving _p (unit normal _n) over the surface's albedo
+	void Record(const glm::vec3& _p, const glm::vec3& _n, const glm::vec3& _value);
+	// Cached light at _p over albedo; false until its cell has enough samples
+	bool Lookup(const glm::vec3& _p, const glm::vec3& _n, glm::vec3& _value) const;
+
+	// Call between frames from one thread: blends the frame's samples into the values Lookup returns
+	void EndFrame();
+
+	// Paths look the cache up from this bounce on (0 is the camera ray's hit)
+	int GetLookupBounce() const { return mLookupBounce; }
+	size_t GetUsedCells() const { return mUsedCells; }
+
+	// True if the cache was cleared or a setting changed
+	bool UpdateUI();
+
+private:
+	struct Cell
+	{
+		std::atomic<uint64_t> key{ 0 }; // 0 for an empty slot
+		glm::vec3 value{ 0.0f };
+		uint32_t samples = 0;
+
+		// This frame's samples, blended in by EndFrame
+		std::atomic<float> pending[3] = { 0.0f, 0.0f, 0.0f };
+		std::atomic<uint32_t> pendingCount{ 0 };
+	};
+
+	uint64_t Key(const glm::vec3& _p, const glm::vec3& _n) const;
+	// Slot holding _key, claiming an empty one for it if new; nullptr if the probe limit is reached first
+	Cell* FindOrInsert(uint64_t _key);
+	const Cell* Find(uint64_t _key) const;
+
+	glm::vec3 mMin{ -1.0f };
+	glm::vec3 mMax{ 1.0f };
+	float mCellSize = 0.01f;
+	std::vector<Cell> mCells;
+	size_t mUsedCells = 0;
+
+	int mLookupBounce = 1;
+	float mRelativeCellSize = 0.005f; // Of the scene's diagonal
+	int mMinSamples = 8; // Before a cell answers lookups
+	int mHistory = 256; // Samples the running mean keeps at most, so it follows changing light
+	int mTableBits = 18;
+};
\ No newline at end of file
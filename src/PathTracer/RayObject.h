@@ -6,6 +6,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 struct Material
 {
@@ -19,14 +20,23 @@ struct Material
 	float transmission = 0.f;
 };
 
+// Compact record returned by intersection; surface data is only computed for the final closest hit
 struct Hit
 {
-	float t; // Distance along ray (ray(t) = o + t*d)
-	glm::vec3 p; // Hit point
-	glm::vec3 n; // Normal
-	Material* mat;
+	float t = 0.0f; // Distance along ray (ray(t) = o + t*d)
+	int object = -1; // Index of the hit object in the scene, filled in by the PathTracer
+	uint32_t primitive = 0; // Object-defined primitive id (mesh face, ...)
+	glm::vec2 uv{ 0.0f }; // Barycentrics for triangles
+};
+
+// Full shading data at a hit, built once by RayObject::ComputeSurfaceInteraction
+struct SurfaceInteraction
+{
+	glm::vec3 p{ 0.0f }; // Hit point
+	glm::vec3 n{ 0.0f }; // Shading normal, faces against the ray
+	Material mat; // Material evaluated at the hit (owned, not shared between hits)
 
-	bool frontFace;
+	bool frontFace = true;
 };
 
 class RayObject
@@ -36,7 +46,10 @@ public:
 	~RayObject() {}
 
 	// Pure virtual functions for derived classes to implement
+	// Closest hit in (_tMin, _tMax); fills only the compact hit record
 	virtual bool RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) = 0;
+	// Position, normal and material for a hit previously returned by RayIntersect
+	virtual void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const = 0;
 
 	void SetName(const std::string& _name) { mName = _name; }
 	const std::string& GetName() { return mName; }
@@ -50,8 +63,8 @@ public:
 	void SetMaterial(const Material& _material) { mMaterial = _material; }
 	Material GetMaterial() { return mMaterial; }
 
-	// Inhereted classes set up their own UI
-	virtual void UpdateUI() {}
+	// Inhereted classes set up their own UI, returning true if anything was edited
+	virtual bool UpdateUI() { return false; }
 
 protected:
 	std::string mName = "Object";
@@ -0,0 +1,269 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// 32-bit integer hash with good avalanche (Wellons' lowbias32)
+static inline uint32_t Hash(uint32_t _x)
+{
+    _x ^= _x >> 16;
+    _x *= 0x7feb352du;
+    _x ^= _x >> 15;
+    _x *= 0x846ca68bu;
+    _x ^= _x >> 16;
+    return _x;
+}
+
+static inline uint32_t HashCombine(uint32_t _seed, uint32_t _v)
+{
+    return Hash(_seed ^ (_v + 0x9e3779b9u + (_seed << 6) + (_seed >> 2)));
+}
+
+static inline uint32_t ReverseBits(uint32_t _x)
+{
+    _x = (_x << 16) | (_x >> 16);
+    _x = ((_x & 0x00ff00ffu) << 8) | ((_x & 0xff00ff00u) >> 8);
+    _x = ((_x & 0x0f0f0f0fu) << 4) | ((_x & 0xf0f0f0f0u) >> 4);
+    _x = ((_x & 0x33333333u) << 2) | ((_x & 0xccccccccu) >> 2);
+    _x = ((_x & 0x55555555u) << 1) | ((_x & 0xaaaaaaaau) >> 1);
+    return _x;
+}
+
+// Owen scrambling by hashing (Burley, "Practical Hash-based Owen Scrambling", 2020): in bit-reversed order
+// a Laine-Karras style permutation only lets lower bits change higher ones, so each output bit of _x
+// is flipped by a function of the bits above it. Constants are Vegdahl's, which mix the seed in better
+static inline uint32_t LaineKarrasPermutation(uint32_t _x, uint32_t _seed)
+{
+    _x ^= _x * 0x3d20adeau;
+    _x += _seed;
+    _x *= (_seed >> 16) | 1u;
+    _x ^= _x * 0x05526c56u;
+    _x ^= _x * 0x53a22864u;
+    return _x;
+}
+
+static inline uint32_t NestedUniformScramble(uint32_t _x, uint32_t _seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(_x), _seed));
+}
+
+// Second Sobol dimension, from the x + 1 primitive polynomial (the first is the bit-reversed index)
+// The matrix product is linear over XOR, so it is tabulated one index byte at a time
+struct SobolSecondTable
+{
+    uint32_t bytes[4][256];
+
+    SobolSecondTable()
+    {
+        uint32_t v[32];
+        v[0] = 1u << 31;
+        for (int i = 1; i < 32; ++i)
+            v[i] = v[i - 1] ^ (v[i - 1] >> 1);
+
+        for (int b = 0; b < 4; ++b)
+        {
+            for (uint32_t x = 0; x < 256; ++x)
+            {
+                uint32_t result = 0;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    if (x & (1u << bit))
+                        result ^= v[b * 8 + bit];
+                }
+                bytes[b][x] = result;
+            }
+        }
+    }
+};
+
+static const SobolSecondTable g_sobolSecond;
+
+static inline uint32_t SobolSecond(uint32_t _index)
+{
+    return g_sobolSecond.bytes[0][_index & 0xffu] ^ g_sobolSecond.bytes[1][(_index >> 8) & 0xffu]
+        ^ g_sobolSecond.bytes[2][(_index >> 16) & 0xffu] ^ g_sobolSecond.bytes[3][_index >> 24];
+}
+
+static inline float ToFloat(uint32_t _x)
+{
+    return std::min(0x1.fffffep-1f, float(_x) * 0x1p-32f);
+}
+
+// Tileable blue-noise ranks from void-and-cluster (Ulichney 1993), built once on first use
+struct BlueNoiseMask
+{
+    static constexpr int kSize = 64;
+    static constexpr int kCount = kSize * kSize;
+
+    float values[kCount]; // Rank + 0.5 over kCount, so every value in [0,1) appears exactly once
+
+    BlueNoiseMask()
+    {
+        // Toroidal Gaussian energy kernel, indexed by wrapped offset
+        const float sigma = 1.9f;
+        std::vector<float> kernel(kCount);
+        for (int y = 0; y < kSize; ++y)
+        {
+            for (int x = 0; x < kSize; ++x)
+            {
+                const int dx = std::min(x, kSize - x), dy = std::min(y, kSize - y);
+                kernel[y * kSize + x] = std::exp(-float(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+
+        std::vector<uint8_t> bits(kCount, 0);
+        std::vector<float> energy(kCount, 0.0f);
+        auto toggle = [&](int _p, bool _set)
+            {
+                bits[_p] = _set ? 1 : 0;
+                const float sign = _set ? 1.0f : -1.0f;
+                const int px = _p % kSize, py = _p / kSize;
+                for (int y = 0; y < kSize; ++y)
+                {
+                    const float* row = &kernel[((y - py + kSize) % kSize) * kSize];
+                    for (int x = 0; x < kSize; ++x)
+                        energy[y * kSize + x] += sign * row[(x - px + kSize) % kSize];
+                }
+            };
+        // Tightest cluster: the set pixel with most energy; largest void: the empty pixel with least
+        auto extreme = [&](bool _set)
+            {
+                int best = -1;
+                for (int p = 0; p < kCount; ++p)
+                {
+                    if (bits[p] != (_set ? 1 : 0)) continue;
+                    if (best < 0 || (_set ? energy[p] > energy[best] : energy[p] < energy[best]))
+                        best = p;
+                }
+                return best;
+            };
+
+        // Initial pattern: a tenth of the pixels at random, then swapped until clusters stop moving
+        Pcg32 rng;
+        const int initialCount = kCount / 10;
+        for (int placed = 0; placed < initialCount;)
+        {
+            const int p = int(rng.NextUint() % kCount);
+            if (bits[p]) continue;
+            toggle(p, true);
+            ++placed;
+        }
+        for (;;)
+        {
+            const int cluster = extreme(true);
+            toggle(cluster, false);
+            const int gap = extreme(false);
+            toggle(gap, true);
+            if (gap == cluster)
+                break;
+        }
+
+        std::vector<int> rank(kCount, 0);
+        const std::vector<uint8_t> initialBits = bits;
+        const std::vector<float> initialEnergy = energy;
+
+        // Lower ranks: remove the tightest cluster each time
+        for (int r = initialCount - 1; r >= 0; --r)
+        {
+            const int p = extreme(true);
+            toggle(p, false);
+            rank[p] = r;
+        }
+
+        // Upper ranks: fill the largest void each time (with half the pixels set the largest void of the
+        // ones is also the tightest cluster of the zeros, so one rule covers both remaining phases)
+        bits = initialBits;
+        energy = initialEnergy;
+        for (int r = initialCount; r < kCount; ++r)
+        {
+            const int p = extreme(false);
+            toggle(p, true);
+            rank[p] = r;
+        }
+
+        for (int p = 0; p < kCount; ++p)
+            values[p] = (float(rank[p]) + 0.5f) / float(kCount);
+    }
+};
+
+static const BlueNoiseMask& GetBlueNoiseMask()
+{
+    static const BlueNoiseMask mask;
+    return mask;
+}
+
+Sampler::Sampler(Type _type, glm::ivec2 _pixel, uint32_t _sampleIndex, uint32_t _seed)
+{
+    mType = _type;
+    mPixel = _pixel;
+    // Blue noise needs every pixel to run the same point set, only shifted, so its seed ignores the pixel
+    mPixelSeed = (mType == Type::SobolBlueNoise) ? Hash(_seed) : HashCombine(HashCombine(Hash(_seed), uint32_t(_pixel.x)), uint32_t(_pixel.y));
+    mSampleIndex = _sampleIndex;
+
+    if (mType == Type::Random)
+        mRng.Seed(mPixelSeed, uint64_t(_sampleIndex) << 16);
+}
+
+glm::vec2 Sampler::GetPixel2D()
+{
+    mDimension = 0;
+    return Get2D();
+}
+
+void Sampler::StartBounce(int _bounce)
+{
+    mDimension = kPixelDimensions + uint32_t(_bounce) * kBounceDimensions;
+}
+
+float Sampler::BlueNoiseShift(uint32_t _dimension, uint32_t _channel) const
+{
+    // Each channel reads the mask at its own offset along the R2 sequence, so dimensions are not correlated
+    const uint32_t k = _dimension * 2 + _channel + 1;
+    const int size = BlueNoiseMask::kSize;
+    const int ox = int(float(k) * 0.7548776662f * size) % size;
+    const int oy = int(float(k) * 0.5698402910f * size) % size;
+    const int x = (mPixel.x + ox) & (size - 1);
+    const int y = (mPixel.y + oy) & (size - 1);
+    return GetBlueNoiseMask().values[y * size + x];
+}
+
+static inline float WrapShift(float _u, float _shift)
+{
+    const float u = _u + _shift;
+    return std::min(0x1.fffffep-1f, u >= 1.0f ? u - 1.0f : u);
+}
+
+float Sampler::Get1D()
+{
+    if (mType == Type::Random)
+        return mRng.NextFloat();
+
+    // Each dimension gets its own shuffle of the sample order, so dimensions are decorrelated
+    // while each one is still stratified over every power-of-two prefix of samples
+    const uint32_t dimension = mDimension++;
+    const uint32_t seed = HashCombine(mPixelSeed, dimension);
+    const uint32_t index = NestedUniformScramble(mSampleIndex, seed);
+    // The first dimension is the bit-reversed index, so its scramble cancels one pair of reversals
+    const float u = ToFloat(ReverseBits(LaineKarrasPermutation(index, Hash(seed ^ 0x1u))));
+    return (mType == Type::SobolBlueNoise) ? WrapShift(u, BlueNoiseShift(dimension, 0)) : u;
+}
+
+glm::vec2 Sampler::Get2D()
+{
+    if (mType == Type::Random)
+    {
+        const float u = mRng.NextFloat();
+        return glm::vec2(u, mRng.NextFloat());
+    }
+
+    // The first two Sobol dimensions together are a (0,2)-sequence, stratified in 2D as well as 1D
+    const uint32_t dimension = mDimension++;
+    const uint32_t seed = HashCombine(mPixelSeed, dimension);
+    const uint32_t index = NestedUniformScramble(mSampleIndex, seed);
+    const glm::vec2 u(ToFloat(ReverseBits(LaineKarrasPermutation(index, Hash(seed ^ 0x1u)))),
+                      ToFloat(NestedUniformScramble(SobolSecond(index), Hash(seed ^ 0x2u))));
+    if (mType != Type::SobolBlueNoise)
+        return u;
+    return glm::vec2(WrapShift(u.x, BlueNoiseShift(dimension, 0)), WrapShift(u.y, BlueNoiseShift(dimension, 1)));
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+// Small PCG32 generator (O'Neill), 16 bytes of state
+struct Pcg32
+{
+	uint64_t state = 0x853c49e6748fea9bull;
+	uint64_t inc = 0xda3e39cb94b95bdbull;
+
+	void Seed(uint64_t _sequence, uint64_t _offset)
+	{
+		state = 0u;
+		inc = (_sequence << 1u) | 1u;
+		NextUint();
+		state += _offset;
+		NextUint();
+	}
+
+	uint32_t NextUint()
+	{
+		const uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		const uint32_t xorShifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		const uint32_t rot = uint32_t(old >> 59u);
+		return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31u));
+	}
+
+	float NextFloat() { return std::min(0x1.fffffep-1f, float(NextUint()) * 0x1p-32f); }
+};
+
+// Source of the random numbers for one path. Every value is a function of (pixel, sample index, dimension),
+// so threads share no generator state and a path is the same whichever thread traces it.
+// Each Get1D / Get2D call uses the next dimension; StartBounce moves to a fixed dimension per bounce
+// so the same decision at the same depth draws from the same dimension in every sample.
+class Sampler
+{
+public:
+	enum class Type
+	{
+		Random, // Independent uniform numbers from PCG32
+		Sobol, // Owen-scrambled Sobol (0,2)-sequence, padded to higher dimensions by per-dimension shuffles
+		// Sobol with one scramble shared by every pixel, toroidally shifted per pixel by a blue-noise mask:
+		// each pixel keeps its stratification while the error between neighbours is pushed to high frequencies,
+		// so images at a few samples per pixel look like fine grain rather than blotches
+		SobolBlueNoise
+	};
+
+	Sampler(Type _type, glm::ivec2 _pixel, uint32_t _sampleIndex, uint32_t _seed = 0);
+
+	// Offset inside the pixel for the camera ray
+	glm::vec2 GetPixel2D();
+
+	void StartBounce(int _bounce);
+
+	float Get1D();
+	glm::vec2 Get2D();
+
+	Type GetType() const { return mType; }
+
+	static constexpr uint32_t kPixelDimensions = 1;
+	static constexpr uint32_t kBounceDimensions = 11; // Upper bound on the calls one bounce makes (a guided bounce draws three more)
+
+private:
+	// Offset from the blue-noise mask for one channel of one dimension at this pixel
+	float BlueNoiseShift(uint32_t _dimension, uint32_t _channel) const;
+
+	Type mType;
+	glm::ivec2 mPixel;
+	uint32_t mPixelSeed;
+	uint32_t mSampleIndex;
+	uint32_t mDimension = 0;
+	Pcg32 mRng;
+};
\ No newline at end of file
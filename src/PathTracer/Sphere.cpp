@@ -52,9 +52,14 @@ bool Sphere::RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out)
         if (t < _tMin || t > _tMax) return false;
     }
 
-    // Fill hit record
     _out.t = t;
-    _out.p = _ray.origin + t * _ray.direction;
+    _out.primitive = 0;
+    return true;
+}
+
+void Sphere::ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const
+{
+    _out.p = _ray.origin + _hit.t * _ray.direction;
 
     // Outward normal (geometric)
     glm::vec3 outward = (_out.p - mPosition) / mRadius;
@@ -65,24 +70,25 @@ bool Sphere::RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out)
 
     _out.n = frontFace ? outward : -outward;
 
-    _out.mat = &mMaterial;
-    return true;
+    _out.mat = mMaterial;
 }
 
-void Sphere::UpdateUI()
+bool Sphere::UpdateUI()
 {
+    bool changed = false;
     if (ImGui::TreeNode(mName.c_str()))
     {
-        ImGui::DragFloat3("Position ", &mPosition[0], 0.1);
-        ImGui::DragFloat3("Rotation ", &mRotation[0], 1.0f);
-        ImGui::SliderFloat("Radius ", &mRadius, 0.0f, 20.0f);
-        ImGui::ColorEdit3("Albedo", &mMaterial.albedo.r);
-        ImGui::SliderFloat("Roughness", &mMaterial.roughness, 0.0f, 1.0f);
-        ImGui::SliderFloat("Metallic", &mMaterial.metallic, 0.0f, 1.0f);
-        ImGui::ColorEdit3("Emission Colour", &mMaterial.emissionColour.r);
-        ImGui::SliderFloat("Emission Strength", &mMaterial.emissionStrength, 0.0f, 100.0f);
-		ImGui::SliderFloat("Index of Refraction", &mMaterial.IOR, 1.0f, 3.0f);
-		ImGui::SliderFloat("Transmission", &mMaterial.transmission, 0.0f, 1.0f);
+        changed |= ImGui::DragFloat3("Position ", &mPosition[0], 0.1);
+        changed |= ImGui::DragFloat3("Rotation ", &mRotation[0], 1.0f);
+        changed |= ImGui::SliderFloat("Radius ", &mRadius, 0.0f, 20.0f);
+        changed |= ImGui::ColorEdit3("Albedo", &mMaterial.albedo.r);
+        changed |= ImGui::SliderFloat("Roughness", &mMaterial.roughness, 0.0f, 1.0f);
+        changed |= ImGui::SliderFloat("Metallic", &mMaterial.metallic, 0.0f, 1.0f);
+        changed |= ImGui::ColorEdit3("Emission Colour", &mMaterial.emissionColour.r);
+        changed |= ImGui::SliderFloat("Emission Strength", &mMaterial.emissionStrength, 0.0f, 100.0f);
+		changed |= ImGui::SliderFloat("Index of Refraction", &mMaterial.IOR, 1.0f, 3.0f);
+		changed |= ImGui::SliderFloat("Transmission", &mMaterial.transmission, 0.0f, 1.0f);
         ImGui::TreePop();
     }
+    return changed;
 }
\ No newline at end of file
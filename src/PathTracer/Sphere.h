@@ -14,8 +14,9 @@ public:
 	~Sphere() {}
 
 	bool RayIntersect(const Ray& _ray, float _tMin, float _tMax, Hit& _out) override;
+	void ComputeSurfaceInteraction(const Ray& _ray, const Hit& _hit, SurfaceInteraction& _out) const override;
 
-	void UpdateUI() override;
+	bool UpdateUI() override;
 
 	void SetRadius(float _radius) { mRadius = _radius; }
 	float GetRadius() { return mRadius; }
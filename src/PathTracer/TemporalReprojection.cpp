@@ -0,0 +1,141 @@
+#include "TemporalReprojection.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr int kRowsPerTask = 16;
+
+bool TemporalReprojection::Capture(const Film& _film, const Camera& _camera)
+{
+    mPending = false;
+    const std::vector<std::uint32_t>& samples = _film.Samples();
+    if (std::none_of(samples.begin(), samples.end(), [](std::uint32_t _s) { return _s != 0u; }))
+        return false;
+
+    mWidth = _film.Width();
+    mHeight = _film.Height();
+    const int n = _film.PixelCount();
+    mColour.resize(n);
+    mLumSq.resize(n);
+    mSamples.assign(samples.begin(), samples.end());
+    mNormal.resize(n);
+    mDepth.resize(n);
+
+    for (int p = 0; p < n; ++p)
+    {
+        const int x = p % mWidth, y = p / mWidth;
+        const SampleFeatures features = _film.FeaturesAt(x, y);
+        mColour[p] = _film.AverageAt(x, y);
+        mLumSq[p] = _film.MeanLumSqAt(x, y);
+        // Averaged normals shorten where surfaces meet; those pixels match nothing
+        const float length = glm::length(features.normal);
+        mNormal[p] = length > 0.5f ? features.normal / length : glm::vec3(0.0f);
+        mDepth[p] = features.depth;
+    }
+
+    mViewProjection = _camera.GetViewProjection();
+    mPosition = _camera.GetPosition();
+    mPending = true;
+    return true;
+}
+
+void TemporalReprojection::Apply(Film& _film, Camera& _camera, ThreadPool& _threadPool)
+{
+    if (!mPending)
+        return;
+    mPending = false;
+    mReusedFraction = 0.0f;
+    if (_film.Width() != mWidth || _film.Height() != mHeight)
+        return;
+
+    mReusedPerRow.assign(mHeight, 0);
+    for (int y0 = 0; y0 < mHeight; y0 += kRowsPerTask)
+    {
+        const int y1 = std::min(y0 + kRowsPerTask, mHeight);
+        _threadPool.EnqueueTask([=, this, &_film, &_camera] { ApplyRows(_film, _camera, y0, y1); });
+    }
+    _threadPool.WaitForCompletion();
+
+    int reused = 0;
+    for (int count : mReusedPerRow)
+        reused += count;
+    mReusedFraction = _film.PixelCount() ? float(reused) / float(_film.PixelCount()) : 0.0f;
+}
+
+void TemporalReprojection::ApplyRows(Film& _film, Camera& _camera, int _y0, int _y1)
+{
+    const glm::ivec2 size(mWidth, mHeight);
+
+    for (int y = _y0; y < _y1; ++y)
+    {
+        for (int x = 0; x < mWidth; ++x)
+        {
+            if (_film.SampleCountAt(x, y) == 0u)
+                continue;
+            const SampleFeatures features = _film.FeaturesAt(x, y);
+            const float length = glm::length(features.normal);
+            if (length <= 0.5f)
+                continue;
+            const glm::vec3 normal = features.normal / length;
+
+            // The point the pixel sees, at its depth along the ray through its centre, in the old view's raster
+            // space shifted so pixel centres land on whole numbers
+            const Ray ray = _camera.GetRay(glm::ivec2(x, y), size);
+            const glm::vec3 point = ray.origin + ray.direction * features.depth;
+            const glm::vec4 clip = mViewProjection * glm::vec4(point, 1.0f);
+            if (clip.w <= 0.0f)
+                continue;
+            const glm::vec2 raster = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2(size) - 0.5f;
+            const glm::ivec2 base(glm::floor(raster));
+            const glm::vec2 t = raster - glm::vec2(base);
+            const float expectedDepth = glm::length(point - mPosition);
+
+            // Bilinear over the taps that saw the same surface; the rest were occluded or saw something else
+            glm::vec3 colour(0.0f);
+            float lumSq = 0.0f;
+            float samples = 0.0f;
+            float weightSum = 0.0f;
+            for (int i = 0; i < 4; ++i)
+            {
+                const int hx = base.x + (i & 1);
+                const int hy = base.y + (i >> 1);
+                if (hx < 0 || hy < 0 || hx >= mWidth || hy >= mHeight)
+                    continue;
+
+                const int q = hy * mWidth + hx;
+                if (mSamples[q] == 0u
+                    || std::abs(mDepth[q] - expectedDepth) > mDepthTolerance * expectedDepth
+                    || glm::dot(mNormal[q], normal) < mNormalThreshold)
+                    continue;
+
+                const float w = ((i & 1) ? t.x : 1.0f - t.x) * ((i >> 1) ? t.y : 1.0f - t.y);
+                colour += mColour[q] * w;
+                lumSq += mLumSq[q] * w;
+                samples += float(mSamples[q]) * w;
+                weightSum += w;
+            }
+            if (weightSum < 1e-3f)
+                continue;
+
+            const uint32_t count = uint32_t(std::clamp(std::lround(samples / weightSum), 1l, long(mMaxHistory)));
+            _film.AddHistory(x, y, colour / weightSum, lumSq / weightSum, count);
+            ++mReusedPerRow[y];
+        }
+    }
+}
+
+bool TemporalReprojection::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Temporal reprojection"))
+    {
+        ImGui::Text("%.1f%% of pixels reused", mReusedFraction * 100.0f);
+        changed |= ImGui::SliderInt("Max history", &mMaxHistory, 1, 1024, "%d", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Depth tolerance", &mDepthTolerance, 0.005f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Normal threshold", &mNormalThreshold, 0.0f, 0.999f, "%.3f");
+        ImGui::TreePop();
+    }
+    return changed;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Camera.h"
+#include "Film.h"
+#include "ThreadPool.h"
+
+#include <GLM/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Carries an accumulation over a camera move instead of starting it again. The film's average colour, depth and
+// normal are kept with the old camera's matrices; once the new view's first frame is traced, each pixel's surface
+// (from its own depth along its ray) is projected into the old view and the history read there, bilinearly,
+// from the taps whose depth and normal match it, so surfaces that were hidden or off screen start afresh.
+// History counts as at most mMaxHistory samples, so while the camera keeps moving each frame is blended in
+// as an exponential moving average; once it stops the accumulation carries on from there.
+class TemporalReprojection
+{
+public:
+	// Keeps _film's accumulation, traced through _camera; false (and nothing kept) if it has no samples
+	bool Capture(const Film& _film, const Camera& _camera);
+	// Blends the captured history into _film, which holds the first frame traced through the moved _camera.
+	// Does nothing unless Capture succeeded since the last call, or if the film changed size
+	void Apply(Film& _film, Camera& _camera, ThreadPool& _threadPool);
+
+	// A capture waiting for Apply
+	bool IsPending() const { return mPending; }
+	// Share of pixels that took history in the last Apply
+	float GetReusedFraction() const { return mReusedFraction; }
+
+	void SetMaxHistory(int _samples) { mMaxHistory = _samples; }
+	int GetMaxHistory() const { return mMaxHistory; }
+
+	bool UpdateUI();
+
+private:
+	void ApplyRows(Film& _film, Camera& _camera, int _y0, int _y1);
+
+	int mMaxHistory = 32; // Samples the history counts as at most
+	float mDepthTolerance = 0.05f; // Relative depth difference that marks a disocclusion
+	float mNormalThreshold = 0.9f; // Cosine between normals below which surfaces differ
+
+	// Previous view
+	glm::mat4 mViewProjection{ 1.0f };
+	glm::vec3 mPosition{ 0.0f };
+	int mWidth = 0;
+	int mHeight = 0;
+	bool mPending = false;
+
+	std::vector<glm::vec3> mColour;
+	std::vector<float> mLumSq;
+	std::vector<std::uint32_t> mSamples;
+	std::vector<glm::vec3> mNormal;
+	std::vector<float> mDepth;
+
+	std::vector<int> mReusedPerRow; // Pixels that took history in each row, in the last Apply
+	float mReusedFraction = 0.0f;
+};
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "TileScheduler.h"
+
+#include <IMGUI/imgui.h>
+
+#include <algorithm>
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+using Milliseconds = std::chrono::duration<float, std::milli>;
+
+void TileScheduler::Restart()
+{
+    mNextTile.store(0, std::memory_order_relaxed);
+    mCompletedPasses = 0;
+}
+
+float TileScheduler::GetPassProgress() const
+{
+    const uint64_t tileCount = uint64_t(mTilesX) * mTilesY;
+    return tileCount ? float(mNextTile.load(std::memory_order_relaxed) % tileCount) / float(tileCount) : 0.0f;
+}
+
+void TileScheduler::RenderFrame(int _width, int _height, int _numTasks, ThreadPool& _threadPool, const TraceTile& _traceTile)
+{
+    const Clock::time_point start = Clock::now();
+
+    const int tilesX = (_width + kTileSize - 1) / kTileSize;
+    const int tilesY = (_height + kTileSize - 1) / kTileSize;
+    if (tilesX != mTilesX || tilesY != mTilesY)
+    {
+        mTilesX = tilesX;
+        mTilesY = tilesY;
+        mTileCost.assign(size_t(tilesX) * tilesY, 0.0f);
+        mSamplesPerPixel = 1;
+        Restart();
+    }
+    const uint64_t tileCount = mTileCost.size();
+    if (tileCount == 0)
+        return;
+
+    // Tiles not traced yet are taken to cost the average of the rest
+    auto averageCost = [&] {
+        float sum = 0.0f;
+        int measured = 0;
+        for (float cost : mTileCost)
+        {
+            if (cost > 0.0f)
+            {
+                sum += cost;
+                ++measured;
+            }
+        }
+        return measured ? sum / float(measured) : 0.0f;
+    };
+    const float defaultCost = averageCost();
+
+    // At most one pass per frame, so no two tasks ever hold the same tile
+    const uint64_t first = mNextTile.load(std::memory_order_relaxed);
+    const uint64_t last = first + tileCount;
+    const Milliseconds budget(mBudgetMs);
+
+    std::vector<float> busyMs(_numTasks, 0.0f);
+    for (int task = 0; task < _numTasks; ++task)
+    {
+        _threadPool.EnqueueTask([&, task] {
+            for (;;)
+            {
+                // Stop handing out tiles once a typical one would end more than halfway past the budget, so frames
+                // overrun about as often as they end early; unless none has been handed out yet
+                const Milliseconds halfTile(0.5f * defaultCost * float(mSamplesPerPixel));
+                if (Clock::now() - start + halfTile >= budget && mNextTile.load(std::memory_order_relaxed) != first)
+                    break;
+                const uint64_t index = mNextTile.fetch_add(1, std::memory_order_relaxed);
+                if (index >= last)
+                    break;
+
+                const int tile = int(index % tileCount);
+                const int x0 = (tile % mTilesX) * kTileSize;
+                const int y0 = (tile / mTilesX) * kTileSize;
+
+                // Fewer samples where they would take too much of the frame for one tile
+                const float cost = mTileCost[tile] > 0.0f ? mTileCost[tile] : defaultCost;
+                int samplesPerPixel = mSamplesPerPixel;
+                if (cost > 0.0f)
+                    samplesPerPixel = std::clamp(int(mBudgetMs * mMaxTileShare / cost), 1, samplesPerPixel);
+
+                const Clock::time_point tileStart = Clock::now();
+                _traceTile(x0, y0, std::min(x0 + kTileSize, _width), std::min(y0 + kTileSize, _height), samplesPerPixel);
+                const float ms = Milliseconds(Clock::now() - tileStart).count();
+                mTileCost[tile] = ms / float(samplesPerPixel);
+                busyMs[task] += ms;
+            }
+        });
+    }
+    _threadPool.WaitForCompletion();
+
+    // Tasks that found the pass finished still moved the counter on
+    const uint64_t next = std::min(mNextTile.load(std::memory_order_relaxed), last);
+    mNextTile.store(next, std::memory_order_relaxed);
+    mCompletedPasses = int(next / tileCount);
+
+    // Samples per pixel for a whole pass to fill the budget, at the parallelism this frame reached
+    float passCost = 0.0f;
+    const float fallbackCost = averageCost();
+    for (float cost : mTileCost)
+        passCost += cost > 0.0f ? cost : fallbackCost;
+    float totalBusyMs = 0.0f;
+    for (float ms : busyMs)
+        totalBusyMs += ms;
+    const float wallMs = Milliseconds(Clock::now() - start).count();
+    if (passCost > 0.0f && wallMs > 0.0f)
+    {
+        const float parallelism = std::max(1.0f, totalBusyMs / wallMs);
+        mSamplesPerPixel = std::clamp(int(mBudgetMs * parallelism / passCost), 1, mMaxSamplesPerPixel);
+    }
+}
+
+bool TileScheduler::UpdateUI()
+{
+    bool changed = false;
+    if (ImGui::TreeNode("Frame budget"))
+    {
+        ImGui::Text("Pass %.0f%% done, %d samples per pixel", GetPassProgress() * 100.0f, mSamplesPerPixel);
+        changed |= ImGui::SliderFloat("Budget (ms)", &mBudgetMs, 4.0f, 1000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat("Max tile share", &mMaxTileShare, 0.05f, 1.0f, "%.2f");
+        changed |= ImGui::SliderInt("Max samples per pixel", &mMaxSamplesPerPixel, 1, 256, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::TreePop();
+    }
+    return changed;
+}
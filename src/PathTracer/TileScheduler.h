@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Frame-time budgeted rendering. Instead of a whole pass over the image every frame, tasks take tiles in order
+// until the budget runs out, and the next frame carries on from the first tile not handed out. Each tile's cost
+// per sample is measured as it is traced; samples per pixel are then raised so that a pass fills the budget when
+// the scene is cheap, and capped per tile so that an expensive tile cannot hold the frame up on its own.
+class TileScheduler
+{
+public:
+	// _traceTile(x0, y0, x1, y1, samplesPerPixel) traces the pixels [x0, x1) x [y0, y1)
+	using TraceTile = std::function<void(int, int, int, int, int)>;
+
+	// Traces tiles of a _width x _height image with _numTasks tasks on _threadPool until the budget is spent,
+	// at most one pass per call. The frame always takes at least one tile, so it makes progress however small the budget
+	void RenderFrame(int _width, int _height, int _numTasks, ThreadPool& _threadPool, const TraceTile& _traceTile);
+
+	// The next frame starts from the first tile, as a new pass; call when the accumulation starts again
+	void Restart();
+
+	// Whether every tile was traced at least once since Restart
+	bool HasCompletedPass() const { return mCompletedPasses > 0; }
+	// Share of the current pass handed out so far
+	float GetPassProgress() const;
+
+	void SetBudget(float _milliseconds) { mBudgetMs = _milliseconds; }
+	float GetBudget() const { return mBudgetMs; }
+	int GetSamplesPerPixel() const { return mSamplesPerPixel; }
+
+	bool UpdateUI();
+
+	static constexpr int kTileSize = 16;
+
+private:
+	float mBudgetMs = 33.0f;
+	float mMaxTileShare = 0.5f; // Of the budget, that one tile's samples may take
+	int mMaxSamplesPerPixel = 64;
+
+	int mTilesX = 0;
+	int mTilesY = 0;
+	std::atomic<uint64_t> mNextTile{ 0 }; // Tiles handed out since Restart, over all passes
+	int mCompletedPasses = 0;
+	int mSamplesPerPixel = 1; // For a tile of average cost, in the coming frames
+
+	// Milliseconds one task spent per sample per pixel on each tile, last time it was traced; 0 until then
+	std::vector<float> mTileCost;
+};
\ No newline at end of file
@@ -0,0 +1,442 @@
+#include "TriangleBvh.h"
+
+#include <numeric>
+
+void TriangleBvh::Build(const std::vector<ModelLoader::Face>& _faces, const ModelLoader& _model)
+{
+    mFaces = &_faces;
+    mModel = &_model;
+
+    BuildBVH();
+    BuildOpacityMaps();
+}
+
+bool TriangleBvh::Intersect(const Ray& _ray, float _tMin, float _tMax, float& _t, uint32_t& _face, glm::vec2& _uv) const
+{
+    return Traverse(_ray, _tMin, _tMax, false, _t, _face, _uv);
+}
+
+bool TriangleBvh::Occluded(const Ray& _ray, float _tMin, float _tMax) const
+{
+    float t;
+    uint32_t face;
+    glm::vec2 uv;
+    return Traverse(_ray, _tMin, _tMax, true, t, face, uv);
+}
+
+bool TriangleBvh::Traverse(const Ray& _ray, float _tMin, float _tMax, bool _anyHit, float& _t, uint32_t& _face, glm::vec2& _uv) const
+{
+    // --- BVH traversal (iterative stack) ---
+    if (mNodes.empty()) return false;
+
+    const auto& faces = *mFaces;
+
+    float closestT = _tMax;
+    int bestFace = -1;
+    float bestU = 0.f, bestV = 0.f;
+
+    struct StackItem { uint32_t node; };
+    // Small fixed stack is enough for typical trees; fallback to vector if you prefer.
+    StackItem stack[64];
+    int sp = 0;
+    stack[sp++] = { 0u }; // root
+
+    while (sp)
+    {
+        const uint32_t nodeIdx = stack[--sp].node;
+        const BvhNode& node = mNodes[nodeIdx];
+
+        float t0, t1;
+        if (!RayAabb(_ray, node.bmin, node.bmax, closestT, t0, t1)) continue;
+
+        if (node.count > 0) // leaf
+        {
+            const uint32_t start = node.leftFirst;
+            const uint32_t end = start + node.count;
+            for (uint32_t i = start; i < end; ++i)
+            {
+                const uint32_t fi = mFaceIdx[i];
+                const auto& f = faces[fi];
+
+                const Opacity faceOpacity = mFaceOpacity[fi];
+                if (faceOpacity == Opacity::Transparent) continue; // Fully cut out, no need to test
+
+                float t, u, v;
+                if (!RayTriMT(_ray, f, t, u, v)) continue;
+                if (t < _tMin || t >= closestT) continue; // object-space near/closest
+
+                // Alpha MASK cutout: only micro-triangles the load-time classification could not decide touch the texture
+                if (faceOpacity == Opacity::Unknown && !PassesAlphaMask(fi, u, v)) continue;
+
+                closestT = t;
+                bestFace = int(fi);
+                bestU = u; bestV = v;
+
+                if (_anyHit) return true; // Shadow rays only need to know something is in the way
+            }
+        }
+        else
+        {
+            // Inner: push children (near first if you want)
+            const uint32_t left = node.leftFirst;
+            const uint32_t right = node.rightChild;
+
+            float lt0, lt1, rt0, rt1;
+            bool hitL = RayAabb(_ray, mNodes[left].bmin, mNodes[left].bmax, closestT, lt0, lt1);
+            bool hitR = RayAabb(_ray, mNodes[right].bmin, mNodes[right].bmax, closestT, rt0, rt1);
+
+            if (hitL && hitR) {
+                if (lt0 < rt0) { stack[sp++] = { right }; stack[sp++] = { left }; }
+                else { stack[sp++] = { left }; stack[sp++] = { right }; }
+            }
+            else if (hitL) { stack[sp++] = { left }; }
+            else if (hitR) { stack[sp++] = { right }; }
+        }
+    }
+
+    if (bestFace < 0) return false;
+
+    _t = closestT;
+    _face = uint32_t(bestFace);
+    _uv = glm::vec2(bestU, bestV);
+    return true;
+}
+
+bool TriangleBvh::IsOpaque(uint32_t _face, float _u, float _v) const
+{
+    const Opacity faceOpacity = mFaceOpacity[_face];
+    if (faceOpacity == Opacity::Unknown)
+        return PassesAlphaMask(_face, _u, _v);
+    return faceOpacity == Opacity::Opaque;
+}
+
+float TriangleBvh::OpaqueFraction(uint32_t _face) const
+{
+    const Opacity faceOpacity = mFaceOpacity[_face];
+    if (faceOpacity != Opacity::Unknown)
+        return faceOpacity == Opacity::Opaque ? 1.0f : 0.0f;
+
+    // Micro-triangles all have the same area in barycentric space
+    float covered = 0.0f;
+    int count = 0;
+    for (int i = 0; i < kMicroSubdiv; ++i)
+    {
+        for (int j = 0; i + j < kMicroSubdiv; ++j)
+        {
+            for (int upper = 0; upper < 2; ++upper)
+            {
+                if (upper && i + j + 2 > kMicroSubdiv) continue;
+
+                const int slot = (i * kMicroSubdiv + j) * 2 + upper;
+                const uint8_t packed = mMicroStates[size_t(mFaceMicroMap[_face]) + size_t(slot >> 2)];
+                const Opacity o = Opacity((packed >> ((slot & 3) * 2)) & 3u);
+                covered += (o == Opacity::Opaque) ? 1.0f : (o == Opacity::Unknown) ? 0.5f : 0.0f;
+                ++count;
+            }
+        }
+    }
+    return covered / float(count);
+}
+
+bool TriangleBvh::PassesAlphaMask(uint32_t _face, float _u, float _v) const
+{
+    const Opacity microOpacity = LookupMicroOpacity(_face, _u, _v);
+    if (microOpacity != Opacity::Unknown)
+        return microOpacity == Opacity::Opaque;
+
+    const auto& f = (*mFaces)[_face];
+    const auto& groups = mModel->GetMaterialGroups();
+    const auto& pbr = groups[size_t(f.materialGroup)].pbr;
+
+    const float w = 1.0f - _u - _v;
+    const glm::vec2 uv = w * f.a.texcoord + _u * f.b.texcoord + _v * f.c.texcoord;
+
+    float alpha = pbr.baseColorFactor.a;
+    if (pbr.baseColorTexIndex >= 0)
+    {
+        const auto& img = mModel->GetEmbeddedImages()[size_t(pbr.baseColorTexIndex)];
+        const glm::vec4 tex = ModelLoader::SampleImageNearest(img, uv);
+        alpha *= tex.a;
+    }
+    return alpha >= pbr.alphaCutoff; // Below the cutoff the texel is cut out
+}
+
+void TriangleBvh::BuildBVH()
+{
+    const auto& faces = *mFaces;
+    const size_t N = faces.size();
+    if (N == 0) throw std::runtime_error("TriangleBvh: no faces");
+
+    // Init index permutation
+    mFaceIdx.resize(N);
+    std::iota(mFaceIdx.begin(), mFaceIdx.end(), 0u);
+
+    // Precompute per-face bounds & centroids
+    mFaceBMin.resize(N);
+    mFaceBMax.resize(N);
+    mFaceCentroid.resize(N);
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        const auto& f = faces[i];
+
+        glm::vec3 p0 = f.a.position;
+        glm::vec3 p1 = f.b.position;
+        glm::vec3 p2 = f.c.position;
+
+        glm::vec3 bmin = glm::min(p0, glm::min(p1, p2));
+        glm::vec3 bmax = glm::max(p0, glm::max(p1, p2));
+
+        mFaceBMin[i] = bmin;
+        mFaceBMax[i] = bmax;
+        mFaceCentroid[i] = (p0 + p1 + p2) / 3.0f;
+    }
+
+    // Reserve a rough number of nodes (binary tree upper bound)
+    mNodes.clear();
+    mNodes.reserve(static_cast<size_t>(2 * N));
+
+    // Build root
+    BuildNode(/*start=*/0, /*count=*/static_cast<uint32_t>(N));
+}
+
+uint32_t TriangleBvh::BuildNode(uint32_t start, uint32_t count)
+{
+    const uint32_t nodeIndex = (uint32_t)mNodes.size();
+    mNodes.push_back(BvhNode{}); // placeholder
+    BvhNode& node = mNodes.back();
+
+    glm::vec3 bmin, bmax;
+    RangeBounds(start, count, bmin, bmax);
+    node.bmin = bmin;
+    node.bmax = bmax;
+
+    if (count <= mLeafThreshold) {
+        node.leftFirst = start;
+        node.count = count;          // LEAF
+        node.rightChild = 0;
+        return nodeIndex;
+    }
+
+    // choose split axis (using node bounds extent is fine)
+    glm::vec3 extent = bmax - bmin;
+    int axis = 0;
+    if (extent.y > extent.x && extent.y >= extent.z) axis = 1;
+    else if (extent.z > extent.x && extent.z >= extent.y) axis = 2;
+
+    const uint32_t mid = start + count / 2;
+    std::nth_element(mFaceIdx.begin() + start,
+        mFaceIdx.begin() + mid,
+        mFaceIdx.begin() + start + count,
+        [&](uint32_t ia, uint32_t ib) {
+            return mFaceCentroid[ia][axis] < mFaceCentroid[ib][axis];
+        });
+
+    uint32_t leftCount = mid - start;
+    uint32_t rightCount = count - leftCount;
+    if (leftCount == 0 || rightCount == 0) {
+        leftCount = count / 2;
+        rightCount = count - leftCount;
+    }
+
+    node.count = 0; // INNER
+
+    // Build children and record both indices explicitly
+    const uint32_t leftIdx = BuildNode(start, leftCount);
+    const uint32_t rightIdx = BuildNode(start + leftCount, rightCount);
+
+    node.leftFirst = leftIdx;
+    node.rightChild = rightIdx;
+
+    return nodeIndex;
+}
+
+void TriangleBvh::RangeBounds(uint32_t start, uint32_t count, glm::vec3& outMin, glm::vec3& outMax) const
+{
+    // Initialize with the first face in the range
+    const glm::vec3 firstMin = mFaceBMin[mFaceIdx[start]];
+    const glm::vec3 firstMax = mFaceBMax[mFaceIdx[start]];
+
+    glm::vec3 bmin = firstMin;
+    glm::vec3 bmax = firstMax;
+
+    for (uint32_t i = start + 1; i < start + count; ++i)
+    {
+        const uint32_t fi = mFaceIdx[i];
+        bmin = glm::min(bmin, mFaceBMin[fi]);
+        bmax = glm::max(bmax, mFaceBMax[fi]);
+    }
+
+    outMin = bmin;
+    outMax = bmax;
+}
+
+void TriangleBvh::BuildOpacityMaps()
+{
+    const auto& faces = *mFaces;
+    const auto& groups = mModel->GetMaterialGroups();
+    const size_t N = faces.size();
+
+    mFaceOpacity.assign(N, Opacity::Opaque);
+    mFaceMicroMap.assign(N, UINT32_MAX);
+    mMicroStates.clear();
+
+    std::vector<uint8_t> states(kMicroBytes);
+
+    for (size_t fi = 0; fi < N; ++fi)
+    {
+        const auto& f = faces[fi];
+        if (f.materialGroup < 0) continue;
+
+        const auto& pbr = groups[size_t(f.materialGroup)].pbr;
+        if (pbr.alphaMode != ModelLoader::PBRMaterial::AlphaMode::AlphaMask) continue;
+
+        // Classify each micro-triangle of a uniform barycentric subdivision
+        std::fill(states.begin(), states.end(), uint8_t(0));
+        bool anyOpaque = false, anyTransparent = false, anyUnknown = false;
+
+        auto uvAt = [&](int i, int j) {
+            const float u = float(i) / kMicroSubdiv;
+            const float v = float(j) / kMicroSubdiv;
+            return (1.0f - u - v) * f.a.texcoord + u * f.b.texcoord + v * f.c.texcoord;
+            };
+
+        for (int i = 0; i < kMicroSubdiv; ++i)
+        {
+            for (int j = 0; i + j < kMicroSubdiv; ++j)
+            {
+                for (int upper = 0; upper < 2; ++upper)
+                {
+                    if (upper && i + j + 2 > kMicroSubdiv) continue; // Upper triangle only exists inside the face
+
+                    const Opacity o = upper
+                        ? ClassifyUVTriangle(pbr, uvAt(i + 1, j), uvAt(i, j + 1), uvAt(i + 1, j + 1))
+                        : ClassifyUVTriangle(pbr, uvAt(i, j), uvAt(i + 1, j), uvAt(i, j + 1));
+
+                    anyOpaque |= (o == Opacity::Opaque);
+                    anyTransparent |= (o == Opacity::Transparent);
+                    anyUnknown |= (o == Opacity::Unknown);
+
+                    const int slot = (i * kMicroSubdiv + j) * 2 + upper;
+                    states[slot >> 2] |= uint8_t(uint8_t(o) << ((slot & 3) * 2));
+                }
+            }
+        }
+
+        if (!anyUnknown && !anyTransparent) continue; // Opaque, traversal never needs the texture
+        if (!anyUnknown && !anyOpaque)
+        {
+            mFaceOpacity[fi] = Opacity::Transparent;
+            continue;
+        }
+
+        mFaceOpacity[fi] = Opacity::Unknown;
+        mFaceMicroMap[fi] = uint32_t(mMicroStates.size());
+        mMicroStates.insert(mMicroStates.end(), states.begin(), states.end());
+    }
+}
+
+TriangleBvh::Opacity TriangleBvh::ClassifyUVTriangle(const ModelLoader::PBRMaterial& pbr, const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) const
+{
+    const float factorAlpha = pbr.baseColorFactor.a;
+    if (pbr.baseColorTexIndex < 0)
+        return factorAlpha < pbr.alphaCutoff ? Opacity::Transparent : Opacity::Opaque;
+
+    const auto& img = mModel->GetEmbeddedImages()[size_t(pbr.baseColorTexIndex)];
+    if (img.width <= 0 || img.height <= 0 || img.data.empty() || img.channels < 4)
+        return factorAlpha < pbr.alphaCutoff ? Opacity::Transparent : Opacity::Opaque; // Sampler returns alpha 1
+
+    // Conservative texel footprint of the UV triangle's bounds (nearest sampling, wrap repeat),
+    // padded by one texel so float rounding in the sampler can never reach an unvisited texel
+    const glm::vec2 uvMin = glm::min(uv0, glm::min(uv1, uv2));
+    const glm::vec2 uvMax = glm::max(uv0, glm::max(uv1, uv2));
+
+    const long long x0 = (long long)std::floor(uvMin.x * img.width) - 1;
+    const long long x1 = (long long)std::floor(uvMax.x * img.width) + 1;
+    const long long y0 = (long long)std::floor(uvMin.y * img.height) - 1;
+    const long long y1 = (long long)std::floor(uvMax.y * img.height) + 1;
+
+    const long long kMaxTexels = 4096; // Beyond this leave it to per-hit sampling
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > kMaxTexels) return Opacity::Unknown;
+
+    bool anyOpaque = false, anyTransparent = false;
+    for (long long y = y0; y <= y1; ++y)
+    {
+        const int iy = int(((y % img.height) + img.height) % img.height);
+        for (long long x = x0; x <= x1; ++x)
+        {
+            const int ix = int(((x % img.width) + img.width) % img.width);
+            const size_t idx = (size_t(iy) * img.width + size_t(ix)) * size_t(img.channels);
+            const float alpha = factorAlpha * (img.data[idx + 3] / 255.0f);
+
+            if (alpha < pbr.alphaCutoff) anyTransparent = true;
+            else anyOpaque = true;
+
+            if (anyOpaque && anyTransparent) return Opacity::Unknown;
+        }
+    }
+
+    return anyTransparent ? Opacity::Transparent : Opacity::Opaque;
+}
+
+TriangleBvh::Opacity TriangleBvh::LookupMicroOpacity(uint32_t face, float u, float v) const
+{
+    // Locate the micro-triangle containing barycentrics (u, v)
+    const float su = u * kMicroSubdiv;
+    const float sv = v * kMicroSubdiv;
+    const int i = glm::clamp(int(su), 0, kMicroSubdiv - 1);
+    const int j = glm::clamp(int(sv), 0, kMicroSubdiv - 1 - i);
+    const int upper = (i + j + 2 <= kMicroSubdiv && (su - i) + (sv - j) > 1.0f) ? 1 : 0;
+
+    const int slot = (i * kMicroSubdiv + j) * 2 + upper;
+    const uint8_t packed = mMicroStates[size_t(mFaceMicroMap[face]) + size_t(slot >> 2)];
+    return Opacity((packed >> ((slot & 3) * 2)) & 3u);
+}
+
+// Intersection helpers (slab + MT)
+
+bool TriangleBvh::RayAabb(const Ray& r, const glm::vec3& bmin, const glm::vec3& bmax, float tMax, float& t0, float& t1)
+{
+    // Slab test with lazy recip; caller can pass current closest tMax for pruning
+    const glm::vec3 invD = glm::vec3(1.0f) / r.direction;
+
+    glm::vec3 t0s = (bmin - r.origin) * invD;
+    glm::vec3 t1s = (bmax - r.origin) * invD;
+
+    glm::vec3 tsmaller = glm::min(t0s, t1s);
+    glm::vec3 tbigger = glm::max(t0s, t1s);
+
+    t0 = std::max(std::max(tsmaller.x, tsmaller.y), std::max(tsmaller.z, 0.0f));
+    t1 = std::min(std::min(tbigger.x, tbigger.y), std::min(tbigger.z, tMax));
+
+    return t1 >= t0;
+}
+
+bool TriangleBvh::RayTriMT(const Ray& r, const ModelLoader::Face& f, float& t, float& u, float& v)
+{
+    // MllerTrumbore
+    const glm::vec3 v0 = f.a.position;
+    const glm::vec3 v1 = f.b.position;
+    const glm::vec3 v2 = f.c.position;
+
+    const glm::vec3 e1 = v1 - v0;
+    const glm::vec3 e2 = v2 - v0;
+    const glm::vec3 p = glm::cross(r.direction, e2);
+    const float det = glm::dot(e1, p);
+
+    const float eps = 1e-8f;
+    if (fabsf(det) < eps) return false;           // parallel or degenerate
+
+    const float invDet = 1.0f / det;
+    const glm::vec3 tvec = r.origin - v0;
+
+    u = glm::dot(tvec, p) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    const glm::vec3 q = glm::cross(tvec, e1);
+    v = glm::dot(r.direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = glm::dot(e2, q) * invDet;
+    return t > eps;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Ray.h"
+
+#include "ModelLoader.h"
+
+#include <vector>
+#include <cstdint>
+
+// BVH over a face list plus the opacity micro-maps used for alpha-masked faces.
+// Used by Mesh in object space, and by CompiledScene over faces baked into world space.
+class TriangleBvh
+{
+public:
+	// Faces are referenced, not copied: _faces and _model must outlive the BVH
+	void Build(const std::vector<ModelLoader::Face>& _faces, const ModelLoader& _model);
+
+	// Closest hit in [_tMin, _tMax) for a ray with a normalised direction
+	bool Intersect(const Ray& _ray, float _tMin, float _tMax, float& _t, uint32_t& _face, glm::vec2& _uv) const;
+
+	// Any hit in [_tMin, _tMax), stopping at the first one found
+	bool Occluded(const Ray& _ray, float _tMin, float _tMax) const;
+
+	// False where the face is cut out by its alpha mask
+	bool IsOpaque(uint32_t _face, float _u, float _v) const;
+	// Approximate share of the face's area left by its alpha mask, from the micro-map (undecided cells count half)
+	float OpaqueFraction(uint32_t _face) const;
+
+	bool Empty() const { return mNodes.empty(); }
+
+private:
+	const std::vector<ModelLoader::Face>* mFaces = nullptr;
+	const ModelLoader* mModel = nullptr;
+
+	bool Traverse(const Ray& _ray, float _tMin, float _tMax, bool _anyHit, float& _t, uint32_t& _face, glm::vec2& _uv) const;
+
+	// BVH build helpers
+	void BuildBVH();
+	uint32_t BuildNode(uint32_t start, uint32_t count); // Returns node index
+
+	// Compute aabb for a range of faces (by indices)
+	void RangeBounds(uint32_t start, uint32_t count, glm::vec3& outMin, glm::vec3& outMax) const;
+
+	// Intersection helpers (for traversal)
+	static inline bool RayAabb(const Ray& r, const glm::vec3& bmin, const glm::vec3& bmax, float tMax, float& t0, float& t1);
+
+	static inline bool RayTriMT(const Ray& r, const ModelLoader::Face& f, float& t, float& u, float& v);
+
+	// BVH (flattened, index-based)
+	struct BvhNode
+	{
+		glm::vec3 bmin; // Node AABB
+		glm::vec3 bmax;
+		uint32_t leftFirst; // Inner: index of left child; leaf: start in mFaceIdx
+		uint32_t rightChild;
+		uint32_t count; // Inner: 0; leaf: number of faces in leaf
+	};
+
+	std::vector<BvhNode> mNodes; // Nodes in a flat array
+	std::vector<uint32_t> mFaceIdx; // Permutation of [0..numFaces), leaves are contiguous ranges
+
+	// Precomputed per-face bounds & centroids
+	std::vector<glm::vec3> mFaceBMin;
+	std::vector<glm::vec3> mFaceBMax;
+	std::vector<glm::vec3> mFaceCentroid;
+
+	unsigned mLeafThreshold = 2; // Max faces per leaf
+
+	// Opacity micro-maps for alpha-masked faces (built once at load)
+	enum class Opacity : uint8_t { Transparent = 0, Opaque = 1, Unknown = 2 };
+
+	void BuildOpacityMaps();
+	Opacity ClassifyUVTriangle(const ModelLoader::PBRMaterial& pbr, const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) const;
+	Opacity LookupMicroOpacity(uint32_t face, float u, float v) const;
+	// Full test for a face classified Unknown: micro-map first, texture only if that is undecided
+	bool PassesAlphaMask(uint32_t _face, float _u, float _v) const;
+
+	static constexpr int kMicroSubdiv = 8; // Micro-triangles per edge (kMicroSubdiv^2 per face)
+	static constexpr int kMicroSlots = 2 * kMicroSubdiv * kMicroSubdiv; // (cell, upper/lower) slots, half unused
+	static constexpr int kMicroBytes = kMicroSlots / 4; // 2 bits per slot
+
+	std::vector<Opacity> mFaceOpacity; // Whole-face classification
+	std::vector<uint32_t> mFaceMicroMap; // Byte offset into mMicroStates for Unknown faces, UINT32_MAX otherwise
+	std::vector<uint8_t> mMicroStates; // Packed 2-bit Opacity per micro-triangle slot
+};
\ No newline at end of file
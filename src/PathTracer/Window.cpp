@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <filesystem>
+#include <fstream>
 
 Window::Window(int _width, int _height, const char* _title) : mWidth(_width), mHeight(_height)
 {
@@ -188,6 +189,25 @@ bool Window::SaveImagePNG(const std::string& _filename, const std::vector<uint8_
     return ok != 0;
 }
 
+bool Window::SaveImagePFM(const std::string& _filename, const std::vector<glm::vec3>& _rgb, int _width, int _height)
+{
+    if (_width <= 0 || _height <= 0 || _rgb.size() != size_t(_width) * size_t(_height))
+        return false;
+
+    std::error_code ec;
+    std::filesystem::path p(_filename);
+    if (p.has_parent_path()) std::filesystem::create_directories(p.parent_path(), ec);
+
+    std::ofstream file(_filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    // PFM rows run bottom to top, the same order as the display buffer, so no flip is needed
+    file << "PF\n" << _width << " " << _height << "\n-1.0\n";
+    file.write(reinterpret_cast<const char*>(_rgb.data()), std::streamsize(_rgb.size() * sizeof(glm::vec3)));
+    return bool(file);
+}
+
 void Window::Draw()
 {
     glClearColor(0, 0, 0, 1);
@@ -2,6 +2,7 @@
 
 #include <SDL2/sdl.h>
 #include <GL/glew.h>
+#include <GLM/glm.hpp>
 
 #include <string>
 #include <vector>
@@ -16,6 +17,8 @@ public:
     void DrawScreen(const std::vector<uint8_t>& _rgba8); // Upload and draw
 
     bool SaveImagePNG(const std::string& _filename, const std::vector<uint8_t>& _rgba8);
+    // Linear float RGB sized _width*_height (the image's own size, not the window's), written as a little-endian PFM
+    bool SaveImagePFM(const std::string& _filename, const std::vector<glm::vec3>& _rgb, int _width, int _height);
 
     int  Width()  const { return mWidth; }
     int  Height() const { return mHeight; }
@@ -2,44 +2,136 @@
 #include "Window.h"
 #include "Sphere.h"
 #include "Box.h"
+#include "PrimitiveBatch.h"
 #include "Mesh.h"
 #include "PathTracer.h"
+#include "EnvironmentMap.h"
 #include "Camera.h"
+#include "Sampler.h"
 #include "Timer.h"
 #include "ThreadPool.h"
+#include "Denoiser.h"
+#include "TemporalReprojection.h"
+#include "TileScheduler.h"
 
 #include <IMGUI/imgui.h>
 #include <IMGUI/imgui_impl_sdl2.h>
 #include <IMGUI/imgui_impl_opengl3.h>
 
 #include <iostream>
+#include <algorithm>
 
-void TracePixels(int _fromy, int _toy, glm::ivec2 _winSize, std::shared_ptr<Camera> _camera, std::shared_ptr<PathTracer> _pathTracer, std::shared_ptr<Film> _film, int _depth, bool _albedoOnly)
+// Per-frame options shared by every tracing task
+struct TraceSettings
 {
-	for (int y = _fromy; y <= _toy && y < _winSize.y; ++y)
+	int depth = 5;
+	bool albedoOnly = false;
+	Integrator integrator = Integrator::Path; // Albedo-only previews always use the path integrator
+	bool wavefront = false; // Path integrator only
+	Sampler::Type samplerType = Sampler::Type::SobolBlueNoise;
+	bool adaptive = false; // Skip pixels in tiles the film reports as converged
+	int samplesPerPixel = 1;
+	int pixelScale = 1; // Each film pixel spans this many window pixels per side (progressive previews)
+};
+
+// Traces the film pixels [_x0, _x1) x [_y0, _y1)
+void TracePixels(int _x0, int _y0, int _x1, int _y1, glm::ivec2 _winSize, std::shared_ptr<Camera> _camera, std::shared_ptr<PathTracer> _pathTracer, std::shared_ptr<Film> _film, const TraceSettings& _settings)
+{
+	// Film pixels cover whole blocks of the window, sampled across the block
+	const int scale = _settings.pixelScale;
+
+	// Samples collect in a buffer of this task's own, merged into the film once at the end
+	static thread_local FilmTile tile;
+	tile.Reset(_x0, _y0, _x1, _y1);
+
+	if (_settings.wavefront)
+	{
+		// Generate the whole band's camera rays, trace them as one batch, then accumulate
+		static thread_local std::vector<Ray> rays;
+		static thread_local std::vector<Sampler> samplers;
+		static thread_local std::vector<glm::ivec2> pixels;
+		static thread_local std::vector<glm::vec3> colours;
+		static thread_local std::vector<SampleFeatures> features;
+		rays.clear();
+		samplers.clear();
+		pixels.clear();
+		for (int y = _y0; y < _y1; ++y)
+		{
+			for (int x = _x0; x < _x1; ++x)
+			{
+				if (_settings.adaptive && _film->IsConverged(x, y))
+					continue;
+
+				// Sample indices continue from the film's count so each pixel walks its own sequence in order
+				const uint32_t firstSample = _film->SampleCountAt(x, y);
+				for (int s = 0; s < _settings.samplesPerPixel; ++s)
+				{
+					samplers.emplace_back(_settings.samplerType, glm::ivec2(x, y), firstSample + uint32_t(s));
+					rays.push_back(_camera->GetRay(glm::ivec2(x, y) * scale, _winSize, samplers.back().GetPixel2D() * float(scale)));
+					pixels.push_back(glm::ivec2(x, y));
+				}
+			}
+		}
+
+		_pathTracer->TraceBatch(rays, samplers, _settings.depth, _settings.albedoOnly, colours, &features);
+
+		for (size_t i = 0; i < pixels.size(); ++i)
+			tile.AddSample(pixels[i].x, pixels[i].y, colours[i], features[i]);
+		_film->MergeTile(tile);
+		_pathTracer->PublishStats();
+		return;
+	}
+
+	const bool bidirectional = _settings.integrator == Integrator::Bidirectional && !_settings.albedoOnly;
+	uint64_t lightPaths = 0;
+
+	for (int y = _y0; y < _y1; ++y)
 	{
-		for (int x = 0; x < _winSize.x; ++x)
+		for (int x = _x0; x < _x1; ++x)
 		{
-			Ray ray = _camera->GetRay({ x, y }, _winSize);
-			glm::vec3 colour = _pathTracer->TraceRay(ray, _depth, _albedoOnly);
-			_film->AddSample(x, y, colour);
+			if (_settings.adaptive && _film->IsConverged(x, y))
+				continue;
+
+			for (int s = 0; s < _settings.samplesPerPixel; ++s)
+			{
+				Sampler sampler(_settings.samplerType, glm::ivec2(x, y), _film->SampleCountAt(x, y) + tile.SampleCountAt(x, y));
+				Ray ray = _camera->GetRay(glm::ivec2(x, y) * scale, _winSize, sampler.GetPixel2D() * float(scale));
+				SampleFeatures features;
+				glm::vec3 colour;
+				if (bidirectional)
+				{
+					colour = _pathTracer->TraceBidirectional(ray, sampler, _settings.depth, *_camera, _winSize, *_film, &features);
+					++lightPaths;
+				}
+				else
+				{
+					colour = _pathTracer->TraceRay(ray, sampler, _settings.depth, _settings.albedoOnly, &features);
+				}
+				tile.AddSample(x, y, colour, features);
+			}
 		}
 	}
+	_film->MergeTile(tile);
+	_pathTracer->PublishStats();
+
+	if (lightPaths)
+		_film->AddLightPaths(lightPaths);
 }
 
-void RayTraceParallel(ThreadPool& threadPool, int _numTasks, glm::ivec2 _winSize, std::shared_ptr<Camera> _camera, std::shared_ptr<PathTracer> _pathTracer, std::shared_ptr<Film> _film, int _depth, bool _albedoOnly)
+void RayTraceParallel(ThreadPool& threadPool, int _numTasks, glm::ivec2 _winSize, std::shared_ptr<Camera> _camera, std::shared_ptr<PathTracer> _pathTracer, std::shared_ptr<Film> _film, const TraceSettings& _settings)
 {
-	// Calculate the number of rows each thread should process
-	int rowsPerThread = std::ceil(_winSize.y / static_cast<float>(_numTasks));
+	// Calculate the number of film rows each thread should process
+	const int height = _film->Height();
+	int rowsPerThread = std::ceil(height / static_cast<float>(_numTasks));
 
 	// Enqueue tasks
 	for (int i = 0; i < _numTasks; ++i)
 	{
 		int startY = i * rowsPerThread; // Starting row for this task
-		int endY = std::min(startY + rowsPerThread, _winSize.y); // Ending row for this task
+		int endY = std::min(startY + rowsPerThread, height); // Ending row for this task
 
 		// Enqueue the task to trace pixels for the assigned rows
-		threadPool.EnqueueTask([=] { TracePixels(startY, endY - 1, _winSize, _camera, _pathTracer, _film, _depth, _albedoOnly); });
+		threadPool.EnqueueTask([=] { TracePixels(0, startY, _film->Width(), endY, _winSize, _camera, _pathTracer, _film, _settings); });
 	}
 
 	// Wait for all tasks to complete
@@ -349,6 +441,22 @@ int main()
 	//pathTracer->AddRayObject(light);
 
 
+	//// --- Procedural sphere field (one SoA batch instead of thousands of objects) ---
+	//{
+	//	auto field = std::make_shared<PrimitiveBatch>("Sphere Field");
+	//	Material fieldMat; fieldMat.albedo = glm::vec3(0.8f, 0.8f, 0.8f);
+	//	uint32_t fieldMatIndex = field->AddMaterial(fieldMat);
+	//	for (int z = 0; z < 100; ++z)
+	//	{
+	//		for (int x = 0; x < 100; ++x)
+	//		{
+	//			field->AddSphere(glm::vec3(x * 0.3f, 0.1f, z * 0.3f), 0.1f, fieldMatIndex);
+	//		}
+	//	}
+	//	pathTracer->AddRayObject(field);
+	//}
+
+
 	int numThreads = 32;
 	int numTasks = 128;
 	ThreadPool threadPool(numThreads);
@@ -357,12 +465,61 @@ int main()
 
 	Timer timer;
 	float msPerFrame = 0.0f;
+	float avgPathLength = 0.0f;
+	float samplesPerSecond = 0.0f;
+	float materialSwitchRate = 0.0f;
+	float hitJumpRate = 0.0f;
 
 	Timer accumulationTimer;
 	int frameCounter = 0;
 
 	bool albedoOnly = true;
 
+	Integrator integrator = Integrator::Path;
+	bool wavefront = false;
+
+	Sampler::Type samplerType = Sampler::Type::SobolBlueNoise;
+
+	bool adaptiveSampling = false;
+	float noiseThreshold = 0.02f;
+	int adaptiveMinSamples = 16;
+	const char* integratorNames[] = { "Path tracing", "Bidirectional" };
+	const char* samplerNames[] = { "Random (PCG)", "Sobol (Owen scrambled)", "Sobol + blue noise" };
+	const char* layerNames[] = { "Colour", "Albedo", "Normal", "Depth", "Object id", "Sample count" };
+
+	// Filtered copy of the accumulation, shown and saved in its place while denoising is on
+	Denoiser denoiser;
+	bool denoise = false;
+	std::vector<glm::vec3> denoised;
+	float denoiseMs = 0.0f;
+	// Progressive resolution: after a camera move, frames are traced into a coarse film at 1/8 of the window's
+	// resolution, then 1/4 and 1/2 while the camera stays still, upsampled for display, before accumulation
+	// resumes at full resolution
+	constexpr int kCoarsestPreviewLevel = 3;
+	bool progressiveResolution = true;
+	int previewLevel = 0; // A film pixel covers 2^level window pixels per side; 0 traces the full film
+	bool showingPreview = false;
+	auto previewFilm = std::make_shared<Film>();
+	std::vector<glm::vec3> previewImage;
+	// Temporal reprojection: a camera move keeps what it can of the accumulation instead. Path integrator only,
+	// since light splats are averaged over the whole image rather than per pixel
+	TemporalReprojection reprojection;
+	bool temporalReprojection = true;
+	// Frame-time budget: full-resolution frames trace tiles until the budget is spent instead of a whole pass
+	TileScheduler scheduler;
+	bool frameBudget = false;
+	glm::vec3 lastCameraPosition = camera->GetPosition();
+	glm::vec3 lastCameraRotation = camera->GetRotation();
+
+	auto resolveImage = [&]() -> const std::vector<std::uint8_t>&
+		{
+			if (showingPreview)
+				return film->ResolveToRGBA8(previewImage, threadPool);
+			if (denoise && !albedoOnly && film->GetDisplayLayer() == AovLayer::Colour && (int)denoised.size() == film->PixelCount())
+				return film->ResolveToRGBA8(denoised, threadPool);
+			return film->ResolveToRGBA8(threadPool);
+		};
+
 	bool showDisplay = true;
 
 	bool lockRendering = false;
@@ -370,6 +527,25 @@ int main()
 	bool pauseRendering = false;
 
 	char imageNameBuf[256] = "";
+	bool saveAovs = false;
+
+	// Cube-map skies from assets/skyboxes, or an equirectangular image (.hdr etc.) typed in by path
+	const char* environmentNames[] = { "None", "Sky", "Test sky", "Image file" };
+	const char* environmentPaths[] = { "", "../assets/skyboxes/sky", "../assets/skyboxes/testSky", "" };
+	int environmentIndex = 0;
+	char environmentFileBuf[256] = "../assets/skyboxes/";
+	auto loadEnvironment = [&](const std::string& _path)
+		{
+			try
+			{
+				pathTracer->SetEnvironment(_path.empty() ? nullptr : std::make_shared<EnvironmentMap>(_path));
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << e.what() << std::endl;
+				pathTracer->SetEnvironment(nullptr);
+			}
+		};
 
 	SDL_Event event;
 
@@ -465,8 +641,18 @@ int main()
 			}
 
 			ImGui::Checkbox("Pause rendering", &pauseRendering);
+			ImGui::Checkbox("Progressive resolution", &progressiveResolution);
+			ImGui::Checkbox("Temporal reprojection", &temporalReprojection);
+			if (temporalReprojection)
+				reprojection.UpdateUI();
+			ImGui::Checkbox("Frame time budget", &frameBudget);
+			if (frameBudget)
+				scheduler.UpdateUI();
 
             ImGui::Text("%.3f ms", msPerFrame);
+			ImGui::Text("%.2f Msamples/s, avg path length %.2f", samplesPerSecond / 1e6f, avgPathLength);
+			if (wavefront && integrator == Integrator::Path)
+				ImGui::Text("Material switches %.1f%%, hit jumps %.1f%%", materialSwitchRate * 100.0f, hitJumpRate * 100.0f);
 
 			ImGui::Text("%.0f seconds", accumulationTimer.GetElapsedSeconds());
 			ImGui::Text("%i frames", frameCounter);
@@ -504,11 +690,29 @@ int main()
 			if (ImGui::Button("Save Image"))
 			{
 				std::string filePathStr = "../assets/outputs/" + std::string(imageNameBuf) + ".png";
-				if (!window.SaveImagePNG(filePathStr, film->ResolveToRGBA8()))
+				if (!window.SaveImagePNG(filePathStr, resolveImage()))
 				{
 					std::cout << "Failed to save image to " << filePathStr << std::endl;
 				}
+
+				// Every layer next to the image, as a viewable PNG and as linear floats
+				if (saveAovs)
+				{
+					std::vector<std::uint8_t> layer8;
+					std::vector<glm::vec3> layer;
+					for (int i = 0; i < static_cast<int>(AovLayer::Count); ++i)
+					{
+						const AovLayer aov = static_cast<AovLayer>(i);
+						const std::string base = "../assets/outputs/" + std::string(imageNameBuf) + "_" + Film::GetLayerName(aov);
+						film->ResolveLayerToRGBA8(aov, layer8);
+						film->GetLayer(aov, layer);
+						if (!window.SaveImagePNG(base + ".png", layer8) || !window.SaveImagePFM(base + ".pfm", layer, film->Width(), film->Height()))
+							std::cout << "Failed to save layer to " << base << std::endl;
+					}
+				}
 			}
+			ImGui::SameLine();
+			ImGui::Checkbox("Save AOVs", &saveAovs);
 
 			if (!lockRendering)
 			{
@@ -543,6 +747,113 @@ int main()
 
 			ImGui::SliderInt("Ray Depth", &rayDepth, 1, 10);
 
+			int rouletteDepth = pathTracer->GetRouletteMinDepth();
+			if (ImGui::SliderInt("Russian roulette depth", &rouletteDepth, 1, 10))
+				pathTracer->SetRouletteMinDepth(rouletteDepth);
+
+			bool nextEvent = pathTracer->GetNextEventEstimation();
+			if (ImGui::Checkbox("Next event estimation", &nextEvent))
+				pathTracer->SetNextEventEstimation(nextEvent);
+
+			bool pathGuiding = pathTracer->GetPathGuiding();
+			if (ImGui::Checkbox("Path guiding", &pathGuiding))
+				pathTracer->SetPathGuiding(pathGuiding);
+			if (pathGuiding && pathTracer->GetGuidingField().UpdateUI())
+			{
+				// Early iterations are noisier, so start the accumulation again with the training
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+
+			bool causticPhotons = pathTracer->GetCausticPhotons();
+			if (ImGui::Checkbox("Caustic photons", &causticPhotons))
+				pathTracer->SetCausticPhotons(causticPhotons);
+			if (causticPhotons && pathTracer->GetPhotonMap().UpdateUI())
+			{
+				// The gather radius shrinks with the frame count, so start both again
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+
+			// A biased preview, so it is not mixed into an accumulation made without it
+			bool radianceCaching = pathTracer->GetRadianceCaching();
+			if (ImGui::Checkbox("Radiance cache", &radianceCaching))
+			{
+				pathTracer->SetRadianceCaching(radianceCaching);
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+			if (radianceCaching && pathTracer->GetRadianceCache().UpdateUI())
+			{
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+
+			int samplerIndex = static_cast<int>(samplerType);
+			if (ImGui::Combo("Sampler", &samplerIndex, samplerNames, IM_ARRAYSIZE(samplerNames)))
+			{
+				// Pixels carry on from their sample count, which indexes the old sequence; start them all again
+				samplerType = static_cast<Sampler::Type>(samplerIndex);
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+
+			ImGui::Checkbox("Adaptive sampling", &adaptiveSampling);
+			if (adaptiveSampling)
+			{
+				ImGui::SliderFloat("Noise threshold", &noiseThreshold, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderInt("Min samples", &adaptiveMinSamples, 2, 256);
+				ImGui::Text("%.1f%% converged", film->GetConvergedFraction() * 100.0f);
+			}
+			int displayLayer = static_cast<int>(film->GetDisplayLayer());
+			if (ImGui::Combo("Display layer", &displayLayer, layerNames, IM_ARRAYSIZE(layerNames)))
+				film->SetDisplayLayer(static_cast<AovLayer>(displayLayer));
+
+			ImGui::Checkbox("Denoise", &denoise);
+			if (denoise)
+			{
+				denoiser.UpdateUI();
+				ImGui::Text("Denoise %.2f ms", denoiseMs);
+			}
+
+			// The estimators differ in what they splat, so do not mix their samples
+			int integratorIndex = static_cast<int>(integrator);
+			if (ImGui::Combo("Integrator", &integratorIndex, integratorNames, IM_ARRAYSIZE(integratorNames)))
+			{
+				integrator = static_cast<Integrator>(integratorIndex);
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+			}
+
+			if (integrator == Integrator::Path)
+				ImGui::Checkbox("Wavefront integrator", &wavefront);
+			if (integrator == Integrator::Path && wavefront)
+			{
+				bool sortHits = pathTracer->GetSortHits();
+				if (ImGui::Checkbox("Sort hits by material", &sortHits))
+					pathTracer->SetSortHits(sortHits);
+				bool sortRays = pathTracer->GetSortRays();
+				if (ImGui::Checkbox("Sort rays before traversal", &sortRays))
+					pathTracer->SetSortRays(sortRays);
+			}
+
+			if (ImGui::Combo("Environment", &environmentIndex, environmentNames, IM_ARRAYSIZE(environmentNames)) && environmentIndex != 3)
+				loadEnvironment(environmentPaths[environmentIndex]);
+			if (environmentIndex == 3)
+			{
+				ImGui::InputText("Environment file", environmentFileBuf, IM_ARRAYSIZE(environmentFileBuf));
+				if (ImGui::Button("Load environment"))
+					loadEnvironment(environmentFileBuf);
+			}
+			if (pathTracer->GetEnvironment() && pathTracer->GetEnvironment()->UpdateUI())
+				pathTracer->MarkSceneDirty();
+
 			if(ImGui::SliderInt("Number of threads", &numThreads, 1, 128))
 			{
 				threadPool.Shutdown();
@@ -555,7 +866,8 @@ int main()
 			{
 				for (auto& rayObject : pathTracer->GetRayObjects())
 				{
-					rayObject->UpdateUI();
+					if (rayObject->UpdateUI())
+						pathTracer->MarkSceneDirty();
 				}
 			}
 
@@ -564,13 +876,114 @@ int main()
 
 		if (!pauseRendering)
 		{
-			frameCounter++;
-			RayTraceParallel(threadPool, numTasks, glm::ivec2(winWidth, winHeight), camera, pathTracer, film, rayDepth, albedoOnly);
+			// A camera move starts the accumulation again, with what reprojects from the old view or else from
+			// the coarsest preview if progressive
+			if (camera->GetPosition() != lastCameraPosition || camera->GetRotation() != lastCameraRotation)
+			{
+				Camera previousCamera = *camera;
+				previousCamera.SetPosition(lastCameraPosition);
+				previousCamera.SetRotation(lastCameraRotation);
+				// A history still waiting for a pass to finish is kept, as the film since holds only part of one
+				const bool reproject = temporalReprojection && !albedoOnly && integrator == Integrator::Path
+					&& (reprojection.IsPending() || reprojection.Capture(*film, previousCamera));
+
+				lastCameraPosition = camera->GetPosition();
+				lastCameraRotation = camera->GetRotation();
+				film->Reset();
+				accumulationTimer.Reset();
+				frameCounter = 0;
+				previewLevel = (progressiveResolution && !reproject) ? kCoarsestPreviewLevel : 0;
+				scheduler.Restart();
+			}
+
+			// Previews are thrown away, so only full-resolution frames count towards the accumulation
+			const bool preview = previewLevel > 0;
+			std::shared_ptr<Film> target = film;
+			if (preview)
+			{
+				const int scale = 1 << previewLevel;
+				previewFilm->Resize((film->Width() + scale - 1) / scale, (film->Height() + scale - 1) / scale);
+				target = previewFilm;
+			}
+			else
+			{
+				frameCounter++;
+			}
+			pathTracer->CompileScene();
+			pathTracer->ResetStats();
+
+			Timer traceTimer;
+			TraceSettings settings;
+			settings.depth = rayDepth;
+			settings.albedoOnly = albedoOnly;
+			settings.integrator = preview ? Integrator::Path : integrator; // Previews only splat into the full film
+			settings.wavefront = wavefront && settings.integrator == Integrator::Path;
+			settings.samplerType = samplerType;
+			settings.adaptive = adaptiveSampling && !albedoOnly && !preview;
+			settings.pixelScale = 1 << previewLevel;
+			// Budgeted frames choose their own samples per pixel; previews are cheap enough to always finish
+			const bool budgeted = frameBudget && !preview && !albedoOnly;
+			// Samples freed by converged tiles go to the rest, keeping the work per frame about the same
+			if (settings.adaptive && !budgeted)
+				settings.samplesPerPixel = std::clamp(int(1.0f / std::max(0.125f, 1.0f - film->GetConvergedFraction())), 1, 8);
+
+			// Only TraceRay gathers photons
+			if (pathTracer->GetCausticPhotons() && !settings.wavefront && settings.integrator == Integrator::Path && !albedoOnly)
+				pathTracer->TracePhotons(threadPool, frameCounter, rayDepth);
+
+			if (budgeted)
+			{
+				scheduler.RenderFrame(film->Width(), film->Height(), numTasks, threadPool, [&](int _x0, int _y0, int _x1, int _y1, int _samplesPerPixel)
+					{
+						TraceSettings tileSettings = settings;
+						tileSettings.samplesPerPixel = _samplesPerPixel;
+						TracePixels(_x0, _y0, _x1, _y1, glm::ivec2(winWidth, winHeight), camera, pathTracer, film, tileSettings);
+					});
+			}
+			else
+			{
+				RayTraceParallel(threadPool, numTasks, glm::ivec2(winWidth, winHeight), camera, pathTracer, target, settings);
+			}
+			// The first pass after a move supplies the depth and normals the history is matched against
+			if (!preview && (!budgeted || scheduler.HasCompletedPass()))
+				reprojection.Apply(*film, *camera, threadPool);
+			if (settings.adaptive)
+				film->UpdateConvergence(noiseThreshold, uint32_t(adaptiveMinSamples));
+			// Only TraceRay guides and feeds the radiance cache, so the other integrators train nothing
+			if (pathTracer->GetPathGuiding() && !settings.wavefront && settings.integrator == Integrator::Path && !albedoOnly)
+				pathTracer->GetGuidingField().EndFrame();
+			if (pathTracer->GetRadianceCaching() && !settings.wavefront && settings.integrator == Integrator::Path && !albedoOnly)
+				pathTracer->GetRadianceCache().EndFrame();
+			const float traceSeconds = traceTimer.GetElapsedSeconds();
+
+			// Each still frame refines the preview one level, until the full film takes over
+			showingPreview = preview;
+			if (preview)
+			{
+				previewFilm->Upsample(settings.pixelScale, film->Width(), film->Height(), previewImage);
+				--previewLevel;
+			}
+
+			if (denoise && !albedoOnly && !preview)
+			{
+				Timer denoiseTimer;
+				denoiser.Denoise(*film, threadPool, denoised);
+				denoiseMs = denoiseTimer.GetElapsedMilliseconds();
+			}
+
+			const uint64_t paths = pathTracer->GetPathCount();
+			avgPathLength = paths ? float(pathTracer->GetBounceCount()) / float(paths) : 0.0f;
+			samplesPerSecond = traceSeconds > 0.0f ? float(paths) / traceSeconds : 0.0f;
+
+			// Both counters tick once per ray segment, so the bounce count is the denominator
+			const uint64_t segments = pathTracer->GetBounceCount();
+			materialSwitchRate = segments ? float(pathTracer->GetMaterialSwitchCount()) / float(segments) : 0.0f;
+			hitJumpRate = segments ? float(pathTracer->GetHitJumpCount()) / float(segments) : 0.0f;
 		}
 
 		if (showDisplay)
 		{
-			window.DrawScreen(film->ResolveToRGBA8());
+			window.DrawScreen(resolveImage());
 		}
 
 		// Draws the GUI